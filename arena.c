@@ -0,0 +1,79 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+
+// Initializes an empty arena, whose memory is charged to mem_class
+void
+arena_init(arena_t *arena, mem_class_t mem_class)
+{
+	arena->mem_class = mem_class;
+	arena->data = NULL;
+	arena->size = 0;
+	arena->capacity = 0;
+	arena->unused = 0;
+}
+
+// Frees the strings of an arena
+void
+arena_free(arena_t *arena)
+{
+	mem_free(arena->mem_class, arena->data);
+	arena_init(arena, arena->mem_class);
+}
+
+// Makes room for capacity bytes in an arena (which never shrinks)
+void
+arena_reserve(arena_t *arena, uint capacity)
+{
+	if (capacity <= arena->capacity)
+		return;
+
+	arena->data = (char *)mem_realloc(arena->mem_class, arena->data,
+		capacity);
+	DIE(!arena->data, "arena->data realloc failed");
+	arena->capacity = capacity;
+}
+
+/**
+ * @brief Appends a string to an arena (which doubles when it is full)
+ *
+ * @param arena the arena
+ * @param str the string
+ * @param len its length
+ * @return uint the offset of the copy
+ */
+uint
+arena_append(arena_t *arena, const char *str, uint len)
+{
+	// An empty arena takes just the string, a full one doubles
+	if (arena->size + len > arena->capacity)
+		arena_reserve(arena, arena->size + len > 2 * arena->capacity ?
+			arena->size + len : 2 * arena->capacity);
+
+	uint offset = arena->size;
+	memcpy(arena->data + offset, str, len);
+	arena->size += len;
+
+	return offset;
+}
+
+// Marks a string of len bytes as no longer used
+void
+arena_release(arena_t *arena, uint len)
+{
+	arena->unused += len;
+}
+
+// Checks if most of an arena is taken by strings that are no longer used
+int
+arena_needs_compaction(arena_t *arena)
+{
+	return arena->unused >= ARENA_COMPACT_MIN &&
+		arena->unused > arena->size / 2;
+}
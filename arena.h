@@ -0,0 +1,53 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "utils.h"
+#include "mem.h"
+
+// The fewest unused bytes that make an arena worth compacting
+#define ARENA_COMPACT_MIN 256
+
+/* An append-only arena of strings. A string is referred to by its offset
+ * and its length (it is not '\0'-terminated), so the offsets stay valid when
+ * the arena grows. An arena is sized for the strings it is first given and
+ * then doubles as it fills. Strings are never removed, only counted as unused; once
+ * they make up most of the arena, its owner copies the strings still in use
+ * into a new one (see arena_needs_compaction).
+ */
+typedef struct arena_t
+{
+	char *data;  // the strings, one after the other
+	uint size;  // the number of bytes in use (live or not)
+	uint capacity;  // the number of bytes data has room for
+	uint unused;  // the number of bytes of strings that are no longer used
+	mem_class_t mem_class;  // the class that the strings are charged to
+} arena_t;
+
+void
+arena_init(arena_t *arena, mem_class_t mem_class);
+
+void
+arena_free(arena_t *arena);
+
+void
+arena_reserve(arena_t *arena, uint capacity);
+
+uint
+arena_append(arena_t *arena, const char *str, uint len);
+
+void
+arena_release(arena_t *arena, uint len);
+
+int
+arena_needs_compaction(arena_t *arena);
+
+// Returns the string that starts at offset
+static inline const char *
+arena_str(const arena_t *arena, uint offset)
+{
+	return arena->data + offset;
+}
+
+#endif  // ARENA_H_
@@ -0,0 +1,356 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+#include "resp.h"
+#include "changelog.h"
+
+HT_TYPED_DEFINE(batch_key_ht, batch_key_t)
+
+// Makes a batch empty and closed
+void
+batch_init(batch_t *batch)
+{
+	batch->cmds = NULL;
+	batch->size = 0;
+	batch->capacity = 0;
+	batch->open = 0;
+	batch->books = NULL;
+	batch->users = NULL;
+	batch->defs = NULL;
+	batch->book_keys = NULL;
+	batch->user_keys = NULL;
+}
+
+// Drops the queued commands (if any) and closes the batch
+void
+batch_discard(batch_t *batch)
+{
+	for (uint i = 0; i < batch->size; ++i)
+		free_command(&batch->cmds[i]);
+
+	mem_free(MEM_OTHER, batch->cmds);
+	batch_key_ht_free(batch->books);
+	batch_key_ht_free(batch->users);
+	batch_key_ht_free(batch->defs);
+	mem_free(MEM_OTHER, batch->book_keys);
+	mem_free(MEM_OTHER, batch->user_keys);
+	batch_init(batch);
+}
+
+/**
+ * @brief Lets a batch take a command that was just read: BEGIN opens the
+ * batch, and while it is open, every command but COMMIT and EXIT is queued
+ * (along with its definitions, so freeing cmd afterwards frees nothing).
+ * EXIT drops an open batch.
+ *
+ * @param batch the input's batch
+ * @param cmd the command
+ * @return int 1 if the batch took the command, 0 if it has to be executed
+ */
+int
+batch_take(batch_t *batch, cmd_t *cmd)
+{
+	if (!batch->open) {
+		if (cmd->op != CMD_BEGIN)
+			return 0;
+		batch->open = 1;
+		return 1;
+	}
+
+	if (cmd->op == CMD_COMMIT)
+		return 0;
+	if (cmd->op == CMD_EXIT) {
+		batch_discard(batch);
+		return 0;
+	}
+
+	if (batch->size == batch->capacity) {
+		batch->capacity = batch->capacity ? 2 * batch->capacity : HMAX;
+		batch->cmds = (cmd_t *)mem_realloc(MEM_OTHER, batch->cmds,
+			batch->capacity * sizeof(cmd_t));
+		DIE(!batch->cmds, "batch->cmds realloc failed");
+	}
+
+	batch->cmds[batch->size++] = *cmd;
+	cmd->defs = NULL;
+	cmd->num_defs = 0;
+
+	return 1;
+}
+
+// Finds the user and the book that a command refers to (NULL for none)
+static void
+cmd_keys(cmd_t *cmd, const char **user, const char **book)
+{
+	*user = *book = NULL;
+
+	switch (cmd->op) {
+	case CMD_ADD_BOOK:
+	case CMD_GET_BOOK:
+	case CMD_RMV_BOOK:
+	case CMD_ADD_DEF:
+	case CMD_GET_DEF:
+	case CMD_RMV_DEF:
+		*book = cmd->argv[1];
+		break;
+	case CMD_ADD_USER:
+		*user = cmd->argv[1];
+		break;
+	case CMD_BORROW:
+	case CMD_RETURN:
+	case CMD_LOST:
+		*user = cmd->argv[1];
+		*book = cmd->argv[2];
+		break;
+	default:
+		break;
+	}
+}
+
+/* Returns the key of a book or a user, looking it up the first time that
+ * the batch refers to it (a book that the command adds is not looked up)
+ */
+static batch_key_t *
+get_key(batch_key_ht_t *keys, uint is_user, const char *name, uint adds,
+	const batch_probe_t *probe)
+{
+	batch_key_t *key = batch_key_ht_get(keys, name);
+	if (key)
+		return key;
+
+	batch_key_t new_key;
+	memset(&new_key, 0, sizeof(new_key));
+	if (!adds)
+		new_key.exists = probe->find(probe->ctx, is_user, name, &new_key);
+
+	return batch_key_ht_put(keys, name, &new_key);
+}
+
+/* Returns the key of a book's definition. It is looked up the first time,
+ * unless the batch has already added or removed the book: the definition
+ * then only exists if the batch has added it since.
+ */
+static batch_key_t *
+get_def_key(batch_t *batch, batch_key_t *book_key, const char *book,
+	const char *def, const batch_probe_t *probe)
+{
+	char name[2 * MAX_BOOK_SIZE + 1];
+	snprintf(name, sizeof(name), "%s\n%s", def, book);
+
+	batch_key_t *key = batch_key_ht_get(batch->defs, name);
+	if (!key) {
+		batch_key_t new_key;
+		memset(&new_key, 0, sizeof(new_key));
+		new_key.gen = book_key->gen;
+		if (!book_key->gen)
+			new_key.exists = probe->find_def(probe->ctx, book, def);
+		key = batch_key_ht_put(batch->defs, name, &new_key);
+	} else if (key->gen != book_key->gen) {
+		key->exists = 0;
+		key->gen = book_key->gen;
+	}
+
+	return key;
+}
+
+// Marks a user as having no book borrowed, banning them if necessary
+static void
+play_settle(user_t *state)
+{
+	memcpy(state->book_name, INIT_STR, sizeof(INIT_STR));
+	state->charged = 0;
+	if (state->score < 0)
+		state->banned = 1;
+}
+
+/* Plays a command on the keys of a batch, changing them the way executing
+ * the command would change the tables. Returns 0 if the command would fail.
+ */
+static int
+play_command(batch_t *batch, cmd_t *cmd, batch_key_t *user,
+	batch_key_t *book, const batch_probe_t *probe)
+{
+	user_t *state = user ? &user->state : NULL;
+	batch_key_t *def;
+
+	switch (cmd->op) {
+	case CMD_ADD_BOOK:
+		// A book that is already there is replaced, statistics included
+		book->exists = 1;
+		book->borrowed = 0;
+		++(book->gen);
+		for (int i = 0; i < cmd->num_defs; ++i)
+			get_def_key(batch, book, cmd->argv[1], cmd->defs[i].key,
+				probe)->exists = 1;
+		return 1;
+	case CMD_RMV_BOOK:
+		book->exists = 0;
+		++(book->gen);
+		return 1;
+	case CMD_ADD_DEF:
+		get_def_key(batch, book, cmd->argv[1], cmd->argv[2], probe)->exists = 1;
+		return 1;
+	case CMD_RMV_DEF:
+		def = get_def_key(batch, book, cmd->argv[1], cmd->argv[2], probe);
+		if (!def->exists)
+			return 0;
+		def->exists = 0;
+		return 1;
+	case CMD_ADD_USER:
+		if (user->exists)
+			return 0;
+		user->exists = 1;
+		init_user(state, cmd->argv[1]);
+		return 1;
+	case CMD_BORROW:
+		if (state->banned || strcmp(state->book_name, INIT_STR) ||
+			book->borrowed)
+			return 0;
+		book->borrowed = 1;
+		state->days_max = atoi(cmd->argv[3]);
+		state->charged = 0;
+		memcpy(state->book_name, cmd->argv[2], MAX_BOOK_SIZE);
+		return 1;
+	case CMD_RETURN:
+		if (state->banned || strcmp(state->book_name, cmd->argv[2]) ||
+			!strcmp(state->book_name, INIT_STR))
+			return 0;
+		score_return(state, atoi(cmd->argv[3]));
+		play_settle(state);
+		book->borrowed = 0;
+		return 1;
+	case CMD_LOST:
+		if (state->banned)
+			return 0;
+		state->score -= 50;
+		play_settle(state);
+		book->exists = 0;
+		++(book->gen);
+		return 1;
+	default:
+		// The other commands change none of the keys
+		return 1;
+	}
+}
+
+/* Resolves the books and the users of a batch, then plays its commands on
+ * them, in order: every command but ADD_BOOK and ADD_USER needs its book
+ * and its user to exist, ADD_BOOK and ADD_USER add theirs, and RMV_BOOK
+ * and LOST remove the book. Returns the message that refuses the batch (or
+ * NULL if it can be executed).
+ */
+static const char *
+resolve_keys(batch_t *batch, const batch_probe_t *probe)
+{
+	batch->books = batch_key_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR, 0,
+		0, MEM_OTHER, NULL);
+	batch->users = batch_key_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR, 0,
+		0, MEM_OTHER, NULL);
+	batch->defs = batch_key_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR, 0,
+		0, MEM_OTHER, NULL);
+	batch->book_keys = (batch_key_t **)mem_calloc(MEM_OTHER, batch->size + 1,
+		sizeof(batch_key_t *));
+	DIE(!batch->book_keys, "batch->book_keys calloc failed");
+	batch->user_keys = (batch_key_t **)mem_calloc(MEM_OTHER, batch->size + 1,
+		sizeof(batch_key_t *));
+	DIE(!batch->user_keys, "batch->user_keys calloc failed");
+
+	for (uint i = 0; i < batch->size; ++i) {
+		cmd_t *cmd = &batch->cmds[i];
+		const char *user, *book;
+		cmd_keys(cmd, &user, &book);
+
+		batch_key_t *user_key = NULL, *book_key = NULL;
+		if (user) {
+			user_key = get_key(batch->users, 1, user, 0, probe);
+			if (!user_key->exists && cmd->op != CMD_ADD_USER)
+				return "The batch refers to a book or a user that does not "
+					"exist and was not executed.\n";
+			batch->user_keys[i] = user_key;
+		}
+
+		if (book) {
+			uint adds = cmd->op == CMD_ADD_BOOK;
+			book_key = get_key(batch->books, 0, book, adds, probe);
+			if (!book_key->exists && !adds)
+				return "The batch refers to a book or a user that does not "
+					"exist and was not executed.\n";
+			batch->book_keys[i] = book_key;
+		}
+
+		if (!play_command(batch, cmd, user_key, book_key, probe))
+			return "The batch has a command that would fail and was not "
+				"executed.\n";
+	}
+
+	return NULL;
+}
+
+// Counts the books and the definitions that a command adds
+void
+batch_count_adds(const cmd_t *cmd, uint *num_books, uint *num_defs)
+{
+	if (cmd->op == CMD_ADD_BOOK) {
+		++(*num_books);
+		*num_defs += cmd->num_defs;
+	} else if (cmd->op == CMD_ADD_DEF) {
+		++(*num_defs);
+	}
+}
+
+/**
+ * @brief Checks a batch before COMMIT executes it: its commands must all be
+ * valid, the books and the users that they refer to must exist, every
+ * command must succeed (taking the ones before it as done) and, with a
+ * memory budget, what the batch adds must fit in it. Each book and user is
+ * looked up once, so that executing the batch does not look it up again.
+ *
+ * @param batch the batch
+ * @param probe looks at the tables
+ * @return int 1 if the batch can be executed; otherwise, 0, after telling
+ * why and dropping the batch
+ */
+int
+batch_check(batch_t *batch, const batch_probe_t *probe)
+{
+	if (!batch->open) {
+		resp_msg("There is no batch to commit.\n");
+		return 0;
+	}
+
+	/* BULK_LOAD and ADVANCE are left out as well, since the books that
+	 * BULK_LOAD adds are only known once its file is read, and the users
+	 * that ADVANCE charges (and bans) are only known once it runs
+	 */
+	const char *error = NULL;
+	for (uint i = 0; i < batch->size && !error; ++i) {
+		cmd_op_t op = batch->cmds[i].op;
+		if (op == CMD_INVALID || op == CMD_BEGIN || op == CMD_TENANT ||
+			op == CMD_BULK_LOAD || op == CMD_ADVANCE)
+			error = "The batch has an invalid command and was not "
+				"executed.\n";
+		else if (changelog_read_only(op))
+			error = "The library is a read-only replica.\n";
+	}
+
+	if (!error)
+		error = resolve_keys(batch, probe);
+
+	if (!error && mem_get_budget() && !probe->fits(probe->ctx, batch))
+		error = "The batch does not fit in the memory budget and was not "
+			"executed.\n";
+
+	if (!error)
+		return 1;
+
+	resp_msg(error);
+	batch_discard(batch);
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "utils.h"
+#include "ht_typed.h"
+#include "command.h"
+
+/* A book, a user or a definition that the commands of a batch refer to.
+ * Each one is looked up once, when the batch is checked, and then follows
+ * the commands of the batch in order, so that the check knows whether each
+ * command would succeed. The commands that add or remove a book or a user
+ * look it up again while the batch is executed.
+ */
+typedef struct batch_key_t
+{
+	uint exists;  // whether it exists at the point of the batch reached
+	book_t *book;  // the book (NULL until it is found or for a user)
+	user_t *user;  // the user (NULL until it is found or for a book)
+	/* For a book, how many times the batch has added or removed it so far;
+	 * for a definition, the gen of its book that exists refers to
+	 */
+	uint gen;
+	uint borrowed;  // whether the book is borrowed
+	user_t state;  // the user's record, as the batch leaves it
+} batch_key_t;
+
+// The keys that a batch refers to (name -> batch_key_t)
+HT_TYPED_DECLARE(batch_key_ht, batch_key_t);
+
+/* Looks up a book (or a user, if is_user) for batch_check, filling its key
+ * in (a book's borrowed, a user's state). Returns whether it exists.
+ */
+typedef int (*batch_find_t)(void *ctx, uint is_user, const char *name,
+	batch_key_t *key);
+
+/* Checks for batch_check whether a book, as it is in the tables, has a
+ * definition with the given key
+ */
+typedef int (*batch_find_def_t)(void *ctx, const char *book,
+	const char *def);
+
+// Checks for batch_check whether the books and definitions it adds fit
+typedef int (*batch_fits_t)(void *ctx, const struct batch_t *batch);
+
+// How batch_check looks at the tables
+typedef struct batch_probe_t
+{
+	batch_find_t find;
+	batch_find_def_t find_def;
+	batch_fits_t fits;  // only called with a memory budget
+	void *ctx;  // passed to all of them
+} batch_probe_t;
+
+/* A batch of commands, sent between BEGIN and COMMIT. The commands are only
+ * queued until COMMIT, which executes all of them at once: a batch is never
+ * interleaved with other commands, and the change log holds it as a single
+ * transaction. A batch is only executed if every one of its commands would
+ * succeed, taking every command before it as done: one that has an invalid
+ * command, that refers to a book or a user that does not exist at that
+ * point, that has a command that would fail (a BORROW of a borrowed book,
+ * for example), that does not fit in the memory budget, or that is cut
+ * short by EXIT or by the end of the input, is not executed at all.
+ */
+typedef struct batch_t
+{
+	cmd_t *cmds;  // the queued commands (they own their definitions)
+	uint size;
+	uint capacity;
+	uint open;  // whether BEGIN was received (and COMMIT was not yet)
+	batch_key_ht_t *books;  // the books the commands refer to (once checked)
+	batch_key_ht_t *users;  // the users the commands refer to (once checked)
+	batch_key_ht_t *defs;  // the definitions they refer to (once checked)
+	batch_key_t **book_keys;  // the book of each command (or NULL)
+	batch_key_t **user_keys;  // the user of each command (or NULL)
+} batch_t;
+
+void
+batch_init(batch_t *batch);
+
+void
+batch_discard(batch_t *batch);
+
+int
+batch_take(batch_t *batch, cmd_t *cmd);
+
+void
+batch_count_adds(const cmd_t *cmd, uint *num_books, uint *num_defs);
+
+int
+batch_check(batch_t *batch, const batch_probe_t *probe);
+
+#endif  // BATCH_H_
@@ -6,216 +6,886 @@
 #include <string.h>
 #include <errno.h>
 #include "utils.h"
-#include "ll.h"
-#include "ht.h"
+#include "mem.h"
+#include "ht_typed.h"
+#include "keycmp.h"
+#include "resp.h"
+#include "changelog.h"
 
-// Frees the hashtable within a book_t struct
+HT_TYPED_DEFINE(def_ht, def_t)
+HT_TYPED_DEFINE(book_ht, book_t)
+
+/* Frees the hashtable and the arena within a book_t struct (or its packed
+ * definitions, whose strings belong to the library's dictionary)
+ */
 void
-free_book(void *book)
+free_book(book_t *book)
+{
+	def_ht_free(book->defs);
+	arena_free(&book->vals);
+	mem_free(MEM_DEFS, book->packed);
+}
+
+// Returns the length of a string of at most size bytes (it may lack a '\0')
+static uint
+str_len(const char *str, uint size)
 {
-	ht_free(((book_t *)book)->defs);
+	const char *end = memchr(str, '\0', size);
+
+	return end ? (uint)(end - str) : size;
 }
 
 /**
- * @brief Adds a book in the library
+ * @brief Creates an empty library
  * 
- * @param library the library hashtable
- * @param name the book's name
- * @param num_defs the number of definitions within the book
+ * @param key_width the width of the keys of the library's hashtables (0 for
+ * variable length keys)
+ * @param name_index whether the library keeps an index of the books' names
+ * @param filtered whether the library's hashtables keep filters of their keys
+ * @param dict the dictionary that the books keep their definitions packed
+ * in, as ids, shared by all the libraries of the process (NULL to give
+ * every book a hashtable of definitions)
+ * @return library_t * 
+ */
+library_t *
+library_create(uint key_width, uint name_index, uint filtered, dict_t *dict)
+{
+	library_t *library = (library_t *)mem_malloc(MEM_BOOKS, sizeof(library_t));
+	DIE(!library, "library malloc failed");
+
+	library->books = book_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR,
+		key_width, filtered, MEM_BOOKS, free_book);
+	book_stats_init(&library->stats);
+	// The index's keys are definition keys, just like those of the books
+	uint def_key_width = key_width ? MAX_DEF_NAME_SIZE : 0;
+	library->def_index = def_index_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR,
+		def_key_width, filtered, MEM_INDEX, free_posting_list);
+	library->names = name_index ? radix_create() : NULL;
+	library->def_clock = 0;
+	library->line_hits = 0;
+	library->line_misses = 0;
+	library->dict = dict;
+
+	return library;
+}
+
+/* Frees a library, along with all of its books (whose strings leave the
+ * shared dictionary, unless another library uses them as well)
  */
 void
-add_book(ht_t *library, char name[MAX_BOOK_SIZE], int num_defs)
+library_free(library_t *library)
 {
-	// Creates a new book_t struct
-	book_t book;
-	// Copies its name
-	memcpy(book.name, name, MAX_BOOK_SIZE);
-	// Init
-	book.ratings = book.purchases = book.status = book.rating_avg = 0;
+	if (!library)
+		return;
 
-	// Creates the book's hashtable
-	book.defs = ht_create(HMAX, 1, 0, hash_function_string,
-		compare_function_strings, NULL);
+	if (library->dict) {
+		book_ht_cursor_t cursor;
+		book_ht_entry_t *it = book_ht_begin(library->books, &cursor);
+		for (; it; it = book_ht_next(&cursor)) {
+			book_t *book = &it->value;
+			for (uint i = 0; i < book->num_packed; ++i) {
+				dict_release(library->dict, book->packed[i].key);
+				dict_release(library->dict, book->packed[i].val);
+			}
+		}
+	}
 
-	// Puts the definitions in the book's hashtable
-	for (int i = 0; i < num_defs; ++i) {
-		def_t def;
+	book_ht_free(library->books);
+	book_stats_free(&library->stats);
+	def_index_free(library->def_index);
+	radix_free(library->names);
+	mem_free(MEM_BOOKS, library);
+}
 
-		// Reading
-		char line[LINE_SIZE];
-		fgets(line, LINE_SIZE, stdin);
-		int len = strlen(line);
+/* Copies the values that are still in use into a new arena, once most of
+ * the book's arena is taken by replaced or removed ones
+ */
+static void
+compact_vals(book_t *book)
+{
+	if (!arena_needs_compaction(&book->vals))
+		return;
 
-		if (line[len - 1] == '\n')
-			line[len - 1] = '\0';
+	arena_t vals;
+	arena_init(&vals, MEM_DEFS);
+	arena_reserve(&vals, book->vals.size - book->vals.unused);
 
-		int argc = 0;
-		char argv[NR_ARGS][MAX_BOOK_SIZE] = {{'\0'}};
+	def_ht_cursor_t cursor;
+	def_ht_entry_t *it = def_ht_begin(book->defs, &cursor);
+	for (; it; it = def_ht_next(&cursor)) {
+		def_t *def = &it->value;
+		def->val_offset = arena_append(&vals,
+			arena_str(&book->vals, def->val_offset), def->val_len);
+	}
 
-		break_down_line(line, &argc, argv, '"');
+	arena_free(&book->vals);
+	book->vals = vals;
+}
 
-		// Copies the key and the val
-		memcpy(def.key, argv[0], MAX_DEF_NAME_SIZE);
-		memcpy(def.val, argv[1], MAX_DEF_NAME_SIZE);
+/* Stores a definition in a book's hashtable and arena, without indexing it
+ * (a definition that replaces another one keeps its posting)
+ */
+static def_t *
+store_def(book_t *book, def_arg_t *arg)
+{
+	def_t *old_def = def_ht_get(book->defs, arg->key);
+	posting_t *posting = NULL;
+	if (old_def) {
+		posting = old_def->posting;
+		arena_release(&book->vals, old_def->val_len);
+	}
 
-		// Puts the definition in the book
-		ht_put(book.defs, def.key, strlen(def.key) + 1, &def,
-			sizeof(def_t), book.defs->free_function);
+	// Appends the value to the book's arena
+	def_t def;
+	def.val_len = str_len(arg->val, MAX_BOOK_SIZE);
+	def.val_offset = arena_append(&book->vals, arg->val, def.val_len);
+	def.posting = posting;
+
+	def_t *new_def = def_ht_put(book->defs, arg->key, &def);
+	if (old_def)
+		compact_vals(book);
+
+	return new_def;
+}
+
+/* Logs a definition that was stored in a book (which must already be in the
+ * library), then indexes it if the book did not have its key yet
+ */
+static void
+publish_def(library_t *library, book_t *book, def_arg_t *arg, def_t *def)
+{
+	changelog_def_put(book->name, arg->key, arg->val,
+		str_len(arg->val, MAX_BOOK_SIZE));
+	if (!def->posting) {
+		def->posting = index_def(library->def_index, arg->key, book, def);
+		def->posting->seq = library->def_clock++;
+	}
+}
+
+/* Finds the place of a key in a packed book: the index of its definition,
+ * or of the first definition after it (setting found accordingly)
+ */
+static uint
+find_packed(book_t *book, uint key, uint *found)
+{
+	uint lo = 0, hi = book->num_packed;
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+		if (book->packed[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = lo < book->num_packed && book->packed[lo].key == key;
+
+	return lo;
+}
+
+/* Puts a definition in a packed book (which must already be in the library):
+ * its key and its value are interned in the dictionary, and the book keeps
+ * their ids in an array that is exactly as long as it has to be
+ */
+static void
+put_packed(library_t *library, book_t *book, def_arg_t *arg)
+{
+	uint key = dict_intern(library->dict, arg->key,
+		str_len(arg->key, MAX_DEF_NAME_SIZE));
+	uint val_len = str_len(arg->val, MAX_BOOK_SIZE);
+	uint val = dict_intern(library->dict, arg->val, val_len);
+
+	// A definition that replaces another one keeps its posting
+	uint found;
+	uint pos = find_packed(book, key, &found);
+	if (found) {
+		dict_release(library->dict, key);
+		dict_release(library->dict, book->packed[pos].val);
+		book->packed[pos].val = val;
+		changelog_def_put(book->name, arg->key, arg->val, val_len);
+		return;
 	}
 
-	// Puts the the book in the library
-	ht_put(library, book.name, strlen(book.name) + 1, &book,
-		sizeof(book_t), library->free_function);
+	book->packed = (packed_def_t *)mem_realloc(MEM_DEFS, book->packed,
+		(book->num_packed + 1) * sizeof(packed_def_t));
+	DIE(!book->packed, "book->packed realloc failed");
+	memmove(&book->packed[pos + 1], &book->packed[pos],
+		(book->num_packed - pos) * sizeof(packed_def_t));
+	++(book->num_packed);
+
+	packed_def_t *def = &book->packed[pos];
+	def->key = key;
+	def->val = val;
+	changelog_def_put(book->name, arg->key, arg->val, val_len);
+
+	// The definition moves within the array, so the posting does not know it
+	def->posting = index_def(library->def_index, arg->key, book, NULL);
+	def->posting->seq = library->def_clock++;
+}
+
+// Puts a definition in a book (which must already be in the library)
+static void
+put_def(library_t *library, book_t *book, def_arg_t *arg)
+{
+	if (library->dict)
+		put_packed(library, book, arg);
+	else
+		publish_def(library, book, arg, store_def(book, arg));
+}
+
+/* Removes all the definitions of a book from the index (and, if it is
+ * packed, drops their strings)
+ */
+static void
+unindex_book(library_t *library, book_t *book)
+{
+	if (library->dict) {
+		for (uint i = 0; i < book->num_packed; ++i) {
+			unindex_def(library->def_index, book->packed[i].posting);
+			dict_release(library->dict, book->packed[i].key);
+			dict_release(library->dict, book->packed[i].val);
+		}
+		return;
+	}
+
+	def_ht_cursor_t cursor;
+	def_ht_entry_t *it = def_ht_begin(book->defs, &cursor);
+	for (; it; it = def_ht_next(&cursor))
+		unindex_def(library->def_index, it->value.posting);
+}
+
+/* Estimates the memory taken by a definition (an upper bound, since most
+ * values are shorter than MAX_BOOK_SIZE and, in a packed book, most strings
+ * are already in the dictionary)
+ */
+static size_t
+def_cost(library_t *library)
+{
+	if (library->dict)
+		return sizeof(packed_def_t) + 2 * sizeof(dict_ht_entry_t)
+			+ MAX_DEF_NAME_SIZE + 1 + MAX_BOOK_SIZE + 1 + sizeof(posting_t);
+
+	return sizeof(def_ht_entry_t) + MAX_DEF_NAME_SIZE + 1 + MAX_BOOK_SIZE
+		+ sizeof(posting_t);
+}
+
+// Estimates the memory taken by a book with num_defs definitions
+static size_t
+book_cost(library_t *library, int num_defs)
+{
+	size_t cost = sizeof(book_ht_entry_t) + MAX_BOOK_SIZE + 1
+		+ num_defs * def_cost(library);
+	if (!library->dict)
+		cost += sizeof(def_ht_t) + ht_pow2(HMAX) * sizeof(ll_t);
+
+	return cost;
+}
+
+// Estimates the memory taken by num_books new books and num_defs definitions
+size_t
+adds_cost(library_t *library, uint num_books, uint num_defs)
+{
+	return num_books * book_cost(library, 0) + num_defs * def_cost(library);
+}
+
+/**
+ * @brief Builds a book along with its definitions, without touching the
+ * library (so that several books can be built at the same time), other
+ * than reading how its tables are created. The definitions are only
+ * logged and indexed once the book is put in the library by insert_book
+ * (and a packed book, whose strings go to the library's dictionary, only
+ * gets them then).
+ *
+ * @param library the library the book is meant for
+ * @param name the book's name
+ * @param num_defs the number of definitions within the book
+ * @param defs the definitions
+ * @param book receives the book
+ */
+void
+build_book(library_t *library, char name[MAX_BOOK_SIZE], int num_defs,
+	def_arg_t *defs, book_t *book)
+{
+	// Copies its name (zero-padded, so that it can be compared by key_cmp)
+	key_pad(book->name, name, MAX_BOOK_SIZE);
+	book->line_len = 0;
+	book->packed = NULL;
+	book->num_packed = 0;
+	if (library->dict) {
+		book->defs = NULL;
+		arena_init(&book->vals, MEM_DEFS);
+		return;
+	}
+
+	/* Creates the book's hashtable (its keys are fixed-width and filtered if
+	 * the library's are)
+	 */
+	uint def_key_width = library->books->key_width ? MAX_DEF_NAME_SIZE : 0;
+	book->defs = def_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR,
+		def_key_width, library->books->filter != NULL, MEM_DEFS, NULL);
+	// Makes room for all the definitions at once
+	def_ht_reserve(book->defs, num_defs);
+	// Sizes the arena for exactly the values of the definitions
+	uint vals_size = 0;
+	for (int i = 0; i < num_defs; ++i)
+		vals_size += str_len(defs[i].val, MAX_BOOK_SIZE);
+	arena_init(&book->vals, MEM_DEFS);
+	arena_reserve(&book->vals, vals_size);
+
+	for (int i = 0; i < num_defs; ++i)
+		store_def(book, &defs[i]);
+}
+
+/**
+ * @brief Puts a book made by build_book in the library, then logs and
+ * indexes its definitions, in the order in which they were given
+ *
+ * @param library the library
+ * @param book the book (it is copied into the library)
+ * @param num_defs the number of definitions the book was built with
+ * @param defs the definitions
+ */
+void
+insert_book(library_t *library, book_t *book, int num_defs, def_arg_t *defs)
+{
+	/* If the book is already in the library, it is replaced by the new one,
+	 * which keeps its id (with all of its statistics set to 0)
+	 */
+	book_t *new_book;
+	book_t *old_book = book_ht_get(library->books, book->name);
+	if (old_book) {
+		unindex_book(library, old_book);
+		book->id = old_book->id;
+		book_stats_reset(&library->stats, book->id);
+		new_book = book_ht_put(library->books, book->name, book);
+	} else {
+		// Puts the the book in the library, then gives it an id
+		new_book = book_ht_put(library->books, book->name, book);
+		new_book->id = book_stats_add(&library->stats, new_book);
+	}
+	changelog_book_add(new_book->name);
+
+	// Adds the book to the names index
+	if (library->names)
+		radix_insert(library->names, new_book->name,
+			str_len(new_book->name, MAX_BOOK_SIZE), new_book);
+
+	/* Indexes the definitions (once the book is in the library, so that the
+	 * index can point to it), each key at its first definition
+	 */
+	for (int i = 0; i < num_defs; ++i) {
+		if (library->dict)
+			put_packed(library, new_book, &defs[i]);
+		else
+			publish_def(library, new_book, &defs[i],
+				def_ht_get(new_book->defs, defs[i].key));
+	}
+}
+
+/**
+ * @brief Adds a book in the library
+ * 
+ * @param library the library
+ * @param name the book's name
+ * @param num_defs the number of definitions within the book
+ * @param defs the definitions (already read along with the command)
+ */
+void
+add_book(library_t *library, char name[MAX_BOOK_SIZE], int num_defs,
+	def_arg_t *defs)
+{
+	// Refuses the book if it would not fit in the memory budget
+	if (mem_over_budget(book_cost(library, num_defs))) {
+		resp_msg("Not enough memory for the book.\n");
+		return;
+	}
+
+	book_t book;
+	build_book(library, name, num_defs, defs, &book);
+	insert_book(library, &book, num_defs, defs);
 }
 
 // Prints a book's important information
 void
-print_book(book_t *book)
+print_book(library_t *library, book_t *book)
 {
 	if (!book)
 		return;
 
-	printf("Name:%s Rating:%.3lf Purchases:%d\n",
-		book->name, book->rating_avg, book->purchases);
+	resp_book(book->name, library->stats.rating_avg[book->id],
+		library->stats.purchases[book->id]);
+}
+
+/* Prints a book that was already looked up (NULL if it is not there), from
+ * its pre-rendered line, which is rendered first if it is not up to date
+ */
+void
+show_book(library_t *library, book_t *book)
+{
+	if (!book) {
+		resp_msg("The book is not in the library.\n");
+		return;
+	}
+
+	if (book->line_len) {
+		++(library->line_hits);
+	} else {
+		++(library->line_misses);
+		int len = resp_book_line(book->line, BOOK_LINE_SIZE, book->name,
+			library->stats.rating_avg[book->id],
+			library->stats.purchases[book->id]);
+
+		// A line that does not fit is never cached
+		if (len <= 0 || len >= BOOK_LINE_SIZE) {
+			print_book(library, book);
+			return;
+		}
+		book->line_len = len;
+	}
+
+	resp_text(book->line, book->line_len);
 }
 
 // Gets a book from the library (searches using its name)
 void
-get_book(ht_t *library, char name[MAX_BOOK_SIZE])
+get_book(library_t *library, char name[MAX_BOOK_SIZE])
 {
-	book_t *book = (book_t *)ht_get(library, name);
+	show_book(library, book_ht_get(library->books, name));
+}
+
+// Prints how many GET_BOOKs were answered with a pre-rendered line
+void
+report_line_cache(uint64_t hits, uint64_t misses)
+{
+	resp_line("Hits:%llu Misses:%llu\n", (unsigned long long)hits,
+		(unsigned long long)misses);
+}
 
+// Removes a book that was already looked up (NULL if it is not there)
+void
+drop_book(library_t *library, book_t *book)
+{
 	if (!book) {
-		printf("The book is not in the library.\n");
+		resp_msg("The book is not in the library.\n");
 		return;
 	}
 
-	print_book(book);
+	// Unindexes it and its definitions, frees its id, then removes it
+	if (library->names)
+		radix_remove(library->names, book->name,
+			str_len(book->name, MAX_BOOK_SIZE));
+	unindex_book(library, book);
+	book_stats_remove(&library->stats, book->id);
+	changelog_book_remove(book->name);
+	book_ht_remove_value(library->books, book);
 }
 
 // Removes a book from the library
 void
-remove_book(ht_t *library, char name[MAX_BOOK_SIZE])
+remove_book(library_t *library, char name[MAX_BOOK_SIZE])
 {
-	if (!ht_remove_entry(library, name, free_book))
-		printf("The book is not in the library.\n");
+	drop_book(library, book_ht_get(library->books, name));
 }
 
-// Adds a definiton to a given book
+/* Adds a definiton to a book that was already looked up (NULL if it is not
+ * in the library)
+ */
 void
-add_def(ht_t *library, char book_name[MAX_BOOK_SIZE], def_t *def)
+add_def_to(library_t *library, book_t *book, def_arg_t *def)
 {
-	// Gets the book
-	book_t *book = (book_t *)ht_get(library, book_name);
 	if (!book) {
-		printf("The book is not in the library.\n");
+		resp_msg("The book is not in the library.\n");
+		return;
+	}
+
+	// Refuses the definition if it would not fit in the memory budget
+	if (mem_over_budget(def_cost(library))) {
+		resp_msg("Not enough memory for the definition.\n");
 		return;
 	}
 
 	// Adds the new definiton
-	ht_put(book->defs, def->key, strlen(def->key) + 1, def,
-		sizeof(def_t), book->defs->free_function);
+	put_def(library, book, def);
 }
 
-/* Gets a definiton from a given book from the library
- * (searches using their name)
- */
+// Adds a definiton to a given book
 void
-get_def(ht_t *library, char book_name[MAX_BOOK_SIZE],
+add_def(library_t *library, char book_name[MAX_BOOK_SIZE], def_arg_t *def)
+{
+	add_def_to(library, book_ht_get(library->books, book_name), def);
+}
+
+// Gets a definiton from a book that was already looked up (or NULL)
+void
+get_def_from(library_t *library, book_t *book,
 	char def_name[MAX_DEF_NAME_SIZE])
 {
-	// Gets the book
-	book_t *book = (book_t *)ht_get(library, book_name);
 	if (!book) {
-		printf("The book is not in the library.\n");
+		resp_msg("The book is not in the library.\n");
+		return;
+	}
+
+	// The value of a packed definition is only decoded when it is printed
+	if (library->dict) {
+		uint found, len;
+		uint pos = find_packed(book, dict_find(library->dict, def_name),
+			&found);
+		if (!found) {
+			resp_msg("The definition is not in the book.\n");
+			return;
+		}
+
+		const char *val = dict_str(library->dict, book->packed[pos].val, &len);
+		resp_def(val, len);
 		return;
 	}
 
 	// Gets the definiton
-	def_t *def = (def_t *)ht_get(book->defs, def_name);
+	def_t *def = def_ht_get(book->defs, def_name);
 	if (!def) {
-		printf("The definition is not in the book.\n");
+		resp_msg("The definition is not in the book.\n");
 		return;
 	}
 
-	// Prints the definition
-	printf("%s\n", def->val);
+	// Prints the definition (straight from the book's arena)
+	resp_def(arena_str(&book->vals, def->val_offset), def->val_len);
 }
 
-/* Removes a definiton from a given book from the library
+/* Gets a definiton from a given book from the library
  * (searches using their name)
  */
 void
-remove_def(ht_t *library, char book_name[MAX_BOOK_SIZE],
+get_def(library_t *library, char book_name[MAX_BOOK_SIZE],
+	char def_name[MAX_DEF_NAME_SIZE])
+{
+	get_def_from(library, book_ht_get(library->books, book_name), def_name);
+}
+
+// Checks if a book that was already looked up (or NULL) has a definition
+int
+has_def(library_t *library, book_t *book, const char *def_name)
+{
+	if (!book)
+		return 0;
+
+	if (library->dict) {
+		uint found;
+		find_packed(book, dict_find(library->dict, def_name), &found);
+		return found;
+	}
+
+	return def_ht_get(book->defs, def_name) != NULL;
+}
+
+// Removes a definition from a packed book, dropping its strings
+static void
+remove_packed(library_t *library, book_t *book,
+	char def_name[MAX_DEF_NAME_SIZE])
+{
+	uint found;
+	uint pos = find_packed(book, dict_find(library->dict, def_name), &found);
+	if (!found) {
+		resp_msg("The definition is not in the book.\n");
+		return;
+	}
+
+	packed_def_t *def = &book->packed[pos];
+	unindex_def(library->def_index, def->posting);
+	dict_release(library->dict, def->key);
+	dict_release(library->dict, def->val);
+
+	--(book->num_packed);
+	memmove(def, def + 1, (book->num_packed - pos) * sizeof(packed_def_t));
+	if (!book->num_packed) {
+		mem_free(MEM_DEFS, book->packed);
+		book->packed = NULL;
+	} else {
+		book->packed = (packed_def_t *)mem_realloc(MEM_DEFS, book->packed,
+			book->num_packed * sizeof(packed_def_t));
+		DIE(!book->packed, "book->packed realloc failed");
+	}
+
+	changelog_def_remove(book->name, def_name);
+}
+
+// Removes a definiton from a book that was already looked up (or NULL)
+void
+remove_def_from(library_t *library, book_t *book,
 	char def_name[MAX_DEF_NAME_SIZE])
 {
-	// Gets the book
-	book_t *book = (book_t *)ht_get(library, book_name);
 	if (!book) {
-		printf("The book is not in the library.\n");
+		resp_msg("The book is not in the library.\n");
+		return;
+	}
+
+	if (library->dict) {
+		remove_packed(library, book, def_name);
 		return;
 	}
 
-	// Removes the definition
-	if (!ht_remove_entry(book->defs, def_name, book->defs->free_function))
-		printf("The definition is not in the book.\n");
+	// Removes the definition (from the index, as well)
+	def_t *def = def_ht_get(book->defs, def_name);
+	if (!def) {
+		resp_msg("The definition is not in the book.\n");
+		return;
+	}
+
+	unindex_def(library->def_index, def->posting);
+	arena_release(&book->vals, def->val_len);
+	def_ht_remove_value(book->defs, def);
+	changelog_def_remove(book->name, def_name);
+	compact_vals(book);
 }
 
-// Swaps two book_t structs
+/* Removes a definiton from a given book from the library
+ * (searches using their name)
+ */
 void
-swap_books(book_t *book1, book_t *book2)
+remove_def(library_t *library, char book_name[MAX_BOOK_SIZE],
+	char def_name[MAX_DEF_NAME_SIZE])
 {
-	book_t aux = *book1;
-	*book1 = *book2;
-	*book2 = aux;
+	remove_def_from(library, book_ht_get(library->books, book_name),
+		def_name);
 }
 
-// Prints all books' important information (sorted)
+/**
+ * @brief Returns the value of the definition that a posting stands for
+ *
+ * @param library the library
+ * @param posting the posting
+ * @param key the definition's key (only needed if the book is packed)
+ * @param len receives the value's length
+ * @return const char * the value (it is not '\0'-terminated)
+ */
+const char *
+posting_val(library_t *library, posting_t *posting, const char *key,
+	uint *len)
+{
+	book_t *book = posting->book;
+	if (!library->dict) {
+		*len = posting->def->val_len;
+		return arena_str(&book->vals, posting->def->val_offset);
+	}
+
+	uint found;
+	uint pos = find_packed(book, dict_find(library->dict, key), &found);
+
+	return dict_str(library->dict, book->packed[pos].val, len);
+}
+
+/* Prints every book that contains a definition with the given key, along
+ * with the definition's value (answered from the index, in O(result size)).
+ * Returns the number of printed books.
+ */
+uint
+print_postings(library_t *library, char def_name[MAX_DEF_NAME_SIZE])
+{
+	posting_list_t *list = def_index_get(library->def_index, def_name);
+	if (!list)
+		return 0;
+
+	for (posting_t *it = list->head; it; it = it->next) {
+		uint len;
+		const char *val = posting_val(library, it, def_name, &len);
+		resp_posting(it->book->name, val, len, it->seq);
+	}
+
+	return list->size;
+}
+
+// Prints every book that contains a definition with the given key
 void
-top_books(ht_t *library)
+find_def(library_t *library, char def_name[MAX_DEF_NAME_SIZE])
 {
-	// Allocates memory for a vector of book_t structs
-	book_t *vector = (book_t *)malloc(library->size * sizeof(book_t));
-	DIE(!vector, "vector (books) malloc failed");
+	if (!print_postings(library, def_name))
+		resp_msg("The definition is not in any book.\n");
+}
+
+// Compares two books by their names
+static int
+compare_names(book_stats_t *stats, uint id1, uint id2)
+{
+	return key_cmp(stats->books[id1]->name, stats->books[id2]->name,
+		MAX_BOOK_SIZE);
+}
+
+/* Compares two books by their place in the ranking: rating, number of
+ * purchases, then name (unless by_name is 0)
+ */
+static int
+compare_ranks(book_stats_t *stats, uint id1, uint id2, uint by_name)
+{
+	if (stats->rating_avg[id1] != stats->rating_avg[id2])
+		return stats->rating_avg[id1] > stats->rating_avg[id2] ? -1 : 1;
+	if (stats->purchases[id1] != stats->purchases[id2])
+		return stats->purchases[id1] > stats->purchases[id2] ? -1 : 1;
+
+	return by_name ? compare_names(stats, id1, id2) : 0;
+}
 
-	uint cnt = 0;
-
-	// Adds entries from the hashtable in the vector
-	ll_node_t *it;
-	for (uint i = 0; i < library->hmax; ++i)	{
-		if (library->buckets[i]->head) {
-			it = library->buckets[i]->head;
-			while (it) {
-				vector[cnt] = *(book_t *)(((info *)it->data)->value);
-				++cnt;
-				it = it->next;
+/**
+ * @brief Sorts a vector of book ids (a stable, bottom-up merge sort)
+ *
+ * @param stats the books' statistics
+ * @param vector the ids
+ * @param cnt the number of ids
+ * @param by_rank sort by the ranking (1) or only by the names (0)
+ * @param by_name break ties in the ranking by the names (if the vector is
+ * already in the order of the names, the stable sort keeps it so)
+ */
+static void
+sort_books(book_stats_t *stats, uint *vector, uint cnt, uint by_rank,
+	uint by_name)
+{
+	uint *aux = (uint *)mem_malloc(MEM_BOOKS, cnt * sizeof(uint));
+	DIE(!aux, "aux (books) malloc failed");
+
+	uint *src = vector, *dst = aux;
+	for (uint width = 1; width < cnt; width *= 2) {
+		// Merges the runs [i, mid) and [mid, end) into dst
+		for (uint i = 0; i < cnt; i += 2 * width) {
+			uint mid = i + width < cnt ? i + width : cnt;
+			uint end = i + 2 * width < cnt ? i + 2 * width : cnt;
+			uint l = i, r = mid, k = i;
+
+			while (l < mid && r < end) {
+				int cmp = by_rank ?
+					compare_ranks(stats, src[r], src[l], by_name) :
+					compare_names(stats, src[r], src[l]);
+				// Takes from the right run only if it comes strictly first
+				dst[k++] = cmp < 0 ? src[r++] : src[l++];
 			}
+			while (l < mid)
+				dst[k++] = src[l++];
+			while (r < end)
+				dst[k++] = src[r++];
 		}
+
+		uint *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != vector)
+		memcpy(vector, src, cnt * sizeof(uint));
+	mem_free(MEM_BOOKS, aux);
+}
+
+// The state of a traversal of the names index
+typedef struct book_walk_t
+{
+	uint *vector;  // collects the ids of the visited books (if not NULL)
+	uint cnt;  // the number of visited books
+	uint limit;  // stops after this many books (0 for no limit)
+	library_t *library;  // prints the visited books (if not NULL)
+} book_walk_t;
+
+// Visits a book found in the names index
+static int
+visit_book(void *value, void *ctx)
+{
+	book_walk_t *walk = (book_walk_t *)ctx;
+	book_t *book = (book_t *)value;
+
+	if (walk->vector)
+		walk->vector[walk->cnt] = book->id;
+	if (walk->library)
+		print_book(walk->library, book);
+	++(walk->cnt);
+
+	return !walk->limit || walk->cnt < walk->limit;
+}
+
+/* Prints the books whose names start with a prefix, in lexicographic order
+ * (at most limit of them, if limit is not 0). Returns the number of books
+ * that match.
+ */
+uint
+print_prefixed(library_t *library, char prefix[MAX_BOOK_SIZE], uint limit)
+{
+	uint len = str_len(prefix, MAX_BOOK_SIZE);
+	book_walk_t walk = {NULL, 0, limit, library};
+
+	if (library->names) {
+		radix_walk_prefix(library->names, prefix, len, visit_book, &walk);
+	} else {
+		// Without the index, the matching books are gathered and sorted
+		book_stats_t *stats = &library->stats;
+		uint *vector = (uint *)mem_malloc(MEM_BOOKS,
+			(stats->size + 1) * sizeof(uint));
+		DIE(!vector, "vector (books) malloc failed");
+
+		uint cnt = 0;
+		for (uint i = 0; i < stats->size; ++i)
+			if (!strncmp(stats->books[i]->name, prefix, len))
+				vector[cnt++] = i;
+
+		sort_books(stats, vector, cnt, 0, 0);
+		for (uint i = 0; i < cnt && (!limit || i < limit); ++i)
+			print_book(library, stats->books[vector[i]]);
+
+		walk.cnt = cnt;
+		mem_free(MEM_BOOKS, vector);
+	}
+
+	return walk.cnt;
+}
+
+// Prints the books whose names start with a prefix
+void
+list_books(library_t *library, char prefix[MAX_BOOK_SIZE], uint limit)
+{
+	if (!print_prefixed(library, prefix, limit))
+		resp_msg("No book starts with this prefix.\n");
+}
+
+/* Prints all books' important information (sorted). The ranking is computed
+ * over the statistics' columns. If the library has the names index, the
+ * books are taken in the order of their names, so the (stable) sort never
+ * compares names.
+ */
+void
+top_books(library_t *library)
+{
+	book_stats_t *stats = &library->stats;
+
+	// Allocates memory for a vector of book ids
+	uint *vector = (uint *)mem_malloc(MEM_BOOKS,
+		stats->size * sizeof(uint));
+	DIE(!vector, "vector (books) malloc failed");
+
+	uint cnt = stats->size;
+
+	if (library->names) {
+		book_walk_t walk = {vector, 0, 0, NULL};
+		radix_walk_prefix(library->names, "", 0, visit_book, &walk);
+	} else {
+		// The ids are dense, so they are exactly 0, 1, ..., cnt - 1
+		for (uint i = 0; i < cnt; ++i)
+			vector[i] = i;
 	}
 
 	/* Sorts the vector based on the given priorities: rating,
 	 * numner of purchases, name
 	 */
-	for (uint i = 0; i < cnt - 1; ++i)
-		for (uint j = i; j < cnt; ++j) {
-			if (vector[i].rating_avg < vector[j].rating_avg) {
-				swap_books(&vector[i], &vector[j]);
-			} else if (vector[i].rating_avg == vector[j].rating_avg) {
-				if (vector[i].purchases < vector[j].purchases) {
-					swap_books(&vector[i], &vector[j]);
-				} else if (vector[i].purchases == vector[j].purchases) {
-					if (strcmp(vector[i].name, vector[j].name) > 0)
-						swap_books(&vector[i], &vector[j]);
-				}
-			}
-		}
+	sort_books(stats, vector, cnt, 1, !library->names);
 
 	// Prints the vector
 	for (uint i = 0; i < cnt; ++i) {
-		printf("%d. Name:%s Rating:%.3lf Purchases:%d\n",
-			i + 1, vector[i].name, vector[i].rating_avg, vector[i].purchases);
+		uint id = vector[i];
+		resp_book_rank(i + 1, stats->books[id]->name, stats->rating_avg[id],
+			stats->purchases[id]);
 	}
 
 	// Frees the vector
-	free(vector);
+	mem_free(MEM_BOOKS, vector);
+}
+
+// Prints aggregated statistics over the whole library
+void
+library_stats(library_t *library)
+{
+	book_stats_t *stats = &library->stats;
+
+	resp_library_stats(stats->size, book_stats_borrowed(stats),
+		book_stats_purchases(stats), book_stats_rating(stats));
 }
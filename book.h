@@ -4,54 +4,165 @@
 #define BOOK_H_
 
 #include "utils.h"
-#include "ht.h"
+#include "ht_typed.h"
+#include "book_stats.h"
+#include "def_index.h"
+#include "radix.h"
+#include "arena.h"
+#include "dict.h"
+
+// The room for a book's pre-rendered GET_BOOK line
+#define BOOK_LINE_SIZE 128
+
+// A definition, as it is given to ADD_BOOK and ADD_DEF
+typedef struct def_arg_t
+{
+	char key[MAX_DEF_NAME_SIZE];
+	char val[MAX_BOOK_SIZE];
+} def_arg_t;
+
+/* A definition, as it is stored in a book (the key is the one of its entry,
+ * while the value is kept in the book's arena)
+ */
+typedef struct def_t
+{
+	uint val_offset;  // where the value starts in the book's arena
+	uint val_len;  // the length of the value
+	posting_t *posting;  // the definition's entry in the inverted index
+} def_t;
+
+// The hashtable of definitions (key -> def_t)
+HT_TYPED_DECLARE(def_ht, def_t);
+
+/* A definition, as it is stored in a packed book: the ids of its key and its
+ * value in the library's dictionary
+ */
+typedef struct packed_def_t
+{
+	uint key;
+	uint val;
+	posting_t *posting;  // the definition's entry in the inverted index
+} packed_def_t;
 
 typedef struct book_t
 {
-	uint ratings;  // the sum of total ratings
-	uint purchases;  // the number of purchases
-	double rating_avg;  // the average rating
-	uint status;  // the book's status: borrowed or not
+	uint id;  // the book's index in the library's statistics
 	char name[MAX_BOOK_SIZE];  // the book's name
-	struct ht_t *defs;  // the hashtable of definitions
+	def_ht_t *defs;  // the hashtable of definitions
+	arena_t vals;  // the values of the definitions
+	/* The definitions of a packed book (instead of defs and vals), in the
+	 * order of their keys' ids
+	 */
+	packed_def_t *packed;
+	uint num_packed;
+	/* The book's GET_BOOK line, rendered when it was last needed. Only the
+	 * book's statistics appear in it, so only book_stats invalidates it.
+	 */
+	char line[BOOK_LINE_SIZE];
+	uint line_len;  // the length of line (0 if it has to be rendered)
 } book_t;
 
-typedef struct def_t
+// The hashtable of books (name -> book_t)
+HT_TYPED_DECLARE(book_ht, book_t);
+
+typedef struct library_t
 {
-	char key[MAX_DEF_NAME_SIZE];
-	char val[MAX_DEF_NAME_SIZE];
-} def_t;
+	book_ht_t *books;  // the hashtable of books
+	book_stats_t stats;  // the books' statistics (indexed by their ids)
+	def_index_t *def_index;  // the definitions of all books, by key
+	radix_t *names;  // the books, in the order of their names (optional)
+	uint64_t def_clock;  // the sequence number of the next posting
+	uint64_t line_hits;  // GET_BOOKs answered with a pre-rendered line
+	uint64_t line_misses;  // GET_BOOKs that had to render the line
+	dict_t *dict;  // the keys and values of packed books (shared, or NULL)
+} library_t;
+
+library_t *
+library_create(uint key_width, uint name_index, uint filtered, dict_t *dict);
+
+void
+library_free(library_t *library);
+
+void
+free_book(book_t *book);
+
+size_t
+adds_cost(library_t *library, uint num_books, uint num_defs);
+
+void
+build_book(library_t *library, char name[MAX_BOOK_SIZE], int num_defs,
+	def_arg_t *defs, book_t *book);
 
 void
-free_book(void *book);
+insert_book(library_t *library, book_t *book, int num_defs, def_arg_t *defs);
 
 void
-add_book(ht_t *library, char name[MAX_BOOK_SIZE], int num_defs);
+add_book(library_t *library, char name[MAX_BOOK_SIZE], int num_defs,
+	def_arg_t *defs);
 
 void
-print_book(book_t *book);
+print_book(library_t *library, book_t *book);
 
 void
-get_book(ht_t *library, char name[MAX_BOOK_SIZE]);
+show_book(library_t *library, book_t *book);
 
 void
-remove_book(ht_t *library, char name[MAX_BOOK_SIZE]);
+get_book(library_t *library, char name[MAX_BOOK_SIZE]);
 
 void
-add_def(ht_t *library, char book_name[MAX_BOOK_SIZE], def_t *def);
+report_line_cache(uint64_t hits, uint64_t misses);
 
 void
-get_def(ht_t *library, char book_name[MAX_BOOK_SIZE],
+drop_book(library_t *library, book_t *book);
+
+void
+remove_book(library_t *library, char name[MAX_BOOK_SIZE]);
+
+void
+add_def_to(library_t *library, book_t *book, def_arg_t *def);
+
+void
+add_def(library_t *library, char book_name[MAX_BOOK_SIZE], def_arg_t *def);
+
+void
+get_def_from(library_t *library, book_t *book,
+	char def_name[MAX_DEF_NAME_SIZE]);
+
+void
+get_def(library_t *library, char book_name[MAX_BOOK_SIZE],
+	char def_name[MAX_DEF_NAME_SIZE]);
+
+int
+has_def(library_t *library, book_t *book, const char *def_name);
+
+void
+remove_def_from(library_t *library, book_t *book,
 	char def_name[MAX_DEF_NAME_SIZE]);
 
 void
-remove_def(ht_t *library, char book_name[MAX_BOOK_SIZE],
+remove_def(library_t *library, char book_name[MAX_BOOK_SIZE],
 	char def_name[MAX_DEF_NAME_SIZE]);
 
+const char *
+posting_val(library_t *library, posting_t *posting, const char *key,
+	uint *len);
+
+uint
+print_postings(library_t *library, char def_name[MAX_DEF_NAME_SIZE]);
+
+void
+find_def(library_t *library, char def_name[MAX_DEF_NAME_SIZE]);
+
+uint
+print_prefixed(library_t *library, char prefix[MAX_BOOK_SIZE], uint limit);
+
+void
+list_books(library_t *library, char prefix[MAX_BOOK_SIZE], uint limit);
+
 void
-swap_books(book_t *book1, book_t *book2);
+top_books(library_t *library);
 
 void
-top_books(ht_t *library);
+library_stats(library_t *library);
 
 #endif  // BOOK_H_
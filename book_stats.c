@@ -0,0 +1,194 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "book_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+#include "book.h"
+
+// Initializes an empty store
+void
+book_stats_init(book_stats_t *stats)
+{
+	stats->ratings = NULL;
+	stats->purchases = NULL;
+	stats->rating_avg = NULL;
+	stats->status = NULL;
+	stats->books = NULL;
+	stats->size = 0;
+	stats->capacity = 0;
+}
+
+// Frees all the columns of a store
+void
+book_stats_free(book_stats_t *stats)
+{
+	mem_free(MEM_BOOKS, stats->ratings);
+	mem_free(MEM_BOOKS, stats->purchases);
+	mem_free(MEM_BOOKS, stats->rating_avg);
+	mem_free(MEM_BOOKS, stats->status);
+	mem_free(MEM_BOOKS, stats->books);
+	book_stats_init(stats);
+}
+
+// Grows a column to hold capacity elements of elem_size bytes
+static void *
+grow_column(void *column, uint capacity, size_t elem_size)
+{
+	column = mem_realloc(MEM_BOOKS, column, capacity * elem_size);
+	DIE(!column, "book_stats column realloc failed");
+
+	return column;
+}
+
+// Grows all the columns to hold capacity books
+static void
+grow_columns(book_stats_t *stats, uint capacity)
+{
+	stats->ratings = grow_column(stats->ratings, capacity, sizeof(uint));
+	stats->purchases = grow_column(stats->purchases, capacity, sizeof(uint));
+	stats->rating_avg = grow_column(stats->rating_avg, capacity,
+		sizeof(double));
+	stats->status = grow_column(stats->status, capacity, sizeof(uint));
+	stats->books = grow_column(stats->books, capacity,
+		sizeof(struct book_t *));
+	stats->capacity = capacity;
+}
+
+// Makes room for num_books books at once (the columns only grow)
+void
+book_stats_reserve(book_stats_t *stats, uint num_books)
+{
+	if (num_books > stats->capacity)
+		grow_columns(stats, num_books);
+}
+
+/**
+ * @brief Gives a new book the next free id, with all of its statistics
+ * set to 0
+ *
+ * @param stats the store
+ * @param book the book that owns the id (it must not move in memory)
+ * @return uint the book's id
+ */
+uint
+book_stats_add(book_stats_t *stats, struct book_t *book)
+{
+	// Doubles the columns when they are full
+	if (stats->size == stats->capacity)
+		grow_columns(stats, stats->capacity ? 2 * stats->capacity : HMAX);
+
+	uint id = stats->size++;
+	stats->books[id] = book;
+	book_stats_reset(stats, id);
+
+	return id;
+}
+
+// Sets all the statistics of a book to 0
+void
+book_stats_reset(book_stats_t *stats, uint id)
+{
+	stats->books[id]->line_len = 0;
+	stats->ratings[id] = 0;
+	stats->purchases[id] = 0;
+	stats->rating_avg[id] = 0;
+	stats->status[id] = 0;
+}
+
+/**
+ * @brief Frees a book's id. The last book takes its place, so the ids stay
+ * dense (that book's id is updated through its back pointer).
+ *
+ * @param stats the store
+ * @param id the id of the removed book
+ */
+void
+book_stats_remove(book_stats_t *stats, uint id)
+{
+	uint last = --stats->size;
+
+	if (id != last) {
+		stats->ratings[id] = stats->ratings[last];
+		stats->purchases[id] = stats->purchases[last];
+		stats->rating_avg[id] = stats->rating_avg[last];
+		stats->status[id] = stats->status[last];
+		stats->books[id] = stats->books[last];
+		stats->books[id]->id = id;
+	}
+}
+
+/* Marks a book as returned, updating its number of purchases, sum of total
+ * ratings and average rating
+ */
+void
+book_stats_return(book_stats_t *stats, uint id, uint rating)
+{
+	stats->status[id] = 0;
+	stats->books[id]->line_len = 0;
+
+	++(stats->purchases[id]);
+	stats->ratings[id] += rating;
+	stats->rating_avg[id] = (double)stats->ratings[id] / stats->purchases[id];
+}
+
+// Overwrites the statistics of a book (with the ones of a primary's copy)
+void
+book_stats_set(book_stats_t *stats, uint id, uint status, uint ratings,
+	uint purchases)
+{
+	stats->books[id]->line_len = 0;
+	stats->status[id] = status;
+	stats->ratings[id] = ratings;
+	stats->purchases[id] = purchases;
+	stats->rating_avg[id] = purchases ? (double)ratings / purchases : 0;
+}
+
+// Returns the number of borrowed books
+uint
+book_stats_borrowed(book_stats_t *stats)
+{
+	uint borrowed = 0;
+
+	for (uint i = 0; i < stats->size; ++i)
+		borrowed += stats->status[i];
+
+	return borrowed;
+}
+
+// Returns the total number of purchases
+uint
+book_stats_purchases(book_stats_t *stats)
+{
+	uint purchases = 0;
+
+	for (uint i = 0; i < stats->size; ++i)
+		purchases += stats->purchases[i];
+
+	return purchases;
+}
+
+// Returns the sum of all ratings ever given
+uint
+book_stats_ratings(book_stats_t *stats)
+{
+	uint ratings = 0;
+
+	for (uint i = 0; i < stats->size; ++i)
+		ratings += stats->ratings[i];
+
+	return ratings;
+}
+
+// Returns the average of all ratings ever given (0 if there are none)
+double
+book_stats_rating(book_stats_t *stats)
+{
+	uint ratings = book_stats_ratings(stats);
+	uint purchases = book_stats_purchases(stats);
+
+	return purchases ? (double)ratings / purchases : 0;
+}
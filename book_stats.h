@@ -0,0 +1,63 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef BOOK_STATS_H_
+#define BOOK_STATS_H_
+
+#include "utils.h"
+
+struct book_t;
+
+/* The statistics of all the books in a library, stored column by column.
+ * Every book has a dense id in [0, size), which is its index in each column,
+ * so scanning a statistic over the whole library is a sequential pass over
+ * one array, without touching the books' names or definitions.
+ */
+typedef struct book_stats_t
+{
+	uint *ratings;  // the sum of total ratings
+	uint *purchases;  // the number of purchases
+	double *rating_avg;  // the average rating
+	uint *status;  // the book's status: borrowed or not
+	struct book_t **books;  // the book that owns each id (cold data)
+	uint size;  // the number of books (ids in use)
+	uint capacity;  // the number of ids each column has room for
+} book_stats_t;
+
+void
+book_stats_init(book_stats_t *stats);
+
+void
+book_stats_free(book_stats_t *stats);
+
+void
+book_stats_reserve(book_stats_t *stats, uint num_books);
+
+uint
+book_stats_add(book_stats_t *stats, struct book_t *book);
+
+void
+book_stats_reset(book_stats_t *stats, uint id);
+
+void
+book_stats_remove(book_stats_t *stats, uint id);
+
+void
+book_stats_return(book_stats_t *stats, uint id, uint rating);
+
+void
+book_stats_set(book_stats_t *stats, uint id, uint status, uint ratings,
+	uint purchases);
+
+uint
+book_stats_borrowed(book_stats_t *stats);
+
+uint
+book_stats_purchases(book_stats_t *stats);
+
+uint
+book_stats_ratings(book_stats_t *stats);
+
+double
+book_stats_rating(book_stats_t *stats);
+
+#endif  // BOOK_STATS_H_
@@ -0,0 +1,333 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bulk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "utils.h"
+#include "mem.h"
+#include "resp.h"
+
+// Reads a whole file into memory (returns 0 if it cannot be read)
+static int
+read_file(bulk_t *bulk, const char *path)
+{
+	FILE *in = fopen(path, "r");
+	if (!in)
+		return 0;
+
+	size_t capacity = 0;
+	for (;;) {
+		if (bulk->size == capacity) {
+			capacity = capacity ? 2 * capacity : 16 * LINE_SIZE;
+			bulk->text = (char *)mem_realloc(MEM_OTHER, bulk->text, capacity);
+			DIE(!bulk->text, "bulk->text realloc failed");
+		}
+
+		size_t len = fread(bulk->text + bulk->size, 1, capacity - bulk->size,
+			in);
+		bulk->size += len;
+		if (!len)
+			break;
+	}
+
+	int ok = !ferror(in);
+	fclose(in);
+
+	return ok;
+}
+
+/* Finds the next line of the file, split the way fgets splits the input:
+ * a line longer than LINE_SIZE - 1 characters is read in several pieces
+ */
+static int
+next_line(bulk_t *bulk, size_t *pos, bulk_line_t *line)
+{
+	if (*pos >= bulk->size)
+		return 0;
+
+	size_t max = bulk->size - *pos;
+	if (max > LINE_SIZE - 1)
+		max = LINE_SIZE - 1;
+
+	char *start = bulk->text + *pos;
+	char *end = (char *)memchr(start, '\n', max);
+
+	line->offset = *pos;
+	line->len = end ? (uint)(end - start) : (uint)max;
+	*pos += end ? line->len + 1 : line->len;
+
+	return 1;
+}
+
+// Copies a line out of the file, so that it can be parsed
+static void
+copy_line(bulk_t *bulk, bulk_line_t *line, char buf[LINE_SIZE])
+{
+	memcpy(buf, bulk->text + line->offset, line->len);
+	buf[line->len] = '\0';
+}
+
+// Adds a line of definitions
+static void
+add_line(bulk_t *bulk, bulk_line_t *line, uint *capacity)
+{
+	if (bulk->num_lines == *capacity) {
+		*capacity = *capacity ? 2 * *capacity : HMAX;
+		bulk->lines = (bulk_line_t *)mem_realloc(MEM_OTHER, bulk->lines,
+			*capacity * sizeof(bulk_line_t));
+		DIE(!bulk->lines, "bulk->lines realloc failed");
+	}
+
+	bulk->lines[bulk->num_lines++] = *line;
+}
+
+// Adds an ADD_BOOK, whose definitions start at the next line
+static void
+add_cmd(bulk_t *bulk, cmd_t *cmd, uint *capacity)
+{
+	if (bulk->num_cmds == *capacity) {
+		*capacity = *capacity ? 2 * *capacity : HMAX;
+		bulk->cmds = (cmd_t *)mem_realloc(MEM_OTHER, bulk->cmds,
+			*capacity * sizeof(cmd_t));
+		DIE(!bulk->cmds, "bulk->cmds realloc failed");
+		bulk->first_line = (uint *)mem_realloc(MEM_OTHER, bulk->first_line,
+			*capacity * sizeof(uint));
+		DIE(!bulk->first_line, "bulk->first_line realloc failed");
+		bulk->num_read = (uint *)mem_realloc(MEM_OTHER, bulk->num_read,
+			*capacity * sizeof(uint));
+		DIE(!bulk->num_read, "bulk->num_read realloc failed");
+	}
+
+	bulk->cmds[bulk->num_cmds] = *cmd;
+	bulk->first_line[bulk->num_cmds] = bulk->num_lines;
+	bulk->num_read[bulk->num_cmds] = 0;
+	++(bulk->num_cmds);
+}
+
+/**
+ * @brief Reads a catalogue and finds where each of its ADD_BOOKs starts.
+ * Only the lines of the commands are parsed here; the definitions are left
+ * to bulk_prepare. Empty lines between the commands are skipped.
+ *
+ * @param bulk receives the catalogue
+ * @param path the file
+ * @return int 1 on success, 0 if the file cannot be read or has a command
+ * other than ADD_BOOK (bulk is left empty)
+ */
+int
+bulk_read(bulk_t *bulk, const char *path)
+{
+	memset(bulk, 0, sizeof(bulk_t));
+	if (!read_file(bulk, path)) {
+		bulk_free(bulk);
+		return 0;
+	}
+
+	uint line_capacity = 0, cmd_capacity = 0;
+	// The definitions that the last ADD_BOOK still has to read
+	int pending = 0;
+	size_t pos = 0;
+	bulk_line_t line;
+	while (next_line(bulk, &pos, &line)) {
+		if (pending) {
+			add_line(bulk, &line, &line_capacity);
+			++(bulk->num_read[bulk->num_cmds - 1]);
+			--pending;
+			continue;
+		} else if (!line.len) {
+			continue;
+		}
+
+		char buf[LINE_SIZE];
+		copy_line(bulk, &line, buf);
+
+		cmd_t cmd;
+		pending = parse_command(buf, &cmd);
+		if (cmd.op != CMD_ADD_BOOK) {
+			free_command(&cmd);
+			bulk_free(bulk);
+			return 0;
+		}
+		add_cmd(bulk, &cmd, &cmd_capacity);
+	}
+
+	return 1;
+}
+
+// A run of ADD_BOOKs, prepared by one thread
+typedef struct bulk_range_t
+{
+	bulk_t *bulk;
+	library_t *library;  // the library the books are built for (or NULL)
+	uint begin, end;  // the range is [begin, end)
+	int valid;  // whether all of the run's definitions are valid
+} bulk_range_t;
+
+/* Parses the definitions of a run of ADD_BOOKs, then builds their books
+ * (only for the ADD_BOOKs whose definitions are all valid)
+ */
+static void
+prepare_range(bulk_range_t *range)
+{
+	bulk_t *bulk = range->bulk;
+	char line[LINE_SIZE];
+
+	range->valid = 1;
+	for (uint i = range->begin; i < range->end; ++i) {
+		cmd_t *cmd = &bulk->cmds[i];
+		for (uint j = 0; j < bulk->num_read[i]; ++j) {
+			copy_line(bulk, &bulk->lines[bulk->first_line[i] + j], line);
+			if (!parse_def(line, &cmd->defs[j]))
+				cmd->op = CMD_INVALID;
+		}
+
+		if (cmd->op != CMD_ADD_BOOK)
+			range->valid = 0;
+		else if (range->library)
+			build_book(range->library, cmd->argv[1], cmd->num_defs,
+				cmd->defs, &bulk->books[i]);
+	}
+}
+
+static void *
+prepare_thread(void *arg)
+{
+	// What the threads allocate is profiled as made by BULK_LOAD
+	mem_profile_tag(CMD_BULK_LOAD + 1);
+	prepare_range((bulk_range_t *)arg);
+
+	return NULL;
+}
+
+/**
+ * @brief Parses the definitions of all the ADD_BOOKs of a catalogue and,
+ * if a library is given, builds their books (without putting them in it).
+ * The ADD_BOOKs are split into runs with about as many definitions each,
+ * and every run is prepared by a thread of its own.
+ *
+ * @param bulk the catalogue
+ * @param library the library the books are built for (NULL to only parse)
+ * @return int 1 on success, 0 if a definition has a key or a value that is
+ * too long (none of the books is then kept)
+ */
+int
+bulk_prepare(bulk_t *bulk, library_t *library)
+{
+	if (library && bulk->num_cmds) {
+		bulk->books = (book_t *)mem_calloc(MEM_OTHER, bulk->num_cmds,
+			sizeof(book_t));
+		DIE(!bulk->books, "bulk->books calloc failed");
+	}
+
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint num_threads = num_cpus > 1 ? (uint)num_cpus : 1;
+	if (num_threads > BULK_MAX_THREADS)
+		num_threads = BULK_MAX_THREADS;
+	if (num_threads > bulk->num_lines / BULK_MIN_DEFS)
+		num_threads = bulk->num_lines / BULK_MIN_DEFS;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	// Each run ends at the first ADD_BOOK past its share of the lines
+	bulk_range_t ranges[BULK_MAX_THREADS];
+	uint begin = 0;
+	for (uint i = 0; i < num_threads; ++i) {
+		size_t share = (size_t)bulk->num_lines * (i + 1) / num_threads;
+		uint end = begin;
+		while (end < bulk->num_cmds &&
+			(i + 1 == num_threads || bulk->first_line[end] < share))
+			++end;
+
+		ranges[i].bulk = bulk;
+		ranges[i].library = library;
+		ranges[i].begin = begin;
+		ranges[i].end = end;
+		begin = end;
+	}
+
+	// The first run is prepared by the calling thread
+	pthread_t threads[BULK_MAX_THREADS];
+	for (uint i = 1; i < num_threads; ++i)
+		DIE(pthread_create(&threads[i], NULL, prepare_thread, &ranges[i]),
+			"bulk pthread_create failed");
+
+	prepare_range(&ranges[0]);
+
+	int valid = ranges[0].valid;
+	for (uint i = 1; i < num_threads; ++i) {
+		pthread_join(threads[i], NULL);
+		valid &= ranges[i].valid;
+	}
+
+	if (!valid && bulk->books)
+		for (uint i = 0; i < bulk->num_cmds; ++i)
+			if (bulk->cmds[i].op == CMD_ADD_BOOK)
+				free_book(&bulk->books[i]);
+
+	return valid;
+}
+
+// Frees a catalogue (the books that were built belong to the library)
+void
+bulk_free(bulk_t *bulk)
+{
+	for (uint i = 0; i < bulk->num_cmds; ++i)
+		free_command(&bulk->cmds[i]);
+
+	mem_free(MEM_OTHER, bulk->text);
+	mem_free(MEM_OTHER, bulk->lines);
+	mem_free(MEM_OTHER, bulk->cmds);
+	mem_free(MEM_OTHER, bulk->first_line);
+	mem_free(MEM_OTHER, bulk->num_read);
+	mem_free(MEM_OTHER, bulk->books);
+	memset(bulk, 0, sizeof(bulk_t));
+}
+
+/**
+ * @brief BULK_LOAD: adds all the books of a catalogue to the library, with
+ * the same result as executing its ADD_BOOKs one by one. With a memory
+ * budget, the books are added one by one, so that each one is checked
+ * against it in turn.
+ *
+ * @param library the library
+ * @param path the catalogue
+ */
+void
+bulk_load(library_t *library, const char *path)
+{
+	bulk_t bulk;
+	if (!bulk_read(&bulk, path)) {
+		resp_msg("The catalogue could not be loaded.\n");
+		return;
+	}
+
+	if (!bulk_prepare(&bulk, mem_get_budget() ? NULL : library)) {
+		resp_msg("The catalogue could not be loaded.\n");
+		bulk_free(&bulk);
+		return;
+	}
+
+	if (mem_get_budget()) {
+		for (uint i = 0; i < bulk.num_cmds; ++i)
+			add_book(library, bulk.cmds[i].argv[1], bulk.cmds[i].num_defs,
+				bulk.cmds[i].defs);
+	} else {
+		// Sizes the library for all the books at once
+		book_ht_reserve(library->books, library->books->size + bulk.num_cmds);
+		book_stats_reserve(&library->stats,
+			library->stats.size + bulk.num_cmds);
+
+		for (uint i = 0; i < bulk.num_cmds; ++i)
+			insert_book(library, &bulk.books[i], bulk.cmds[i].num_defs,
+				bulk.cmds[i].defs);
+	}
+
+	resp_line("Loaded:%u\n", bulk.num_cmds);
+	bulk_free(&bulk);
+}
@@ -0,0 +1,58 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef BULK_H_
+#define BULK_H_
+
+#include <stddef.h>
+#include "utils.h"
+#include "book.h"
+#include "command.h"
+
+/* The bulk loader. BULK_LOAD reads a catalogue: a file of ADD_BOOK commands,
+ * each followed by its definitions, just like the input. A single pass finds
+ * where every command starts, then the definitions are parsed and the books
+ * are built by several threads at once, each one taking a run of whole
+ * books. The library is sized for all of them up front, and the books are
+ * put in it in the order of the file, so the tables end up as if the
+ * ADD_BOOKs had been executed one by one.
+ */
+
+// The most threads that a catalogue is loaded on
+#define BULK_MAX_THREADS 16
+// The fewest definitions that are worth a thread of their own
+#define BULK_MIN_DEFS 4096
+
+// A line of the file (its text is not terminated)
+typedef struct bulk_line_t
+{
+	size_t offset;  // where it starts in the file
+	uint len;  // its length, without the '\n'
+} bulk_line_t;
+
+// A catalogue, read into memory
+typedef struct bulk_t
+{
+	char *text;  // the whole file
+	size_t size;
+	bulk_line_t *lines;  // the lines of the definitions, in order
+	uint num_lines;
+	cmd_t *cmds;  // the ADD_BOOKs, in order
+	uint *first_line;  // the first line of each ADD_BOOK's definitions
+	uint *num_read;  // the definitions each ADD_BOOK has lines for
+	uint num_cmds;
+	book_t *books;  // the books built from the ADD_BOOKs (or NULL)
+} bulk_t;
+
+int
+bulk_read(bulk_t *bulk, const char *path);
+
+int
+bulk_prepare(bulk_t *bulk, library_t *library);
+
+void
+bulk_free(bulk_t *bulk);
+
+void
+bulk_load(library_t *library, const char *path);
+
+#endif  // BULK_H_
@@ -0,0 +1,710 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "changelog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "utils.h"
+#include "mem.h"
+#include "book.h"
+#include "user.h"
+#include "command.h"
+#include "resp.h"
+#include "batch.h"
+#include "def_index.h"
+
+/* Every change is a record: its type (1 byte) and the length of its payload
+ * (2 bytes), followed by the payload. Strings are written as their length
+ * (2 bytes) followed by their characters, and numbers as 4 or 8 bytes, in
+ * the order of the host (the log never leaves the machine). A COMMIT record
+ * ends the changes made by a command, with the number of the transaction
+ * and the time when it was written.
+ */
+typedef enum change_type_t
+{
+	CHANGE_BOOK_ADD = 1,  // name: an empty book, with no statistics
+	CHANGE_BOOK_REMOVE,  // name
+	CHANGE_DEF_PUT,  // book name, key, val
+	CHANGE_DEF_REMOVE,  // book name, key
+	CHANGE_BOOK_STATE,  // name, status, sum of ratings, purchases
+	CHANGE_USER,  // name, score, banned, time limit, due day, days charged,
+	// borrowed book's name
+	CHANGE_CLOCK,  // the library's day
+	CHANGE_COMMIT  // transaction number, time (in microseconds)
+} change_type_t;
+
+// The size of a record's header
+#define CHANGE_HEADER 3
+// The largest record (a definition, with its book's name)
+#define CHANGE_MAX_SIZE (CHANGE_HEADER + 3 * (2 + MAX_BOOK_SIZE))
+
+// A record, as it is written or read
+typedef struct change_t
+{
+	unsigned char data[CHANGE_MAX_SIZE];
+	uint size;  // the bytes written so far (or read so far)
+} change_t;
+
+// What a follower has received from the log and what it has applied
+typedef struct follower_t
+{
+	int fd;  // the log
+	unsigned char *buf;  // the bytes received but not applied yet
+	size_t start;  // the first byte not applied yet
+	size_t size;  // the number of bytes in buf
+	size_t capacity;
+	uint64_t applied;  // the number of the last applied transaction
+	uint pending;  // the number of received transactions not applied yet
+	uint64_t pending_since;  // when the oldest of them was written
+	FILE *out;  // where the responses are printed
+} follower_t;
+
+// The log written by this process (NULL if there is none)
+static FILE *changelog;
+// The number of the last written transaction
+static uint64_t changelog_lsn;
+// Whether changes were written since the last commit
+static uint changelog_dirty;
+// The log followed by this process (NULL if it is not a follower)
+static follower_t *replica;
+
+// Returns the current time, in microseconds
+static uint64_t
+now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Starts a record of the given type
+static void
+change_begin(change_t *change, change_type_t type)
+{
+	change->data[0] = type;
+	change->size = CHANGE_HEADER;
+}
+
+// Appends a number to a record
+static void
+change_u32(change_t *change, uint32_t value)
+{
+	memcpy(change->data + change->size, &value, sizeof(value));
+	change->size += sizeof(value);
+}
+
+static void
+change_u64(change_t *change, uint64_t value)
+{
+	memcpy(change->data + change->size, &value, sizeof(value));
+	change->size += sizeof(value);
+}
+
+// Appends a string of at most size characters to a record
+static void
+change_str(change_t *change, const char *str, uint size)
+{
+	uint16_t len = strnlen(str, size);
+
+	memcpy(change->data + change->size, &len, sizeof(len));
+	memcpy(change->data + change->size + sizeof(len), str, len);
+	change->size += sizeof(len) + len;
+}
+
+// Writes a finished record to the log
+static void
+change_end(change_t *change)
+{
+	uint16_t len = change->size - CHANGE_HEADER;
+	memcpy(change->data + 1, &len, sizeof(len));
+
+	fwrite(change->data, 1, change->size, changelog);
+	changelog_dirty = 1;
+}
+
+/**
+ * @brief Opens the log that the changes are written to (a FIFO blocks until
+ * a follower opens it as well)
+ *
+ * @param path the log's path
+ * @return int 1 if it could be opened, 0 otherwise
+ */
+int
+changelog_open(const char *path)
+{
+	changelog = fopen(path, "w");
+	if (!changelog)
+		return 0;
+
+	// A follower that goes away shows up as a failed write, not as a signal
+	signal(SIGPIPE, SIG_IGN);
+	changelog_lsn = 0;
+	changelog_dirty = 0;
+
+	return 1;
+}
+
+// Closes the log
+void
+changelog_close(void)
+{
+	if (!changelog)
+		return;
+
+	fclose(changelog);
+	changelog = NULL;
+}
+
+// Logs that a book was added (or replaced by an empty one)
+void
+changelog_book_add(const char *name)
+{
+	if (!changelog)
+		return;
+
+	change_t change;
+	change_begin(&change, CHANGE_BOOK_ADD);
+	change_str(&change, name, MAX_BOOK_SIZE);
+	change_end(&change);
+}
+
+// Logs that a book was removed
+void
+changelog_book_remove(const char *name)
+{
+	if (!changelog)
+		return;
+
+	change_t change;
+	change_begin(&change, CHANGE_BOOK_REMOVE);
+	change_str(&change, name, MAX_BOOK_SIZE);
+	change_end(&change);
+}
+
+// Logs that a definition was put in a book
+void
+changelog_def_put(const char *book_name, const char *key, const char *val,
+	uint len)
+{
+	if (!changelog)
+		return;
+
+	change_t change;
+	change_begin(&change, CHANGE_DEF_PUT);
+	change_str(&change, book_name, MAX_BOOK_SIZE);
+	change_str(&change, key, MAX_DEF_NAME_SIZE);
+	change_str(&change, val, len < MAX_BOOK_SIZE ? len : MAX_BOOK_SIZE);
+	change_end(&change);
+}
+
+// Logs that a definition was removed from a book
+void
+changelog_def_remove(const char *book_name, const char *key)
+{
+	if (!changelog)
+		return;
+
+	change_t change;
+	change_begin(&change, CHANGE_DEF_REMOVE);
+	change_str(&change, book_name, MAX_BOOK_SIZE);
+	change_str(&change, key, MAX_DEF_NAME_SIZE);
+	change_end(&change);
+}
+
+// Logs a book's statistics (after it was borrowed or returned)
+void
+changelog_book_state(library_t *library, book_t *book)
+{
+	if (!changelog)
+		return;
+
+	book_stats_t *stats = &library->stats;
+	change_t change;
+	change_begin(&change, CHANGE_BOOK_STATE);
+	change_str(&change, book->name, MAX_BOOK_SIZE);
+	change_u32(&change, stats->status[book->id]);
+	change_u32(&change, stats->ratings[book->id]);
+	change_u32(&change, stats->purchases[book->id]);
+	change_end(&change);
+}
+
+// Logs a user's record (after it was added, or after its score changed)
+void
+changelog_user(const user_t *user)
+{
+	if (!changelog)
+		return;
+
+	change_t change;
+	change_begin(&change, CHANGE_USER);
+	change_str(&change, user->name, MAX_DEF_NAME_SIZE);
+	change_u32(&change, user->score);
+	change_u32(&change, user->banned);
+	change_u32(&change, user->days_max);
+	change_u32(&change, user->due);
+	change_u32(&change, user->charged);
+	change_str(&change, user->book_name, MAX_BOOK_SIZE);
+	change_end(&change);
+}
+
+// Logs that the library's clock moved forward
+void
+changelog_clock(uint today)
+{
+	if (!changelog)
+		return;
+
+	change_t change;
+	change_begin(&change, CHANGE_CLOCK);
+	change_u32(&change, today);
+	change_end(&change);
+}
+
+/* Ends the transaction of the current command (if it changed anything) and
+ * hands it to the followers
+ */
+void
+changelog_commit(void)
+{
+	if (!changelog || !changelog_dirty)
+		return;
+
+	change_t change;
+	change_begin(&change, CHANGE_COMMIT);
+	change_u64(&change, ++changelog_lsn);
+	change_u64(&change, now_us());
+	change_end(&change);
+	changelog_dirty = 0;
+
+	// The tables keep working without a log when the followers went away
+	if (fflush(changelog)) {
+		fprintf(stderr, "The change log could not be written: %s\n",
+			strerror(errno));
+		fclose(changelog);
+		changelog = NULL;
+	}
+}
+
+// Reads a number from a record
+static uint32_t
+read_u32(change_t *change)
+{
+	uint32_t value;
+	memcpy(&value, change->data + change->size, sizeof(value));
+	change->size += sizeof(value);
+
+	return value;
+}
+
+static uint64_t
+read_u64(change_t *change)
+{
+	uint64_t value;
+	memcpy(&value, change->data + change->size, sizeof(value));
+	change->size += sizeof(value);
+
+	return value;
+}
+
+// Reads a string into a zero-padded buffer of size characters
+static void
+read_str(change_t *change, char *str, uint size)
+{
+	uint16_t len;
+	memcpy(&len, change->data + change->size, sizeof(len));
+	change->size += sizeof(len);
+
+	memset(str, 0, size);
+	memcpy(str, change->data + change->size, len < size ? len : size);
+	change->size += len;
+}
+
+// A sink for the responses of the changes applied by a follower
+static void
+discard(const resp_t *resp, void *ctx)
+{
+	(void)resp;
+	(void)ctx;
+}
+
+// Applies a change to a follower's tables
+static void
+apply_change(db_t *db, change_t *change)
+{
+	library_t *library = db->library;
+	char name[MAX_BOOK_SIZE];
+	def_arg_t def;
+
+	change->size = CHANGE_HEADER;
+	switch (change->data[0]) {
+	case CHANGE_BOOK_ADD:
+		read_str(change, name, MAX_BOOK_SIZE);
+		add_book(library, name, 0, NULL);
+		break;
+	case CHANGE_BOOK_REMOVE:
+		read_str(change, name, MAX_BOOK_SIZE);
+		remove_book(library, name);
+		break;
+	case CHANGE_DEF_PUT:
+		read_str(change, name, MAX_BOOK_SIZE);
+		read_str(change, def.key, MAX_DEF_NAME_SIZE);
+		read_str(change, def.val, MAX_BOOK_SIZE);
+		add_def(library, name, &def);
+		break;
+	case CHANGE_DEF_REMOVE:
+		read_str(change, name, MAX_BOOK_SIZE);
+		read_str(change, def.key, MAX_DEF_NAME_SIZE);
+		remove_def(library, name, def.key);
+		break;
+	case CHANGE_BOOK_STATE: {
+		read_str(change, name, MAX_BOOK_SIZE);
+		uint status = read_u32(change);
+		uint ratings = read_u32(change);
+		uint purchases = read_u32(change);
+
+		book_t *book = book_ht_get(library->books, name);
+		if (book) {
+			book_stats_set(&library->stats, book->id, status, ratings,
+				purchases);
+			changelog_book_state(library, book);
+		}
+		break;
+	}
+	case CHANGE_USER: {
+		read_str(change, def.key, MAX_DEF_NAME_SIZE);
+		user_t *user = user_ht_get(db->users, def.key);
+		if (!user) {
+			add_user(db->users, def.key);
+			user = user_ht_get(db->users, def.key);
+		}
+
+		user->score = (int)read_u32(change);
+		user->banned = read_u32(change);
+		user->days_max = read_u32(change);
+		user->due = read_u32(change);
+		user->charged = read_u32(change);
+		read_str(change, user->book_name, MAX_BOOK_SIZE);
+
+		// The loan is put back in the heap, in the place of its due day
+		loans_remove(db->loans, user);
+		if (!user->banned && strcmp(user->book_name, INIT_STR))
+			loans_add(db->loans, user);
+		changelog_user(user);
+		break;
+	}
+	case CHANGE_CLOCK:
+		db->loans->today = read_u32(change);
+		changelog_clock(db->loans->today);
+		break;
+	}
+}
+
+/* Reads a record of a follower's buffer, starting at pos. Returns the size
+ * of the record, or 0 if it has not been received whole yet.
+ */
+static size_t
+peek_change(follower_t *follower, size_t pos, change_t *change)
+{
+	if (follower->size - pos < CHANGE_HEADER)
+		return 0;
+
+	uint16_t len;
+	memcpy(&len, follower->buf + pos + 1, sizeof(len));
+	size_t size = CHANGE_HEADER + len;
+	if (follower->size - pos < size)
+		return 0;
+
+	DIE(size > CHANGE_MAX_SIZE, "corrupt change log");
+	memcpy(change->data, follower->buf + pos, size);
+	change->size = CHANGE_HEADER;
+
+	return size;
+}
+
+/* Finds the end of the transaction that starts at pos, along with its
+ * commit. Returns 0 if it has not been received whole yet.
+ */
+static size_t
+find_commit(follower_t *follower, size_t pos, change_t *commit)
+{
+	size_t size;
+
+	while ((size = peek_change(follower, pos, commit))) {
+		pos += size;
+		if (commit->data[0] == CHANGE_COMMIT)
+			return pos;
+	}
+
+	return 0;
+}
+
+// Reads whatever the log has received since the last call
+static void
+receive(follower_t *follower)
+{
+	// Drops the bytes that were applied already
+	if (follower->start) {
+		memmove(follower->buf, follower->buf + follower->start,
+			follower->size - follower->start);
+		follower->size -= follower->start;
+		follower->start = 0;
+	}
+
+	while (1) {
+		if (follower->size == follower->capacity) {
+			follower->capacity *= 2;
+			follower->buf = (unsigned char *)mem_realloc(MEM_OTHER,
+				follower->buf, follower->capacity);
+			DIE(!follower->buf, "follower->buf realloc failed");
+		}
+
+		// Nothing more has been written (or the writer has gone away)
+		ssize_t len = read(follower->fd, follower->buf + follower->size,
+			follower->capacity - follower->size);
+		if (len <= 0)
+			break;
+
+		follower->size += len;
+	}
+}
+
+/**
+ * @brief Applies at most limit of the transactions that the follower has
+ * received, then counts the ones left
+ *
+ * @param db the follower's tables
+ * @param limit the most transactions to apply
+ */
+static void
+catch_up(db_t *db, uint limit)
+{
+	change_t change;
+	size_t end;
+
+	receive(replica);
+
+	resp_set_sink(discard, NULL);
+	for (uint i = 0; i < limit; ++i) {
+		end = find_commit(replica, replica->start, &change);
+		if (!end)
+			break;
+
+		size_t size;
+		while ((size = peek_change(replica, replica->start, &change))) {
+			replica->start += size;
+			if (change.data[0] == CHANGE_COMMIT)
+				break;
+			apply_change(db, &change);
+		}
+
+		replica->applied = read_u64(&change);
+		// A follower may keep a log of its own, for followers of its own
+		changelog_commit();
+	}
+	resp_set_sink(resp_print, replica->out);
+
+	// Counts the transactions left, along with the time of the oldest one
+	replica->pending = 0;
+	for (size_t pos = replica->start;
+		(end = find_commit(replica, pos, &change)); pos = end) {
+		read_u64(&change);
+		uint64_t time = read_u64(&change);
+		if (!replica->pending++)
+			replica->pending_since = time;
+	}
+}
+
+// Prints how far behind the primary the follower is
+void
+report_lag(void)
+{
+	if (!replica) {
+		resp_msg("The library is not a replica.\n");
+		return;
+	}
+
+	uint64_t lag = 0;
+	if (replica->pending) {
+		uint64_t now = now_us();
+		if (now > replica->pending_since)
+			lag = (now - replica->pending_since) / 1000;
+	}
+
+	resp_line("Applied:%llu Pending:%u Lag:%llums\n",
+		(unsigned long long)replica->applied, replica->pending,
+		(unsigned long long)lag);
+}
+
+// Whether a command would change the tables
+static int
+is_mutation(cmd_op_t op)
+{
+	switch (op) {
+	case CMD_ADD_BOOK:
+	case CMD_BULK_LOAD:
+	case CMD_RMV_BOOK:
+	case CMD_ADD_DEF:
+	case CMD_RMV_DEF:
+	case CMD_ADD_USER:
+	case CMD_BORROW:
+	case CMD_RETURN:
+	case CMD_LOST:
+	case CMD_ADVANCE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Whether a command has to be refused, since the tables are a replica's
+int
+changelog_read_only(cmd_op_t op)
+{
+	return replica && is_mutation(op);
+}
+
+/**
+ * @brief Executes the read-only commands from the input against a replica
+ * of the primary's tables. Before each command, the replica applies (at most
+ * FOLLOW_BATCH of) the transactions that it has received from the log.
+ *
+ * @param db the follower's tables
+ * @param path the primary's log
+ * @param in the input
+ * @param out the output
+ * @return int 0 if the log could not be opened, 1 otherwise
+ */
+int
+follow_run(db_t *db, const char *path, FILE *in, FILE *out)
+{
+	follower_t state;
+	state.fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (state.fd < 0)
+		return 0;
+
+	state.capacity = 1 << 16;
+	state.buf = (unsigned char *)mem_malloc(MEM_OTHER, state.capacity);
+	DIE(!state.buf, "replica->buf malloc failed");
+	state.start = 0;
+	state.size = 0;
+	state.applied = 0;
+	state.pending = 0;
+	state.pending_since = 0;
+	state.out = out;
+	replica = &state;
+
+	// Starts from everything that the log already holds
+	do {
+		catch_up(db, FOLLOW_BATCH);
+	} while (replica->pending);
+
+	batch_t batch;
+	batch_init(&batch);
+
+	cmd_t cmd;
+	while (read_command(in, &cmd)) {
+		catch_up(db, FOLLOW_BATCH);
+
+		int running = submit_command(db, &batch, &cmd);
+		free_command(&cmd);
+		if (!running)
+			break;
+	}
+
+	batch_discard(&batch);
+
+	replica = NULL;
+	mem_free(MEM_OTHER, state.buf);
+	close(state.fd);
+	fflush(out);
+	resp_set_sink(resp_print, NULL);
+
+	return 1;
+}
+
+/**
+ * @brief Writes the whole state of the tables as the changes that rebuild it
+ * from empty tables: the clock, the books, their definitions (in the order
+ * in which they were indexed, so FIND_DEF keeps listing them in the same
+ * order), the books' statistics and the users
+ *
+ * @param db the tables
+ * @param out where the changes are written
+ */
+void
+changelog_dump(db_t *db, FILE *out)
+{
+	library_t *library = db->library;
+
+	// The changes go to out instead of the log (if there is one)
+	FILE *log = changelog;
+	uint dirty = changelog_dirty;
+	changelog = out;
+
+	changelog_clock(db->loans->today);
+
+	book_ht_cursor_t books;
+	book_ht_entry_t *book = book_ht_begin(library->books, &books);
+	for (; book; book = book_ht_next(&books))
+		changelog_book_add(book->value.name);
+
+	def_index_cursor_t keys;
+	def_index_entry_t *key = def_index_begin(library->def_index, &keys);
+	for (; key; key = def_index_next(&keys)) {
+		posting_t *posting = key->value.head;
+		for (; posting; posting = posting->next) {
+			uint len;
+			const char *val = posting_val(library, posting, key->key, &len);
+			changelog_def_put(posting->book->name, key->key, val, len);
+		}
+	}
+
+	book = book_ht_begin(library->books, &books);
+	for (; book; book = book_ht_next(&books))
+		changelog_book_state(library, &book->value);
+
+	user_ht_cursor_t users;
+	user_ht_entry_t *user = user_ht_begin(db->users, &users);
+	for (; user; user = user_ht_next(&users))
+		changelog_user(&user->value);
+
+	changelog = log;
+	changelog_dirty = dirty;
+}
+
+/**
+ * @brief Rebuilds the state written by changelog_dump into empty tables
+ * (the memory budget does not apply, since the state already fit in it)
+ *
+ * @param db the tables
+ * @param image the changes
+ * @param size their number of bytes
+ */
+void
+changelog_load(db_t *db, const unsigned char *image, size_t size)
+{
+	size_t budget = mem_get_budget();
+	mem_set_budget(0);
+
+	change_t change;
+	for (size_t pos = 0; pos + CHANGE_HEADER <= size;) {
+		uint16_t len;
+		memcpy(&len, image + pos + 1, sizeof(len));
+		DIE(CHANGE_HEADER + len > CHANGE_MAX_SIZE, "corrupt tables image");
+
+		memcpy(change.data, image + pos, CHANGE_HEADER + len);
+		apply_change(db, &change);
+		pos += CHANGE_HEADER + len;
+	}
+
+	mem_set_budget(budget);
+}
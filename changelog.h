@@ -0,0 +1,68 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef CHANGELOG_H_
+#define CHANGELOG_H_
+
+#include <stdio.h>
+#include "utils.h"
+#include "book.h"
+#include "user.h"
+#include "command.h"
+
+/* The change log. A primary started with --changelog writes every change
+ * it makes to its tables (the state it leaves behind, not the command that
+ * made it) to a file or a FIFO, one transaction per command. A follower
+ * started with --follow tails the log, applies it to its own tables and
+ * serves the read-only commands from them.
+ */
+
+// The most transactions a follower applies before executing a command
+#define FOLLOW_BATCH 256
+
+int
+changelog_open(const char *path);
+
+void
+changelog_close(void);
+
+void
+changelog_book_add(const char *name);
+
+void
+changelog_book_remove(const char *name);
+
+void
+changelog_def_put(const char *book_name, const char *key, const char *val,
+	uint len);
+
+void
+changelog_def_remove(const char *book_name, const char *key);
+
+void
+changelog_book_state(library_t *library, book_t *book);
+
+void
+changelog_user(const user_t *user);
+
+void
+changelog_clock(uint today);
+
+void
+changelog_commit(void);
+
+void
+report_lag(void);
+
+int
+changelog_read_only(cmd_op_t op);
+
+int
+follow_run(db_t *db, const char *path, FILE *in, FILE *out);
+
+void
+changelog_dump(db_t *db, FILE *out);
+
+void
+changelog_load(db_t *db, const unsigned char *image, size_t size);
+
+#endif  // CHANGELOG_H_
@@ -0,0 +1,621 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "command.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+#include "book.h"
+#include "user.h"
+#include "resp.h"
+#include "changelog.h"
+#include "snapshot.h"
+#include "batch.h"
+#include "tenant.h"
+#include "bulk.h"
+
+// The name of each command
+static const struct {
+	const char *name;
+	cmd_op_t op;
+} cmd_names[] = {
+	{"ADD_BOOK", CMD_ADD_BOOK},
+	{"GET_BOOK", CMD_GET_BOOK},
+	{"RMV_BOOK", CMD_RMV_BOOK},
+	{"ADD_DEF", CMD_ADD_DEF},
+	{"GET_DEF", CMD_GET_DEF},
+	{"RMV_DEF", CMD_RMV_DEF},
+	{"ADD_USER", CMD_ADD_USER},
+	{"BORROW", CMD_BORROW},
+	{"RETURN", CMD_RETURN},
+	{"LOST", CMD_LOST},
+	{"LIBRARY_STATS", CMD_LIBRARY_STATS},
+	{"FIND_DEF", CMD_FIND_DEF},
+	{"LIST_BOOKS", CMD_LIST_BOOKS},
+	{"MEMORY", CMD_MEMORY},
+	{"LAG", CMD_LAG},
+	{"ADVANCE", CMD_ADVANCE},
+	{"OVERDUE", CMD_OVERDUE},
+	{"SNAPSHOT", CMD_SNAPSHOT},
+	{"CACHE_STATS", CMD_CACHE_STATS},
+	{"PROFILE", CMD_PROFILE},
+	{"TENANT", CMD_TENANT},
+	{"TENANTS", CMD_TENANTS},
+	{"BULK_LOAD", CMD_BULK_LOAD},
+	{"BEGIN", CMD_BEGIN},
+	{"COMMIT", CMD_COMMIT},
+	{"EXIT", CMD_EXIT},
+};
+
+// Creates the library and the user database
+db_t *
+db_create(const db_opts_t *opts)
+{
+	db_t *db = (db_t *)mem_malloc(MEM_OTHER, sizeof(db_t));
+	DIE(!db, "db malloc failed");
+
+	db->library = library_create(opts->book_key_width, opts->name_index,
+		opts->filtered, opts->dict);
+	db->users = user_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR,
+		opts->user_key_width, opts->filtered, MEM_USERS, NULL);
+	db->loans = loans_create();
+
+	return db;
+}
+
+// Frees the library and the user database
+void
+db_free(db_t *db)
+{
+	if (!db)
+		return;
+
+	library_free(db->library);
+	free_users(db->users);
+	loans_free(db->loans);
+	mem_free(MEM_OTHER, db);
+}
+
+// Returns the command with the given name (CMD_INVALID if there is none)
+cmd_op_t
+parse_op(const char *name)
+{
+	for (uint i = 0; i < sizeof(cmd_names) / sizeof(cmd_names[0]); ++i)
+		if (!strcmp(name, cmd_names[i].name))
+			return cmd_names[i].op;
+
+	return CMD_INVALID;
+}
+
+/**
+ * @brief Breaks a line down into a command. An ADD_BOOK is given room for
+ * the definitions that follow it, which are then filled in by parse_def.
+ * A command with an argument that is too long (or with a definition key
+ * that is, for ADD_DEF) is invalid, instead of having the argument cut.
+ *
+ * @param line the line (without the '\n'), which is modified
+ * @param cmd the command
+ * @return int the number of definitions that follow the command
+ */
+int
+parse_command(char *line, cmd_t *cmd)
+{
+	int argc = 0;
+	char argv[NR_ARGS][MAX_BOOK_SIZE] = {{'\0'}};
+
+	int fits = break_down_line(line, &argc, argv, '"');
+
+	// Keeps only the arguments that commands use
+	cmd->op = parse_op(argv[0]);
+	cmd->argc = argc < CMD_ARGS ? argc : CMD_ARGS;
+	memcpy(cmd->argv, argv, sizeof(cmd->argv));
+	cmd->num_defs = 0;
+	cmd->defs = NULL;
+
+	uint days, limit;
+	if ((cmd->op == CMD_ADVANCE || cmd->op == CMD_OVERDUE) &&
+		!parse_clock_args(cmd, &days, &limit))
+		cmd->op = CMD_INVALID;
+
+	// An invalid ADD_BOOK still reads its definitions
+	int num_defs = cmd->op == CMD_ADD_BOOK ? atoi(argv[2]) : 0;
+	if (!fits || (cmd->op == CMD_ADD_DEF &&
+		strlen(argv[2]) >= MAX_DEF_NAME_SIZE))
+		cmd->op = CMD_INVALID;
+
+	// Makes room for the book's definitions
+	if (num_defs <= 0)
+		return 0;
+
+	cmd->defs = (def_arg_t *)mem_calloc(MEM_OTHER, num_defs,
+		sizeof(def_arg_t));
+	DIE(!cmd->defs, "cmd->defs calloc failed");
+	cmd->num_defs = num_defs;
+
+	return num_defs;
+}
+
+/**
+ * @brief Reads the arguments of ADVANCE (a number of days) or OVERDUE (a
+ * day, then a limit that may be left out)
+ *
+ * @param cmd the command
+ * @param days receives the number of days (or the day)
+ * @param limit receives the limit (0 if there is none)
+ * @return int 1 on success, 0 if an argument is not a non-negative number
+ */
+int
+parse_clock_args(const cmd_t *cmd, uint *days, uint *limit)
+{
+	*limit = 0;
+	if (!parse_uint(cmd->argv[1], days))
+		return 0;
+
+	return cmd->op != CMD_OVERDUE || !cmd->argv[2][0] ||
+		parse_uint(cmd->argv[2], limit);
+}
+
+/* Breaks a line that follows an ADD_BOOK down into a definition. Returns 0
+ * if its key or its value is too long, in which case the ADD_BOOK is
+ * invalid.
+ */
+int
+parse_def(char *line, def_arg_t *def)
+{
+	int argc = 0;
+	char argv[NR_ARGS][MAX_BOOK_SIZE] = {{'\0'}};
+
+	int fits = break_down_line(line, &argc, argv, '"');
+
+	// Copies the key and the val
+	memcpy(def->key, argv[0], MAX_DEF_NAME_SIZE);
+	memcpy(def->val, argv[1], MAX_BOOK_SIZE);
+
+	return fits && strlen(argv[0]) < MAX_DEF_NAME_SIZE;
+}
+
+// Reads a line, without its '\n'
+static int
+read_line(FILE *in, char line[LINE_SIZE])
+{
+	if (!fgets(line, LINE_SIZE, in))
+		return 0;
+
+	int len = strlen(line);
+
+	if (line[len - 1] == '\n')
+		line[len - 1] = '\0';
+
+	return 1;
+}
+
+/**
+ * @brief Reads a command, along with the definitions that follow it if it
+ * is an ADD_BOOK
+ *
+ * @param in the input
+ * @param cmd the command
+ * @return int 0 if the input has ended, 1 otherwise
+ */
+int
+read_command(FILE *in, cmd_t *cmd)
+{
+	char line[LINE_SIZE];
+
+	if (!read_line(in, line))
+		return 0;
+
+	int num_defs = parse_command(line, cmd);
+
+	// Reads the book's definitions (the missing ones are left empty)
+	for (int i = 0; i < num_defs; ++i) {
+		if (!read_line(in, line))
+			break;
+		if (!parse_def(line, &cmd->defs[i]))
+			cmd->op = CMD_INVALID;
+	}
+
+	return 1;
+}
+
+// Frees the memory allocated for a command
+void
+free_command(cmd_t *cmd)
+{
+	mem_free(MEM_OTHER, cmd->defs);
+	cmd->defs = NULL;
+	cmd->num_defs = 0;
+}
+
+/**
+ * @brief Prints the memory in use, in total and by the class it is charged to
+ *
+ * @param total the number of bytes in use
+ * @param peak the most bytes that have been in use
+ * @param used the number of bytes charged to each class (MEM_CLASSES values)
+ */
+void
+report_memory(size_t total, size_t peak, const size_t *used)
+{
+	size_t budget = mem_get_budget();
+	if (budget)
+		resp_line("Memory:%zu Peak:%zu Budget:%zu\n", total, peak, budget);
+	else
+		resp_line("Memory:%zu Peak:%zu Budget:none\n", total, peak);
+
+	for (uint i = 0; i < MEM_CLASSES; ++i)
+		resp_line("%s:%zu\n", mem_class_name(i), used[i]);
+}
+
+// Prints the rankings of the books and of the users (arg is the db_t)
+void
+report_rankings(void *arg)
+{
+	db_t *db = (db_t *)arg;
+
+	resp_msg("Books ranking:\n");
+	// Checks if there are any books, then prints them if there are
+	if (db->library->books->size)
+		top_books(db->library);
+	resp_msg("Users ranking:\n");
+	// Checks if there are any users, then prints them if there are
+	if (db->users->size)
+		top_users(db->users);
+}
+
+// An allocation site, along with what it allocated
+typedef struct site_prof_t
+{
+	const char *site;
+	mem_prof_t prof;
+} site_prof_t;
+
+// Orders allocation sites by the bytes they allocated, then by name
+static int
+compare_sites(const void *a, const void *b)
+{
+	const site_prof_t *site1 = (const site_prof_t *)a;
+	const site_prof_t *site2 = (const site_prof_t *)b;
+
+	if (site1->prof.bytes != site2->prof.bytes)
+		return site1->prof.bytes > site2->prof.bytes ? -1 : 1;
+
+	return strcmp(site1->site, site2->site);
+}
+
+// Prints a profile (the number of calls, bytes and live blocks)
+static void
+report_prof(const char *name, const mem_prof_t *prof)
+{
+	resp_line("%s Calls:%llu Bytes:%llu Live:%llu\n", name,
+		(unsigned long long)prof->calls, (unsigned long long)prof->bytes,
+		(unsigned long long)prof->live);
+}
+
+/* Prints what every allocation site allocated (the busiest first), then
+ * what was allocated while executing each kind of command
+ */
+void
+report_profile(void)
+{
+	if (!mem_profiling()) {
+		resp_msg("Profiling is off.\n");
+		return;
+	}
+
+	const char *names[MEM_PROF_SITES];
+	mem_prof_t profs[MEM_PROF_SITES];
+	uint cnt = mem_profile_sites(names, profs);
+
+	site_prof_t sites[MEM_PROF_SITES];
+	for (uint i = 0; i < cnt; ++i) {
+		sites[i].site = names[i];
+		sites[i].prof = profs[i];
+	}
+	qsort(sites, cnt, sizeof(site_prof_t), compare_sites);
+
+	resp_msg("Allocation sites:\n");
+	for (uint i = 0; i < cnt; ++i)
+		report_prof(sites[i].site, &sites[i].prof);
+
+	// Tag 0 is for everything done outside of the commands
+	resp_msg("Commands:\n");
+	mem_prof_t prof;
+	mem_profile_tagged(0, &prof);
+	if (prof.calls)
+		report_prof("None", &prof);
+
+	for (uint i = 0; i < sizeof(cmd_names) / sizeof(cmd_names[0]); ++i) {
+		mem_profile_tagged(cmd_names[i].op + 1, &prof);
+		if (prof.calls)
+			report_prof(cmd_names[i].name, &prof);
+	}
+
+	mem_profile_tagged(CMD_INVALID + 1, &prof);
+	if (prof.calls)
+		report_prof("INVALID", &prof);
+}
+
+/* Returns the book a command is about, unless the batch that the command
+ * is part of has already looked it up (key)
+ */
+static book_t *
+find_book(library_t *library, const char *name, batch_key_t *key)
+{
+	return key ? key->book : book_ht_get(library->books, name);
+}
+
+// Returns the user a command is about, just like find_book
+static user_t *
+find_user(user_ht_t *users, const char *name, batch_key_t *key)
+{
+	return key ? key->user : user_ht_get(users, name);
+}
+
+/**
+ * @brief Applies a command to the tables, without handing its changes to
+ * the followers yet
+ *
+ * @param db the tables the command is executed against
+ * @param cmd the command
+ * @param book_key the book of the command, as the batch looked it up (or
+ * NULL to look it up)
+ * @param user_key the user of the command, just like book_key
+ * @return int 0 if the command was EXIT, 1 otherwise
+ */
+static int
+apply_command(db_t *db, cmd_t *cmd, batch_key_t *book_key,
+	batch_key_t *user_key)
+{
+	library_t *library = db->library;
+	user_ht_t *users = db->users;
+	loans_t *loans = db->loans;
+	char (*argv)[MAX_BOOK_SIZE] = cmd->argv;
+
+	// The allocations made by the command are profiled as made by its kind
+	mem_profile_tag(cmd->op + 1);
+
+	// Executing different commands
+	switch (cmd->op) {
+	case CMD_ADD_BOOK:
+		add_book(library, argv[1], cmd->num_defs, cmd->defs);
+		break;
+	case CMD_GET_BOOK:
+		show_book(library, find_book(library, argv[1], book_key));
+		break;
+	case CMD_RMV_BOOK:
+		drop_book(library, find_book(library, argv[1], book_key));
+		break;
+	case CMD_ADD_DEF: {
+		// Creating the def_arg_t struct
+		def_arg_t def;
+		memcpy(def.key, argv[2], MAX_DEF_NAME_SIZE);
+		memcpy(def.val, argv[3], MAX_BOOK_SIZE);
+		add_def_to(library, find_book(library, argv[1], book_key), &def);
+		break;
+	}
+	case CMD_GET_DEF:
+		get_def_from(library, find_book(library, argv[1], book_key),
+			argv[2]);
+		break;
+	case CMD_RMV_DEF:
+		remove_def_from(library, find_book(library, argv[1], book_key),
+			argv[2]);
+		break;
+	case CMD_ADD_USER:
+		add_user(users, argv[1]);
+		break;
+	case CMD_BORROW:
+		borrow(library, loans, find_user(users, argv[1], user_key),
+			find_book(library, argv[2], book_key), atoi(argv[3]));
+		break;
+	case CMD_RETURN:
+		return_func(library, loans, find_user(users, argv[1], user_key),
+			find_book(library, argv[2], book_key), argv[2], atoi(argv[3]),
+			atoi(argv[4]));
+		break;
+	case CMD_LOST:
+		lost(library, loans, find_user(users, argv[1], user_key),
+			find_book(library, argv[2], book_key));
+		break;
+	case CMD_LIBRARY_STATS:
+		library_stats(library);
+		break;
+	case CMD_FIND_DEF:
+		find_def(library, argv[1]);
+		break;
+	case CMD_LIST_BOOKS:
+		list_books(library, argv[1], atoi(argv[2]));
+		break;
+	case CMD_MEMORY: {
+		size_t used[MEM_CLASSES];
+		for (uint i = 0; i < MEM_CLASSES; ++i)
+			used[i] = mem_used(i);
+		report_memory(mem_total(), mem_peak(), used);
+		break;
+	}
+	case CMD_LAG:
+		report_lag();
+		break;
+	case CMD_ADVANCE:
+	case CMD_OVERDUE: {
+		uint days, limit;
+		if (!parse_clock_args(cmd, &days, &limit))
+			resp_msg("Invalid command. Please try again.\n");
+		else if (cmd->op == CMD_ADVANCE)
+			advance(library, loans, days);
+		else
+			overdue(loans, days, limit);
+		break;
+	}
+	case CMD_SNAPSHOT:
+		// The rankings are written by a child, from the tables as of now
+		if (snapshot_take(argv[1], report_rankings, db))
+			resp_msg("The snapshot is being written.\n");
+		else
+			resp_msg("The snapshot could not be taken.\n");
+		break;
+	case CMD_CACHE_STATS:
+		report_line_cache(library->line_hits, library->line_misses);
+		break;
+	case CMD_PROFILE:
+		report_profile();
+		break;
+	case CMD_TENANT:
+		tenant_select(argv[1]);
+		break;
+	case CMD_TENANTS:
+		tenant_list();
+		break;
+	case CMD_BULK_LOAD:
+		bulk_load(library, argv[1]);
+		break;
+	case CMD_BEGIN:
+	case CMD_COMMIT:
+		// Batches are handled by submit_command
+		resp_msg("There is no batch to commit.\n");
+		break;
+	case CMD_EXIT:
+		report_rankings(db);
+		// With --profile, the final profile follows the rankings
+		if (mem_profiling())
+			report_profile();
+		return 0;
+	case CMD_INVALID:
+		resp_msg("Invalid command. Please try again.\n");
+		break;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief Executes a command
+ *
+ * @param db the tables the command is executed against
+ * @param cmd the command
+ * @return int 0 if the command was EXIT, 1 otherwise
+ */
+int
+execute_command(db_t *db, cmd_t *cmd)
+{
+	int running = apply_command(db, cmd, NULL, NULL);
+	mem_profile_tag(0);
+	if (!running)
+		return 0;
+
+	// Hands the command's changes (if any) to the followers
+	changelog_commit();
+
+	return 1;
+}
+
+// Looks up a book or a user of a batch in the tables (ctx is the db_t)
+static int
+find_batch_key(void *ctx, uint is_user, const char *name, batch_key_t *key)
+{
+	db_t *db = (db_t *)ctx;
+
+	if (is_user) {
+		key->user = user_ht_get(db->users, name);
+		if (!key->user)
+			return 0;
+		key->state = *key->user;
+		return 1;
+	}
+
+	key->book = book_ht_get(db->library->books, name);
+	if (!key->book)
+		return 0;
+	key->borrowed = db->library->stats.status[key->book->id];
+	return 1;
+}
+
+// Checks if a book of a batch has a definition (ctx is the db_t)
+static int
+find_batch_def(void *ctx, const char *book, const char *def)
+{
+	library_t *library = ((db_t *)ctx)->library;
+
+	return has_def(library, book_ht_get(library->books, book), def);
+}
+
+// Checks if what a batch adds fits in the memory budget (ctx is the db_t)
+static int
+batch_fits(void *ctx, const batch_t *batch)
+{
+	uint num_books = 0, num_defs = 0;
+	for (uint i = 0; i < batch->size; ++i)
+		batch_count_adds(&batch->cmds[i], &num_books, &num_defs);
+
+	return !mem_over_budget(adds_cost(((db_t *)ctx)->library, num_books,
+		num_defs));
+}
+
+/* Executes all the commands of a batch (once it has been checked), then
+ * hands all of their changes to the followers as a single transaction. The
+ * books and the users were looked up by batch_check, so only the commands
+ * that add or remove one look it up again. The batch was checked against
+ * the memory budget as a whole, so its commands are not checked again.
+ */
+static void
+execute_batch(db_t *db, batch_t *batch)
+{
+	size_t budget = mem_get_budget();
+	mem_set_budget(0);
+
+	for (uint i = 0; i < batch->size; ++i) {
+		cmd_t *cmd = &batch->cmds[i];
+		apply_command(db, cmd, batch->book_keys[i], batch->user_keys[i]);
+
+		if (cmd->op == CMD_ADD_BOOK || cmd->op == CMD_RMV_BOOK)
+			batch->book_keys[i]->book = book_ht_get(db->library->books,
+				cmd->argv[1]);
+		else if (cmd->op == CMD_LOST)
+			batch->book_keys[i]->book = book_ht_get(db->library->books,
+				cmd->argv[2]);
+		else if (cmd->op == CMD_ADD_USER)
+			batch->user_keys[i]->user = user_ht_get(db->users, cmd->argv[1]);
+	}
+	mem_profile_tag(0);
+	mem_set_budget(budget);
+
+	changelog_commit();
+	batch_discard(batch);
+}
+
+/**
+ * @brief Executes a command read from an input, within the input's batch:
+ * BEGIN and the commands that follow it are queued, and COMMIT executes
+ * them
+ *
+ * @param db the tables the command is executed against
+ * @param batch the input's batch
+ * @param cmd the command (the batch may take its definitions)
+ * @return int 0 if the command was EXIT, 1 otherwise
+ */
+int
+submit_command(db_t *db, batch_t *batch, cmd_t *cmd)
+{
+	// The command runs against the tables of the input's tenant
+	db = tenant_db(db);
+
+	if (batch_take(batch, cmd))
+		return 1;
+
+	if (cmd->op == CMD_COMMIT) {
+		batch_probe_t probe = {find_batch_key, find_batch_def, batch_fits, db};
+		if (batch_check(batch, &probe))
+			execute_batch(db, batch);
+		return 1;
+	}
+
+	if (changelog_read_only(cmd->op)) {
+		resp_msg("The library is a read-only replica.\n");
+		return 1;
+	}
+
+	return execute_command(db, cmd);
+}
@@ -0,0 +1,114 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdio.h>
+#include "utils.h"
+#include "book.h"
+#include "user.h"
+
+struct batch_t;
+
+// The most arguments a command has (RETURN user book days rating)
+#define CMD_ARGS 5
+
+typedef enum cmd_op_t
+{
+	CMD_INVALID,
+	CMD_ADD_BOOK,
+	CMD_GET_BOOK,
+	CMD_RMV_BOOK,
+	CMD_ADD_DEF,
+	CMD_GET_DEF,
+	CMD_RMV_DEF,
+	CMD_ADD_USER,
+	CMD_BORROW,
+	CMD_RETURN,
+	CMD_LOST,
+	CMD_LIBRARY_STATS,
+	CMD_FIND_DEF,
+	CMD_LIST_BOOKS,
+	CMD_MEMORY,
+	CMD_LAG,
+	CMD_ADVANCE,
+	CMD_OVERDUE,
+	CMD_SNAPSHOT,
+	CMD_CACHE_STATS,
+	CMD_PROFILE,
+	CMD_TENANT,
+	CMD_TENANTS,
+	CMD_BULK_LOAD,
+	CMD_BEGIN,
+	CMD_COMMIT,
+	CMD_EXIT
+} cmd_op_t;
+
+// A command, already broken down into arguments
+typedef struct cmd_t
+{
+	cmd_op_t op;  // the command (taken from argv[0])
+	int argc;  // the number of arguments
+	char argv[CMD_ARGS][MAX_BOOK_SIZE];  // the arguments
+	int num_defs;  // the number of definitions that follow ADD_BOOK
+	def_arg_t *defs;  // the definitions that follow ADD_BOOK
+} cmd_t;
+
+// The options that the tables are created with
+typedef struct db_opts_t
+{
+	uint book_key_width;  // the width of book names (0 for variable length)
+	uint user_key_width;  // the width of usernames (0 for variable length)
+	uint name_index;  // whether the library keeps an index of the names
+	uint filtered;  // whether the hashtables keep filters of their keys
+	dict_t *dict;  // the dictionary the books are packed in (or NULL)
+} db_opts_t;
+
+// The tables that the commands are executed against
+typedef struct db_t
+{
+	library_t *library;
+	user_ht_t *users;  // the users, banned ones included
+	loans_t *loans;  // the users who have a book borrowed, by due day
+} db_t;
+
+db_t *
+db_create(const db_opts_t *opts);
+
+void
+db_free(db_t *db);
+
+cmd_op_t
+parse_op(const char *name);
+
+int
+parse_command(char *line, cmd_t *cmd);
+
+int
+parse_def(char *line, def_arg_t *def);
+
+int
+parse_clock_args(const cmd_t *cmd, uint *days, uint *limit);
+
+int
+read_command(FILE *in, cmd_t *cmd);
+
+void
+free_command(cmd_t *cmd);
+
+void
+report_memory(size_t total, size_t peak, const size_t *used);
+
+void
+report_rankings(void *arg);
+
+void
+report_profile(void);
+
+int
+execute_command(db_t *db, cmd_t *cmd);
+
+int
+submit_command(db_t *db, struct batch_t *batch, cmd_t *cmd);
+
+#endif  // COMMAND_H_
@@ -0,0 +1,93 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "def_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+#include "ht_typed.h"
+
+HT_TYPED_DEFINE(def_index, posting_list_t)
+
+// Frees all the postings of a list (the index's free_function)
+void
+free_posting_list(posting_list_t *list)
+{
+	posting_t *it = list->head;
+
+	while (it) {
+		posting_t *next = it->next;
+		mem_free(MEM_INDEX, it);
+		it = next;
+	}
+}
+
+/**
+ * @brief Adds a definition to the index
+ *
+ * @param index the index
+ * @param key the definition's key
+ * @param book the book that contains the definition
+ * @param def the definition (it must not move in memory)
+ * @return posting_t * the definition's posting
+ */
+posting_t *
+index_def(def_index_t *index, const char *key, struct book_t *book,
+	struct def_t *def)
+{
+	// Gets the key's list, creating it if it is the key's first posting
+	posting_list_t *list = def_index_get(index, key);
+	if (!list) {
+		posting_list_t empty = {NULL, NULL, 0};
+		list = def_index_put(index, key, &empty);
+	}
+
+	posting_t *posting = (posting_t *)mem_malloc(MEM_INDEX, sizeof(posting_t));
+	DIE(!posting, "posting malloc failed");
+	posting->book = book;
+	posting->def = def;
+	posting->list = list;
+
+	// Adds the posting at the end of the list
+	posting->next = NULL;
+	posting->prev = list->tail;
+	if (list->tail)
+		list->tail->next = posting;
+	else
+		list->head = posting;
+	list->tail = posting;
+	++(list->size);
+
+	return posting;
+}
+
+/**
+ * @brief Removes a definition from the index
+ *
+ * @param index the index
+ * @param posting the definition's posting
+ */
+void
+unindex_def(def_index_t *index, posting_t *posting)
+{
+	posting_list_t *list = posting->list;
+
+	// Unties the posting from its list
+	if (posting->prev)
+		posting->prev->next = posting->next;
+	else
+		list->head = posting->next;
+	if (posting->next)
+		posting->next->prev = posting->prev;
+	else
+		list->tail = posting->prev;
+	--(list->size);
+
+	mem_free(MEM_INDEX, posting);
+
+	// A key that is no longer defined anywhere leaves the index
+	if (!list->size)
+		def_index_remove_value(index, list);
+}
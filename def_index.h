@@ -0,0 +1,49 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef DEF_INDEX_H_
+#define DEF_INDEX_H_
+
+#include <stdint.h>
+#include "utils.h"
+#include "ht_typed.h"
+
+struct book_t;
+struct def_t;
+
+/* The inverted index of definitions: for every definition key, the list of
+ * books (and their definitions) that contain it. Every definition in the
+ * library has exactly one posting, which it points to, so a definition is
+ * unindexed in O(1).
+ */
+typedef struct posting_t
+{
+	struct book_t *book;  // the book that contains the definition
+	struct def_t *def;  // the definition (inside the book's hashtable)
+	struct posting_list_t *list;  // the list the posting is in
+	struct posting_t *prev;
+	struct posting_t *next;
+	uint64_t seq;  // when the definition was indexed (orders the postings)
+} posting_t;
+
+// The postings of a key, in the order in which they were added
+typedef struct posting_list_t
+{
+	posting_t *head;
+	posting_t *tail;
+	uint size;
+} posting_list_t;
+
+// The index hashtable (definition key -> posting_list_t)
+HT_TYPED_DECLARE(def_index, posting_list_t);
+
+void
+free_posting_list(posting_list_t *list);
+
+posting_t *
+index_def(def_index_t *index, const char *key, struct book_t *book,
+	struct def_t *def);
+
+void
+unindex_def(def_index_t *index, posting_t *posting);
+
+#endif  // DEF_INDEX_H_
@@ -0,0 +1,120 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "dict.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+
+HT_TYPED_DEFINE(dict_ht, dict_str_t)
+
+// Creates an empty dictionary
+dict_t *
+dict_create(uint filtered, mem_class_t mem_class)
+{
+	dict_t *dict = (dict_t *)mem_calloc(mem_class, 1, sizeof(dict_t));
+	DIE(!dict, "dict calloc failed");
+
+	dict->strs = dict_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR, 0, filtered,
+		mem_class, NULL);
+
+	return dict;
+}
+
+// Frees a dictionary, along with all of its strings
+void
+dict_free(dict_t *dict)
+{
+	if (!dict)
+		return;
+
+	mem_class_t mem_class = dict->strs->mem_class;
+	dict_ht_free(dict->strs);
+	mem_free(mem_class, dict->by_id);
+	mem_free(mem_class, dict->free_ids);
+	mem_free(mem_class, dict);
+}
+
+// Gives a new string an id (a free one, if there is any)
+static uint
+new_id(dict_t *dict)
+{
+	if (dict->num_free)
+		return dict->free_ids[--(dict->num_free)];
+
+	if (dict->num_ids == dict->capacity) {
+		dict->capacity = dict->capacity ? 2 * dict->capacity : HMAX;
+		dict->by_id = (dict_ht_entry_t **)mem_realloc(dict->strs->mem_class,
+			dict->by_id, dict->capacity * sizeof(dict_ht_entry_t *));
+		DIE(!dict->by_id, "dict->by_id realloc failed");
+	}
+
+	return dict->num_ids++;
+}
+
+/**
+ * @brief Takes a reference to a string, adding it to the dictionary if it
+ * is not there yet
+ *
+ * @param dict the dictionary
+ * @param str the string (it need not be '\0'-terminated)
+ * @param len its length (at most MAX_BOOK_SIZE)
+ * @return uint the string's id
+ */
+uint
+dict_intern(dict_t *dict, const char *str, uint len)
+{
+	char key[MAX_BOOK_SIZE + 1];
+	memcpy(key, str, len);
+	key[len] = '\0';
+
+	dict_str_t *found = dict_ht_get(dict->strs, key);
+	if (found) {
+		++(found->refs);
+		return found->id;
+	}
+
+	dict_str_t new_str;
+	new_str.id = new_id(dict);
+	new_str.refs = 1;
+	new_str.len = len;
+
+	// The entries never move, so the id leads straight to the string
+	dict_str_t *stored = dict_ht_put(dict->strs, key, &new_str);
+	dict->by_id[new_str.id] = (dict_ht_entry_t *)((char *)stored -
+		offsetof(dict_ht_entry_t, value));
+
+	return new_str.id;
+}
+
+// Returns the id of a string (DICT_NONE if it is not in the dictionary)
+uint
+dict_find(dict_t *dict, const char *str)
+{
+	dict_str_t *found = dict_ht_get(dict->strs, str);
+
+	return found ? found->id : DICT_NONE;
+}
+
+// Drops a reference to a string, removing it once nothing refers to it
+void
+dict_release(dict_t *dict, uint id)
+{
+	dict_str_t *str = &dict->by_id[id]->value;
+	if (--(str->refs))
+		return;
+
+	dict_ht_remove_value(dict->strs, str);
+	dict->by_id[id] = NULL;
+
+	if (dict->num_free == dict->free_capacity) {
+		dict->free_capacity = dict->free_capacity ?
+			2 * dict->free_capacity : HMAX;
+		dict->free_ids = (uint *)mem_realloc(dict->strs->mem_class,
+			dict->free_ids, dict->free_capacity * sizeof(uint));
+		DIE(!dict->free_ids, "dict->free_ids realloc failed");
+	}
+	dict->free_ids[dict->num_free++] = id;
+}
@@ -0,0 +1,66 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef DICT_H_
+#define DICT_H_
+
+#include "utils.h"
+#include "ht_typed.h"
+#include "mem.h"
+
+// The id that no string has
+#define DICT_NONE ((uint)-1)
+
+/* A dictionary of strings, shared by all the books of the libraries that
+ * pack their definitions (by every tenant's library, in a process that hosts
+ * several of them). Every distinct string is stored once and gets a small
+ * dense id, so a definition only holds the ids of its key and its value.
+ * Each string counts the references to it, and it leaves the dictionary
+ * (freeing its id for the next new string) once the last one is dropped.
+ */
+typedef struct dict_str_t
+{
+	uint id;
+	uint refs;  // the number of references to the string
+	uint len;  // the string's length
+} dict_str_t;
+
+// The hashtable of strings (string -> dict_str_t)
+HT_TYPED_DECLARE(dict_ht, dict_str_t);
+
+typedef struct dict_t
+{
+	dict_ht_t *strs;  // the strings
+	dict_ht_entry_t **by_id;  // the entry of each id (NULL for a free id)
+	uint num_ids;  // the number of ids given out so far
+	uint capacity;  // the number of ids by_id has room for
+	uint *free_ids;  // the ids of the strings that left the dictionary
+	uint num_free;
+	uint free_capacity;
+} dict_t;
+
+dict_t *
+dict_create(uint filtered, mem_class_t mem_class);
+
+void
+dict_free(dict_t *dict);
+
+uint
+dict_intern(dict_t *dict, const char *str, uint len);
+
+uint
+dict_find(dict_t *dict, const char *str);
+
+void
+dict_release(dict_t *dict, uint id);
+
+// Returns the string with the given id, along with its length
+static inline const char *
+dict_str(const dict_t *dict, uint id, uint *len)
+{
+	dict_ht_entry_t *it = dict->by_id[id];
+	*len = it->value.len;
+
+	return it->key;
+}
+
+#endif  // DICT_H_
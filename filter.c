@@ -0,0 +1,153 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "filter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include "utils.h"
+#include "mem.h"
+
+// The number of 64-bit words in a block
+#define BLOCK_WORDS (FILTER_BLOCK_COUNTERS / 16)
+
+// The largest value of a counter
+#define COUNTER_MAX 15u
+
+/* Spreads the bits of a key's hash (the splitmix64 finalizer), so that the
+ * block and the counters do not depend on the bits that pick its bucket
+ */
+static inline uint64_t
+mix(uint hash)
+{
+	uint64_t x = (uint64_t)hash * 0x9E3779B97F4A7C15ULL;
+
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+	return x ^ (x >> 31);
+}
+
+// Returns the first word of the key's block
+static inline uint64_t *
+block_of(filter_t *filter, uint64_t x)
+{
+	return filter->words + (size_t)((x >> 32) % filter->num_blocks)
+		* BLOCK_WORDS;
+}
+
+// Returns the index (in the block) of the key's i-th counter
+static inline uint
+counter_of(uint64_t x, uint i)
+{
+	return (x >> (7 * i)) & (FILTER_BLOCK_COUNTERS - 1);
+}
+
+// Creates a filter sized for capacity keys, charged to mem_class
+filter_t *
+filter_create(uint capacity, mem_class_t mem_class)
+{
+	filter_t *filter = (filter_t *)mem_malloc(mem_class, sizeof(filter_t));
+	DIE(!filter, "filter malloc failed");
+	filter->mem_class = mem_class;
+
+	uint64_t counters = (uint64_t)capacity * FILTER_COUNTERS_PER_KEY;
+	filter->num_blocks = (counters + FILTER_BLOCK_COUNTERS - 1)
+		/ FILTER_BLOCK_COUNTERS;
+	if (!filter->num_blocks)
+		filter->num_blocks = 1;
+
+	filter->words = (uint64_t *)mem_calloc(mem_class,
+		(size_t)filter->num_blocks * BLOCK_WORDS, sizeof(uint64_t));
+	DIE(!filter->words, "filter->words calloc failed");
+
+	return filter;
+}
+
+// Frees a filter
+void
+filter_free(filter_t *filter)
+{
+	if (!filter)
+		return;
+
+	mem_free(filter->mem_class, filter->words);
+	mem_free(filter->mem_class, filter);
+}
+
+// Adds a key (given by its hash) to the filter
+void
+filter_add(filter_t *filter, uint hash)
+{
+	uint64_t x = mix(hash);
+	uint64_t *block = block_of(filter, x);
+
+	for (uint i = 0; i < FILTER_PROBES; ++i) {
+		uint c = counter_of(x, i);
+		uint64_t *word = &block[c / 16];
+		uint shift = (c % 16) * 4;
+
+		if (((*word >> shift) & COUNTER_MAX) != COUNTER_MAX)
+			*word += (uint64_t)1 << shift;
+	}
+}
+
+/* Adds a key just like filter_add, while other threads may be adding keys
+ * too. The counters only grow (up to COUNTER_MAX), so the filter ends up
+ * the same in whatever order the keys are added.
+ */
+void
+filter_add_atomic(filter_t *filter, uint hash)
+{
+	uint64_t x = mix(hash);
+	uint64_t *block = block_of(filter, x);
+
+	for (uint i = 0; i < FILTER_PROBES; ++i) {
+		uint c = counter_of(x, i);
+		uint64_t *word = &block[c / 16];
+		uint shift = (c % 16) * 4;
+
+		uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+		while (((old >> shift) & COUNTER_MAX) != COUNTER_MAX &&
+			!__atomic_compare_exchange_n(word, &old,
+				old + ((uint64_t)1 << shift), 1, __ATOMIC_RELAXED,
+				__ATOMIC_RELAXED))
+			;
+	}
+}
+
+// Removes a key (given by its hash) that was added to the filter
+void
+filter_remove(filter_t *filter, uint hash)
+{
+	uint64_t x = mix(hash);
+	uint64_t *block = block_of(filter, x);
+
+	for (uint i = 0; i < FILTER_PROBES; ++i) {
+		uint c = counter_of(x, i);
+		uint64_t *word = &block[c / 16];
+		uint shift = (c % 16) * 4;
+		uint64_t counter = (*word >> shift) & COUNTER_MAX;
+
+		// A saturated counter no longer knows how many keys it counts
+		if (counter && counter != COUNTER_MAX)
+			*word -= (uint64_t)1 << shift;
+	}
+}
+
+// Returns 0 if the key (given by its hash) is certainly not in the filter
+int
+filter_may_contain(filter_t *filter, uint hash)
+{
+	uint64_t x = mix(hash);
+	uint64_t *block = block_of(filter, x);
+
+	for (uint i = 0; i < FILTER_PROBES; ++i) {
+		uint c = counter_of(x, i);
+		if (!((block[c / 16] >> ((c % 16) * 4)) & COUNTER_MAX))
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,47 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stdint.h>
+#include "utils.h"
+#include "mem.h"
+
+// The number of (4-bit) counters in a block, and how many a key sets
+#define FILTER_BLOCK_COUNTERS 128
+#define FILTER_PROBES 4
+// The number of counters per key the filter is sized for
+#define FILTER_COUNTERS_PER_KEY 10
+
+/* A blocked counting Bloom filter, which tells that a key is certainly not
+ * in a table without touching the table's buckets. Every key maps to a
+ * single 64-byte block (one cache line), in which it increments
+ * FILTER_PROBES 4-bit counters, so keys can also be removed. A counter that
+ * reaches 15 sticks there, which can only cause false positives.
+ */
+typedef struct filter_t
+{
+	uint64_t *words;  // the counters, 16 per word, 8 words per block
+	uint num_blocks;
+	mem_class_t mem_class;  // the class that the filter is charged to
+} filter_t;
+
+filter_t *
+filter_create(uint capacity, mem_class_t mem_class);
+
+void
+filter_free(filter_t *filter);
+
+void
+filter_add(filter_t *filter, uint hash);
+
+void
+filter_add_atomic(filter_t *filter, uint hash);
+
+void
+filter_remove(filter_t *filter, uint hash);
+
+int
+filter_may_contain(filter_t *filter, uint hash);
+
+#endif  // FILTER_H_
@@ -6,8 +6,11 @@
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include "ll.h"
 #include "utils.h"
+#include "mem.h"
+#include "filter.h"
 
 // Compare funtion for strings
 int
@@ -37,7 +40,10 @@ hash_function_string(void *a)
 /**
  * @brief Creates a hashtable
  * 
- * @param hmax number of buckets
+ * @param hmax number of buckets (rounded up to a power of two)
+ * @param max_load the load factor above which the table doubles
+ * @param min_load the load factor below which the table halves (it is kept
+ * under max_load / 2, so that a halved table is not immediately doubled back)
  * @param var_key_size signals a key of variable length
  * @param var_val_size signals a value of variable length
  * @param hash_function the hashing function
@@ -47,23 +53,33 @@ hash_function_string(void *a)
  * @return ht_t * 
  */
 ht_t *
-ht_create(uint hmax, uint var_key_size, uint var_val_size,
+ht_create(uint hmax, double max_load, double min_load,
+	uint var_key_size, uint var_val_size,
 	uint (*hash_function)(void*), int (*compare_function)(void*, void*),
 		void (*free_function)(void *))
 {
+	hmax = ht_pow2(hmax);
+
 	// Allocating memory
-	ht_t *ht = (ht_t *)malloc(sizeof(ht_t));
+	ht_t *ht = (ht_t *)mem_malloc(MEM_OTHER, sizeof(ht_t));
 	DIE(!ht, "hashtable malloc failed");
-	ht->buckets = (ll_t **)malloc(hmax * sizeof(ll_t *));
+	ht->buckets = (ll_t *)mem_malloc(MEM_OTHER, hmax * sizeof(ll_t));
 	DIE(!ht->buckets, "hashtable->buckets malloc failed");
 
-	// Creating the buckets
+	// Creating the (empty) buckets
 	for (uint i = 0; i < hmax; ++i)
-		ht->buckets[i] = ll_create(sizeof(info));
+		ll_init(&ht->buckets[i]);
+
+	// Keeps a gap between the two thresholds (hysteresis)
+	if (min_load * 2 > max_load)
+		min_load = max_load / 4;
 
 	// Init
 	ht->size = 0;
 	ht->hmax = hmax;
+	ht->min_hmax = hmax;
+	ht->max_load = max_load;
+	ht->min_load = min_load;
 	ht->var_key_size = var_key_size;
 	ht->var_val_size = var_val_size;
 	ht->hash_function = hash_function;
@@ -83,25 +99,16 @@ ht_create(uint hmax, uint var_key_size, uint var_val_size,
 void
 free_buckets(ht_t *ht, void (*free_function)(void *))
 {
-	ll_node_t *it;
-	for (uint i = 0; i < ht->hmax; ++i)	{
-		if (ht->buckets[i]->head) {
-			it = ht->buckets[i]->head;
-			// Goes through all nodes and frees all memory associated to them
-			while (it) {
-				if (free_function)
-					free_function(((info *)it->data)->value);
-				free(((info *)it->data)->value);
-				free(((info *)it->data)->key);
-				it = it->next;
-			}
-		}
-		// Frees the bucket
-		ll_free(&ht->buckets[i]);
+	// Goes through all entries and frees all memory associated to them
+	ht_cursor_t cursor;
+	for (ht_entry_t *it = ht_begin(ht, &cursor); it; it = ht_next(&cursor)) {
+		if (free_function)
+			free_function(it->value);
+		mem_free(MEM_OTHER, it);
 	}
 
 	// Frees the array of buckets
-	free(ht->buckets);
+	mem_free(MEM_OTHER, ht->buckets);
 }
 
 // Frees a hashtable
@@ -112,36 +119,76 @@ ht_free(ht_t *ht)
 		return;
 
 	free_buckets(ht, ht->free_function);
-	free(ht);
+	mem_free(MEM_OTHER, ht);
+}
+
+// Moves a cursor to the next entry, returning it (or NULL at the end)
+static ht_entry_t *
+cursor_step(ht_cursor_t *cursor)
+{
+	ht_t *ht = cursor->ht;
+	ll_link_t *link = cursor->next;
+
+	// Skips the empty buckets
+	while (!link) {
+		if (cursor->bucket == ht->hmax)
+			return NULL;
+		link = ht->buckets[cursor->bucket++].first;
+	}
+
+	// The next entry is fetched while the caller works on this one
+	cursor->next = link->next;
+	if (cursor->next)
+		PREFETCH(cursor->next);
+
+	return LL_ENTRY(link, ht_entry_t, link);
+}
+
+/**
+ * @brief Starts walking all the entries of a hashtable. The walk may free
+ * the entries it has returned, but must not add or remove any other entry.
+ * 
+ * @param ht the hashtable
+ * @param cursor the cursor of the walk
+ * @return ht_entry_t * the first entry (NULL if the table is empty)
+ */
+ht_entry_t *
+ht_begin(ht_t *ht, ht_cursor_t *cursor)
+{
+	cursor->ht = ht;
+	cursor->bucket = 0;
+	cursor->next = NULL;
+
+	return cursor_step(cursor);
+}
+
+// Returns the next entry of a walk (NULL once it has reached the end)
+ht_entry_t *
+ht_next(ht_cursor_t *cursor)
+{
+	return cursor_step(cursor);
 }
 
 /**
- * @brief Returns a pair of (key, value), as well as its position
- * in the bucket
+ * @brief Returns the entry holding a key. The entry can be unlinked from
+ * its bucket right away, so it is never searched for a second time.
  * 
  * @param bucket the bucket in which to search
  * @param key a pointer to the key with which to search
  * @param compare_function the function that compares the keys
- * @param key_pos_bucket the position of the pair in the bucket
- * @return ll_node_t * 
+ * @return ht_entry_t * 
  */
-ll_node_t *
-find_key(ll_t *bucket, void *key,
-	int (*compare_function)(void *, void *), uint *key_pos_bucket)
+ht_entry_t *
+find_key(ll_t *bucket, void *key, int (*compare_function)(void *, void *))
 {
 	if (!bucket)
 		return NULL;
 
-	ll_node_t *it = bucket->head;
-
-	// Searches for the node containing (key, value) in the given bucket
-	for (uint i = 0; i < bucket->size; ++i) {
-		if (!compare_function(key, ((info *)it->data)->key)) {
-			// Gets the node's position in the bucket
-			*key_pos_bucket = i;
+	// Searches for the entry containing (key, value) in the given bucket
+	for (ll_link_t *link = bucket->first; link; link = link->next) {
+		ht_entry_t *it = LL_ENTRY(link, ht_entry_t, link);
+		if (!compare_function(key, it->key))
 			return it;
-		}
-		it = it->next;
 	}
 
 	return NULL;
@@ -155,14 +202,11 @@ ht_has_key(ht_t *ht, void *key)
 		return -1;
 
 	// Gets the specific bucket in which to search
-	uint index = ht->hash_function(key) % ht->hmax;
-	ll_t *bucket = ht->buckets[index];
-
-	uint key_pos_bucket;
+	uint index = ht->hash_function(key) & (ht->hmax - 1);
+	ll_t *bucket = &ht->buckets[index];
 
 	// Searches for the key in the bucket
-	ll_node_t *it = find_key(bucket, key, ht->compare_function,
-		&key_pos_bucket);
+	ht_entry_t *it = find_key(bucket, key, ht->compare_function);
 
 	// If it finds it, returns 1
 	if (it)
@@ -180,76 +224,107 @@ ht_get(ht_t *ht, void *key)
 		return NULL;
 
 	// Gets the specific bucket in which to search
-	uint index = ht->hash_function(key) % ht->hmax;
-	ll_t *bucket = ht->buckets[index];
-
-	uint key_pos_bucket;
+	uint index = ht->hash_function(key) & (ht->hmax - 1);
+	ll_t *bucket = &ht->buckets[index];
 
-	// Searches for the node containing (key, value) in the given bucket
-	ll_node_t *it = find_key(bucket, key, ht->compare_function,
-		&key_pos_bucket);
+	// Searches for the entry containing (key, value) in the given bucket
+	ht_entry_t *it = find_key(bucket, key, ht->compare_function);
 
 	// If it finds it, it returns a pointer to the value associated to it
 	if (it)
-		return ((info *)it->data)->value;
+		return it->value;
 
 	// Else, returns NULL
 	return NULL;
 }
 
 /**
- * @brief The resize function.
+ * @brief The resize function. The entries are moved into the new array of
+ * buckets as they are, so no key or value is copied. Halving the table
+ * splices every bucket of its upper half into the matching one of its lower
+ * half (a key's bucket is its bucket in the larger table, without the
+ * highest bit), without rehashing any key; any other resize unlinks each
+ * entry once and links it into its new bucket.
  * 
  * @param ht the hashtable that is to be resized
- * @param key_size the size of a key
- * @param value_size the size of a value
- * @param ht_put a pointer to the put function
+ * @param new_hmax the new number of buckets (rounded up to a power of two)
  */
 void
-ht_resize(ht_t *ht, uint key_size, uint value_size,
-	void (*ht_put)(ht_t *, void *, uint, void *, uint,
-		void (*free_function)(void *)))
+ht_resize(ht_t *ht, uint new_hmax)
 {
-	// Creates a new hashtable
-	ht_t *new_ht = ht_create(2 * ht->hmax, key_size, value_size,
-		hash_function_string, compare_function_strings, ht->free_function);
+	if (!ht || !new_hmax)
+		return;
+
+	new_hmax = ht_pow2(new_hmax);
+	if (new_hmax == ht->hmax)
+		return;
 
-	// Puts all the nodes from the original into the new one
+	if (2 * new_hmax == ht->hmax) {
+		for (uint i = 0; i < new_hmax; ++i)
+			ll_splice(&ht->buckets[i], &ht->buckets[new_hmax + i]);
+
+		// Only gives the upper half back
+		ll_t *new_buckets = (ll_t *)mem_realloc(MEM_OTHER, ht->buckets,
+			new_hmax * sizeof(ll_t));
+		DIE(!new_buckets, "new_buckets realloc failed");
+
+		// The first links still point to the buckets they were in
+		for (uint i = 0; i < new_hmax; ++i)
+			if (new_buckets[i].first)
+				new_buckets[i].first->pprev = &new_buckets[i].first;
+
+		ht->buckets = new_buckets;
+		ht->hmax = new_hmax;
+		return;
+	}
+
+	// Creates the new array of buckets
+	ll_t *new_buckets = (ll_t *)mem_malloc(MEM_OTHER,
+		new_hmax * sizeof(ll_t));
+	DIE(!new_buckets, "new_buckets malloc failed");
+	for (uint i = 0; i < new_hmax; ++i)
+		ll_init(&new_buckets[i]);
+
+	// Moves all the entries from the original buckets into the new ones
 	for (uint i = 0; i < ht->hmax; ++i) {
-		ll_t *bucket = ht->buckets[i];
-		ll_node_t *it = bucket->head;
-
-		for (uint j = 0; j < bucket->size; ++j) {
-			/* If a size is -1, it signals that the key/value is variable,
-			 * aka a string (char *)
-			 * As such the actual size is strlen(key/value) + 1
-			 */
-			if (ht->var_key_size) {
-				char *key = (char *)((info *)it->data)->key;
-				key_size = strlen(key) + 1;
-			}
-			if (ht->var_val_size) {
-				char *val = (char *)((info *)it->data)->value;
-				value_size = strlen(val) + 1;
-			}
-			// Puts the pair in the new hashtable
-			ht_put(new_ht, ((info *)it->data)->key, key_size,
-				((info *)it->data)->value, value_size, new_ht->free_function);
-			it = it->next;
+		ll_link_t *link = ht->buckets[i].first;
+
+		while (link) {
+			ll_link_t *next = link->next;
+			ht_entry_t *it = LL_ENTRY(link, ht_entry_t, link);
+			uint index = ht->hash_function(it->key) & (new_hmax - 1);
+
+			// The old bucket is dropped whole, so it is not unlinked from
+			ll_push(&new_buckets[index], link);
+			link = next;
 		}
 	}
 
-	// Frees the original's buckets
-	free_buckets(ht, NULL);
+	// Replaces the original array of buckets
+	mem_free(MEM_OTHER, ht->buckets);
+	ht->buckets = new_buckets;
+	ht->hmax = new_hmax;
+}
 
-	// Adds the newly created array of buckets to the original
-	ht->buckets = new_ht->buckets;
+/**
+ * @brief Makes room for num_entries entries, so that inserting them does not
+ * trigger any other resize. The number of buckets only grows, by doubling,
+ * so a bulk load costs one allocation instead of one per doubling.
+ * 
+ * @param ht the hashtable
+ * @param num_entries the number of entries the table is expected to hold
+ */
+void
+ht_reserve(ht_t *ht, uint num_entries)
+{
+	if (!ht)
+		return;
 
-	// Doubles the number of buckets
-	ht->hmax *= 2;
+	uint new_hmax = ht->hmax;
+	while ((double)num_entries / new_hmax > ht->max_load)
+		new_hmax *= 2;
 
-	// Frees the new hashtable
-	free(new_ht);
+	ht_resize(ht, new_hmax);
 }
 
 /**
@@ -271,44 +346,42 @@ ht_put(ht_t *ht, void *key, uint key_size, void *value, uint value_size,
 		return;
 
 	// Gets the specific bucket in which to search
-	uint index = ht->hash_function(key) % ht->hmax;
-	ll_t *bucket = ht->buckets[index];
+	uint index = ht->hash_function(key) & (ht->hmax - 1);
+	ll_t *bucket = &ht->buckets[index];
 
-	uint key_pos_bucket;
+	// Searches for the entry containing (key, value) in the given bucket
+	ht_entry_t *it = find_key(bucket, key, ht->compare_function);
 
-	// Searches for the node containing (key, value) in the given bucket
-	ll_node_t *it = find_key(bucket, key, ht->compare_function,
-		&key_pos_bucket);
-
-	info information;
-
-	// If the key is not found, add the pair
+	// If the key is not found, add the pair (value first, then key)
 	if (!it) {
-		information.key = malloc(key_size);
-		DIE(!information.key, "information.key malloc failed");
-		memcpy(information.key, key, key_size);
-
-		information.value = malloc(value_size);
-		DIE(!information.value, "information.value malloc failed");
-		memcpy(information.value, value, value_size);
+		it = (ht_entry_t *)mem_malloc(MEM_OTHER,
+			sizeof(ht_entry_t) + value_size + key_size);
+		DIE(!it, "hashtable entry malloc failed");
+		it->value = it + 1;
+		it->key = (char *)it->value + value_size;
+		memcpy(it->value, value, value_size);
+		memcpy(it->key, key, key_size);
 
-		ll_add_nth_node(bucket, 0, &information);
+		ll_push(bucket, &it->link);
 
 	/* If it does, frees the value if necessary (value is a struct etc.),
 	 * then updates the hashtable.
 	 */
 	} else {
 		if (free_function)
-			free_function(((info *)it->data)->value);
-		memcpy(((info *)it->data)->value, value, value_size);
+			free_function(it->value);
+		memcpy(it->value, value, value_size);
+
+		// The number of entries stays the same
+		return;
 	}
 
 	// The hashtable's size ++
 	++(ht->size);
 
-	// If necessary, resizes the hashtable
-	if ((double )ht->size / ht->hmax > LOAD_FACTOR)
-		ht_resize(ht, key_size, value_size, ht_put);
+	// If necessary, grows the hashtable
+	if ((double)ht->size / ht->hmax > ht->max_load)
+		ht_resize(ht, 2 * ht->hmax);
 }
 
 /**
@@ -327,29 +400,140 @@ ht_remove_entry(ht_t *ht, void *key, void (*free_function)(void *))
 		return -1;
 
 	// Gets the specific bucket in which to search
-	uint index = ht->hash_function(key) % ht->hmax;
-	ll_t *bucket = ht->buckets[index];
-
-	uint key_pos_bucket;
+	uint index = ht->hash_function(key) & (ht->hmax - 1);
+	ll_t *bucket = &ht->buckets[index];
 
-	// Searches for the node containing (key, value) in the given bucket
-	ll_node_t *it = find_key(bucket, key, ht->compare_function,
-		&key_pos_bucket);
+	// Searches for the entry containing (key, value) in the given bucket
+	ht_entry_t *it = find_key(bucket, key, ht->compare_function);
 
-	// If the node exists, it removes it and frees all data associated to it
+	/* If the entry exists, it unlinks it (without searching the bucket
+	 * again) and frees all data associated to it
+	 */
 	if (it) {
-		it = ll_remove_nth_node(bucket, key_pos_bucket);
+		ll_unlink(&it->link);
 		if (free_function)
-			free_function(((info *)it->data)->value);
-		free(((info *)it->data)->value);
-		free(((info *)it->data)->key);
-		free(it->data);
-		free(it);
+			free_function(it->value);
+		mem_free(MEM_OTHER, it);
 		// The hashtable's size --
 		--(ht->size);
 
+		// If necessary, shrinks the hashtable (never below its initial size)
+		if (ht->hmax / 2 >= ht->min_hmax &&
+			(double)ht->size / ht->hmax < ht->min_load)
+			ht_resize(ht, ht->hmax / 2);
+
 		return 1;
 	}
 
 	return 0;
 }
+
+// The number of threads that the growth of a large table is split between
+static uint rehash_threads = 1;
+
+// A range of old buckets, whose entries one thread moves into the new array
+typedef struct rehash_range_t
+{
+	ll_t *buckets;
+	uint begin, end;  // the range is [begin, end)
+	ll_t *new_buckets;
+	uint new_hmax;
+	size_t hash_offset;  // where an entry's hash is, from its link
+	filter_t *filter;  // receives the hashes (if not NULL)
+	uint shared;  // whether other threads add to the filter as well
+} rehash_range_t;
+
+// Moves the entries of a range of old buckets into their new buckets
+static void
+rehash_range(rehash_range_t *range)
+{
+	uint mask = range->new_hmax - 1;
+
+	for (uint i = range->begin; i < range->end; ++i) {
+		ll_link_t *link = range->buckets[i].first;
+
+		while (link) {
+			ll_link_t *next = link->next;
+			uint hash = *(uint *)((char *)link + range->hash_offset);
+
+			if (range->filter && range->shared)
+				filter_add_atomic(range->filter, hash);
+			else if (range->filter)
+				filter_add(range->filter, hash);
+
+			// The old bucket is dropped whole, so it is not unlinked from
+			ll_push(&range->new_buckets[hash & mask], link);
+			link = next;
+		}
+	}
+}
+
+static void *
+rehash_thread(void *arg)
+{
+	rehash_range((rehash_range_t *)arg);
+
+	return NULL;
+}
+
+// Sets the number of threads that a large table grows on
+void
+ht_set_rehash_threads(uint num_threads)
+{
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > HT_MAX_REHASH_THREADS)
+		num_threads = HT_MAX_REHASH_THREADS;
+
+	rehash_threads = num_threads;
+}
+
+/**
+ * @brief Moves all the entries of an array of buckets into a new (empty)
+ * array, for the tables that keep the hash of every entry. When a table of
+ * at least HT_PARALLEL_BUCKETS buckets grows, the old buckets are split into
+ * ranges that are moved by separate threads: since both sizes are powers of
+ * two, old bucket i only feeds the new buckets i + k * hmax, so the ranges
+ * never share a new bucket, no lock is needed, and every new bucket ends up
+ * with the same entries, in the same order, as if a single thread had moved
+ * them all.
+ *
+ * @param buckets the old array
+ * @param hmax its number of buckets
+ * @param new_buckets the new array
+ * @param new_hmax its number of buckets
+ * @param hash_offset where an entry's hash is, from its link
+ * @param filter receives the hashes of all the entries (if not NULL)
+ */
+void
+ht_rehash(ll_t *buckets, uint hmax, ll_t *new_buckets, uint new_hmax,
+	size_t hash_offset, filter_t *filter)
+{
+	uint num_threads = rehash_threads;
+	if (new_hmax < hmax || hmax < HT_PARALLEL_BUCKETS)
+		num_threads = 1;
+
+	rehash_range_t ranges[HT_MAX_REHASH_THREADS];
+	uint step = hmax / num_threads;
+	for (uint i = 0; i < num_threads; ++i) {
+		ranges[i].buckets = buckets;
+		ranges[i].begin = i * step;
+		ranges[i].end = i + 1 < num_threads ? (i + 1) * step : hmax;
+		ranges[i].new_buckets = new_buckets;
+		ranges[i].new_hmax = new_hmax;
+		ranges[i].hash_offset = hash_offset;
+		ranges[i].filter = filter;
+		ranges[i].shared = num_threads > 1;
+	}
+
+	// The first range is moved by the calling thread
+	pthread_t threads[HT_MAX_REHASH_THREADS];
+	for (uint i = 1; i < num_threads; ++i)
+		DIE(pthread_create(&threads[i], NULL, rehash_thread, &ranges[i]),
+			"rehash pthread_create failed");
+
+	rehash_range(&ranges[0]);
+
+	for (uint i = 1; i < num_threads; ++i)
+		pthread_join(threads[i], NULL);
+}
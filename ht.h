@@ -3,23 +3,42 @@
 #ifndef HT_H_
 #define HT_H_
 
+#include <stddef.h>
 #include "utils.h"
 #include "ll.h"
 
-typedef struct info
+struct filter_t;
+
+// The most threads that a table's growth is split between
+#define HT_MAX_REHASH_THREADS 64
+// The fewest buckets a table needs for its growth to be split between threads
+#define HT_PARALLEL_BUCKETS (1u << 16)
+
+/* An entry of the hashtable. Its links are part of it (see ll.h), and the
+ * value and the key are stored right after it, in the same allocation.
+ */
+typedef struct ht_entry_t
 {
+	ll_link_t link;  // the link in the entry's bucket
 	void *key;
 	void *value;
-} info;
+} ht_entry_t;
 
 typedef struct ht_t
 {
 	// Array of linked lists
-	ll_t **buckets;
+	ll_t *buckets;
 	// Total number of nodes in all buckets combined
 	uint size;
-	// Number of buckets
+	// Number of buckets (a power of two)
 	uint hmax;
+	// The number of buckets the table was created with (it never shrinks
+	// below it)
+	uint min_hmax;
+	// The table doubles when size / hmax goes above max_load and halves
+	// when it drops below min_load
+	double max_load;
+	double min_load;
 	// Tells if the key and value are variable (as in they are char *,
 	// so they do not have a specific size);
 	uint var_key_size;
@@ -32,6 +51,55 @@ typedef struct ht_t
 	void (*free_function)(void *);
 } ht_t;
 
+/* A walk over all the entries of a table, which may free the entry it has
+ * just returned (it already holds the link of the next one)
+ */
+typedef struct ht_cursor_t
+{
+	ht_t *ht;
+	uint bucket;  // the bucket that comes after the current one
+	ll_link_t *next;  // the link of the next entry in the current bucket
+} ht_cursor_t;
+
+// Rounds n up to a power of two (every table has a power of two buckets)
+static inline uint
+ht_pow2(uint n)
+{
+	uint pow = 1;
+	while (pow < n)
+		pow <<= 1;
+
+	return pow;
+}
+
+// Reverses the bits of a 32-bit value
+static inline uint
+ht_reverse_bits(uint v)
+{
+	v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+	v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+	v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+	v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+
+	return (v >> 16) | (v << 16);
+}
+
+/* Returns the scan cursor that follows the given one in a table whose bucket
+ * mask is mask, or 0 after the last bucket. The cursor is incremented from
+ * its highest bit down (reverse binary), so the buckets that a bucket splits
+ * into when the table doubles, or that merge into it when the table halves,
+ * are never behind the cursor if the bucket is not (see ht_typed.h).
+ */
+static inline uint
+ht_scan_advance(uint cursor, uint mask)
+{
+	cursor |= ~mask;
+	cursor = ht_reverse_bits(cursor);
+	++cursor;
+
+	return ht_reverse_bits(cursor);
+}
+
 int
 compare_function_strings(void *a, void *b);
 
@@ -39,7 +107,8 @@ uint
 hash_function_string(void *a);
 
 ht_t *
-ht_create(uint hmax, uint var_key_size, uint var_val_size,
+ht_create(uint hmax, double max_load, double min_load,
+	uint var_key_size, uint var_val_size,
 	uint (*hash_function)(void*), int (*compare_function)(void*, void*),
 		void (*free_function)(void *));
 
@@ -49,9 +118,8 @@ free_buckets(ht_t *ht, void (*free_function)(void *));
 void
 ht_free(ht_t *ht);
 
-ll_node_t *
-find_key(ll_t *bucket, void *key,
-	int (*compare_function)(void *, void *), uint *key_pos_bucket);
+ht_entry_t *
+find_key(ll_t *bucket, void *key, int (*compare_function)(void *, void *));
 
 int
 ht_has_key(ht_t *ht, void *key);
@@ -60,15 +128,29 @@ void *
 ht_get(ht_t *ht, void *key);
 
 void
-ht_resize(ht_t *ht, uint key_size, uint value_size,
-	void (*ht_put)(ht_t *, void *, uint, void *, uint,
-		void (*free_function)(void *)));
+ht_resize(ht_t *ht, uint new_hmax);
+
+void
+ht_reserve(ht_t *ht, uint num_entries);
 
 void
 ht_put(ht_t *ht, void *key, uint key_size, void *value, uint value_size,
 	void (*free_function)(void *));
 
+ht_entry_t *
+ht_begin(ht_t *ht, ht_cursor_t *cursor);
+
+ht_entry_t *
+ht_next(ht_cursor_t *cursor);
+
 int
 ht_remove_entry(ht_t *ht, void *key, void (*free_function)(void *));
 
+void
+ht_set_rehash_threads(uint num_threads);
+
+void
+ht_rehash(ll_t *buckets, uint hmax, ll_t *new_buckets, uint new_hmax,
+	size_t hash_offset, struct filter_t *filter);
+
 #endif  // HT_H_
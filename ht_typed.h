@@ -0,0 +1,471 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef HT_TYPED_H_
+#define HT_TYPED_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "utils.h"
+#include "ll.h"
+#include "ht.h"
+#include "keycmp.h"
+#include "filter.h"
+#include "mem.h"
+
+/* Type-specialized hashtables that map strings to values of a given type.
+ *
+ * HT_TYPED_DECLARE(name, val_t) declares the name##_t table and its functions
+ * (it goes in a header), while HT_TYPED_DEFINE(name, val_t) generates them
+ * (it goes in exactly one .c file). Compared to ht_t:
+ * - the hashing and the comparison of keys are inlined, not called through
+ *   function pointers;
+ * - every entry is a single allocation holding the value (stored by type)
+ *   and the key, instead of a node, an info struct, a key and a value;
+ * - the hash of each key is kept in its entry, so lookups only compare the
+ *   strings whose hashes match and resizing never rehashes a key.
+ * The load thresholds behave exactly like those of ht_t, and the buckets are
+ * intrusive lists just like its own (see ll.h): name##_remove_value unlinks
+ * the entry of a value that was already looked up in O(1), without searching
+ * its bucket a second time. The number of buckets is always a power of two,
+ * and the tables have two kinds of cursors: name##_begin and name##_next
+ * walk all the entries, like ht_begin and ht_next (freeing them along the
+ * way, if need be), while name##_scan pages through a table that may be
+ * resized between the pages, like Redis' SCAN.
+ *
+ * A table created with a non-zero key_width stores its keys zero-padded to
+ * that width (see keycmp.h), so that they are compared with the vectorized
+ * key_eq instead of strcmp.
+ *
+ * A table created with filtered set keeps a counting Bloom filter of the
+ * hashes of its keys (see filter.h), which turns away most lookups and
+ * removals of missing keys before the bucket array is touched. It is rebuilt
+ * whenever the table grows, and kept as it is when the table halves.
+ *
+ * All the memory of a table is charged to the class it is created with (see
+ * mem.h).
+ */
+
+// Hashing function for strings (the same one as hash_function_string)
+static inline uint
+ht_hash_string(const char *key)
+{
+	// Credits: http://www.cse.yorku.ca/~oz/hash.html
+	const unsigned char *puchar_key = (const unsigned char *)key;
+	uint hash = 5381;
+	uint c;
+
+	while ((c = *puchar_key++))
+		hash = ((hash << 5u) + hash) + c;  // hash * 33 + c
+
+	return hash;
+}
+
+#define HT_TYPED_DECLARE(name, val_t)										\
+typedef struct name##_entry_t												\
+{																			\
+	/* The links in the entry's bucket */									\
+	ll_link_t link;															\
+	/* The (full) hash of the key */										\
+	uint hash;																\
+	val_t value;															\
+	/* The key, stored right after the value */								\
+	char key[];																\
+} name##_entry_t;															\
+																			\
+typedef struct name##_t														\
+{																			\
+	/* Array of buckets (lists of entries) */								\
+	ll_t *buckets;															\
+	/* Total number of entries */											\
+	uint size;																\
+	/* Number of buckets, and the number the table was created with */		\
+	uint hmax;																\
+	uint min_hmax;															\
+	/* Load thresholds for doubling and halving the table */				\
+	double max_load;														\
+	double min_load;														\
+	/* The width of the (zero-padded) keys, or 0 for variable length keys */\
+	uint key_width;															\
+	/* (Pointer to) Function that frees memory owned by a value */			\
+	void (*free_function)(val_t *);											\
+	/* Filter of the hashes in the table (NULL if it has none) */			\
+	filter_t *filter;														\
+	/* The class that the table's memory is charged to */					\
+	mem_class_t mem_class;													\
+} name##_t;																	\
+																			\
+/* The entry that holds a link of a bucket */								\
+static inline name##_entry_t *												\
+name##_entry(ll_link_t *link)												\
+{																			\
+	return LL_ENTRY(link, name##_entry_t, link);							\
+}																			\
+																			\
+/* A walk over all the entries of a table (see ht_cursor_t) */				\
+typedef struct name##_cursor_t												\
+{																			\
+	name##_t *ht;															\
+	uint bucket;															\
+	ll_link_t *next;														\
+} name##_cursor_t;															\
+																			\
+name##_t *																	\
+name##_create(uint hmax, double max_load, double min_load,					\
+	uint key_width, uint filtered, mem_class_t mem_class,					\
+		void (*free_function)(val_t *));									\
+																			\
+void																		\
+name##_free(name##_t *ht);													\
+																			\
+val_t *																		\
+name##_get(name##_t *ht, const char *key);									\
+																			\
+val_t *																		\
+name##_put(name##_t *ht, const char *key, const val_t *value);				\
+																			\
+int																			\
+name##_remove(name##_t *ht, const char *key);								\
+																			\
+void																		\
+name##_remove_value(name##_t *ht, val_t *value);							\
+																			\
+name##_entry_t *															\
+name##_begin(name##_t *ht, name##_cursor_t *cursor);						\
+																			\
+name##_entry_t *															\
+name##_next(name##_cursor_t *cursor);										\
+																			\
+uint																		\
+name##_scan(name##_t *ht, uint cursor, uint count,							\
+	void (*visit)(name##_entry_t *, void *), void *arg);					\
+																			\
+void																		\
+name##_resize(name##_t *ht, uint new_hmax);									\
+																			\
+void																		\
+name##_reserve(name##_t *ht, uint num_entries)
+
+#define HT_TYPED_DEFINE(name, val_t)										\
+/* Creates a table with hmax buckets (rounded up to a power of two) */		\
+name##_t *																	\
+name##_create(uint hmax, double max_load, double min_load,					\
+	uint key_width, uint filtered, mem_class_t mem_class,					\
+		void (*free_function)(val_t *))										\
+{																			\
+	hmax = ht_pow2(hmax);													\
+	name##_t *ht = (name##_t *)mem_malloc_at(mem_class, sizeof(name##_t),	\
+		#name "_create");													\
+	DIE(!ht, #name " malloc failed");										\
+	ht->buckets = (ll_t *)mem_calloc_at(mem_class, hmax, sizeof(ll_t),		\
+		#name "_create (buckets)");											\
+	DIE(!ht->buckets, #name "->buckets calloc failed");						\
+																			\
+	/* Keeps a gap between the two thresholds (hysteresis) */				\
+	if (min_load * 2 > max_load)											\
+		min_load = max_load / 4;											\
+																			\
+	ht->size = 0;															\
+	ht->hmax = hmax;														\
+	ht->min_hmax = hmax;													\
+	ht->max_load = max_load;												\
+	ht->min_load = min_load;												\
+	ht->key_width = key_width > MAX_KEY_WIDTH ? MAX_KEY_WIDTH : key_width;	\
+	ht->free_function = free_function;										\
+	ht->mem_class = mem_class;												\
+	ht->filter = filtered ?													\
+		filter_create(hmax * max_load, mem_class) : NULL;					\
+																			\
+	return ht;																\
+}																			\
+																			\
+/* Moves a cursor to the next entry, fetching the one after it */			\
+static inline name##_entry_t *												\
+name##_step(name##_cursor_t *cursor)										\
+{																			\
+	name##_t *ht = cursor->ht;												\
+	ll_link_t *link = cursor->next;											\
+																			\
+	while (!link) {															\
+		if (cursor->bucket == ht->hmax)										\
+			return NULL;													\
+		link = ht->buckets[cursor->bucket++].first;							\
+	}																		\
+																			\
+	cursor->next = link->next;												\
+	if (cursor->next)														\
+		PREFETCH(cursor->next);												\
+																			\
+	return name##_entry(link);												\
+}																			\
+																			\
+/* Starts a walk over all the entries (NULL if the table is empty) */		\
+name##_entry_t *															\
+name##_begin(name##_t *ht, name##_cursor_t *cursor)							\
+{																			\
+	cursor->ht = ht;														\
+	cursor->bucket = 0;														\
+	cursor->next = NULL;													\
+																			\
+	return name##_step(cursor);												\
+}																			\
+																			\
+/* Returns the next entry of a walk (NULL once it has reached the end) */	\
+name##_entry_t *															\
+name##_next(name##_cursor_t *cursor)										\
+{																			\
+	return name##_step(cursor);												\
+}																			\
+																			\
+/* Visits the entries of a few buckets, until at least count entries were	\
+ * visited, and returns the cursor of the next call. A scan starts with		\
+ * cursor 0 and ends when 0 is returned, and visits every entry that is in	\
+ * the table for its whole duration at least once, even if the table is		\
+ * resized between the calls (halving it may make some entries be visited	\
+ * twice). visit must not add or remove entries.							\
+ */																			\
+uint																		\
+name##_scan(name##_t *ht, uint cursor, uint count,							\
+	void (*visit)(name##_entry_t *, void *), void *arg)						\
+{																			\
+	if (!ht)																\
+		return 0;															\
+																			\
+	uint mask = ht->hmax - 1;												\
+	uint visited = 0;														\
+																			\
+	do {																	\
+		ll_link_t *link = ht->buckets[cursor & mask].first;					\
+		for (; link; link = link->next, ++visited) {						\
+			if (link->next)													\
+				PREFETCH(link->next);										\
+			visit(name##_entry(link), arg);									\
+		}																	\
+																			\
+		cursor = ht_scan_advance(cursor, mask);								\
+	} while (cursor && visited < count);									\
+																			\
+	return cursor;															\
+}																			\
+																			\
+/* Frees a table, along with all of its entries */							\
+void																		\
+name##_free(name##_t *ht)													\
+{																			\
+	if (!ht)																\
+		return;																\
+																			\
+	name##_cursor_t cursor;													\
+	name##_entry_t *it = name##_begin(ht, &cursor);							\
+	for (; it; it = name##_next(&cursor)) {									\
+		if (ht->free_function)												\
+			ht->free_function(&it->value);									\
+		mem_free(ht->mem_class, it);										\
+	}																		\
+																			\
+	filter_free(ht->filter);												\
+	mem_free(ht->mem_class, ht->buckets);									\
+	mem_free(ht->mem_class, ht);											\
+}																			\
+																			\
+/* Pads the key if the table uses fixed-width keys (padded must hold		\
+ * MAX_KEY_WIDTH + 1 bytes), returning the form in which it is stored		\
+ */																			\
+static inline const char *													\
+name##_key(name##_t *ht, const char *key, char *padded)						\
+{																			\
+	if (!ht->key_width)														\
+		return key;															\
+																			\
+	key_pad(padded, key, ht->key_width);									\
+	padded[ht->key_width] = '\0';											\
+	return padded;															\
+}																			\
+																			\
+/* Checks if an entry holds the (stored form of the) key */					\
+static inline int															\
+name##_match(name##_t *ht, name##_entry_t *it, uint hash, const char *key)	\
+{																			\
+	if (it->hash != hash)													\
+		return 0;															\
+	if (ht->key_width)														\
+		return key_eq(it->key, key, ht->key_width);							\
+	return !strcmp(it->key, key);											\
+}																			\
+																			\
+/* Returns a pointer to the value associated with the key (or NULL) */		\
+val_t *																		\
+name##_get(name##_t *ht, const char *key)									\
+{																			\
+	if (!ht)																\
+		return NULL;														\
+																			\
+	char padded[MAX_KEY_WIDTH + 1];											\
+	key = name##_key(ht, key, padded);										\
+	uint hash = ht_hash_string(key);										\
+	if (ht->filter && !filter_may_contain(ht->filter, hash))				\
+		return NULL;														\
+																			\
+	ll_link_t *link = ht->buckets[hash & (ht->hmax - 1)].first;				\
+																			\
+	for (; link; link = link->next)											\
+		if (name##_match(ht, name##_entry(link), hash, key))				\
+			return &name##_entry(link)->value;								\
+																			\
+	return NULL;															\
+}																			\
+																			\
+/* Moves all the entries into a new array of new_hmax buckets. Halving the	\
+ * table splices the buckets of its upper half into those of its lower half	\
+ * and keeps the filter (whose counts stay exact), so no entry is read.		\
+ */																			\
+void																		\
+name##_resize(name##_t *ht, uint new_hmax)									\
+{																			\
+	if (!ht || !new_hmax)													\
+		return;																\
+																			\
+	new_hmax = ht_pow2(new_hmax);											\
+	if (new_hmax == ht->hmax)												\
+		return;																\
+																			\
+	if (2 * new_hmax == ht->hmax) {											\
+		for (uint i = 0; i < new_hmax; ++i)									\
+			ll_splice(&ht->buckets[i], &ht->buckets[new_hmax + i]);			\
+																			\
+		ll_t *new_buckets = (ll_t *)mem_realloc_at(ht->mem_class,			\
+			ht->buckets, new_hmax * sizeof(ll_t),							\
+			#name "_resize (halved)");										\
+		DIE(!new_buckets, #name " new_buckets realloc failed");				\
+		for (uint i = 0; i < new_hmax; ++i)									\
+			if (new_buckets[i].first)										\
+				new_buckets[i].first->pprev = &new_buckets[i].first;		\
+																			\
+		ht->buckets = new_buckets;											\
+		ht->hmax = new_hmax;												\
+		return;																\
+	}																		\
+																			\
+	ll_t *new_buckets = (ll_t *)mem_calloc_at(ht->mem_class, new_hmax,		\
+		sizeof(ll_t), #name "_resize");										\
+	DIE(!new_buckets, #name " new_buckets calloc failed");					\
+																			\
+	/* The filter is sized for the new number of buckets */					\
+	filter_t *new_filter = NULL;											\
+	if (ht->filter)															\
+		new_filter = filter_create(new_hmax * ht->max_load, ht->mem_class);	\
+																			\
+	/* Large tables grow on several threads (see ht_rehash) */				\
+	ht_rehash(ht->buckets, ht->hmax, new_buckets, new_hmax,					\
+		offsetof(name##_entry_t, hash) - offsetof(name##_entry_t, link),	\
+		new_filter);														\
+																			\
+	filter_free(ht->filter);												\
+	ht->filter = new_filter;												\
+	mem_free(ht->mem_class, ht->buckets);									\
+	ht->buckets = new_buckets;												\
+	ht->hmax = new_hmax;													\
+}																			\
+																			\
+/* Makes room for num_entries entries (the table only grows, by doubling) */\
+void																		\
+name##_reserve(name##_t *ht, uint num_entries)								\
+{																			\
+	if (!ht)																\
+		return;																\
+																			\
+	uint new_hmax = ht->hmax;												\
+	while ((double)num_entries / new_hmax > ht->max_load)					\
+		new_hmax *= 2;														\
+																			\
+	name##_resize(ht, new_hmax);											\
+}																			\
+																			\
+/* Puts a copy of the value in the table, replacing (and freeing) the old	\
+ * value if the key already exists. Returns a pointer to the stored value.	\
+ */																			\
+val_t *																		\
+name##_put(name##_t *ht, const char *key, const val_t *value)				\
+{																			\
+	if (!ht)																\
+		return NULL;														\
+																			\
+	char padded[MAX_KEY_WIDTH + 1];											\
+	key = name##_key(ht, key, padded);										\
+	uint hash = ht_hash_string(key);										\
+	ll_t *bucket = &ht->buckets[hash & (ht->hmax - 1)];						\
+	ll_link_t *link = bucket->first;										\
+																			\
+	/* A new key is linked in without scanning its bucket */				\
+	if (ht->filter && !filter_may_contain(ht->filter, hash))				\
+		link = NULL;														\
+																			\
+	for (; link; link = link->next) {										\
+		name##_entry_t *it = name##_entry(link);							\
+		if (name##_match(ht, it, hash, key)) {								\
+			if (ht->free_function)											\
+				ht->free_function(&it->value);								\
+			it->value = *value;												\
+			return &it->value;												\
+		}																	\
+	}																		\
+																			\
+	size_t key_size = (ht->key_width ? ht->key_width : strlen(key)) + 1;	\
+	name##_entry_t *it = (name##_entry_t *)mem_malloc_at(ht->mem_class,		\
+		sizeof(name##_entry_t) + key_size, #name "_put");					\
+	DIE(!it, #name " entry malloc failed");									\
+	it->hash = hash;														\
+	it->value = *value;														\
+	memcpy(it->key, key, key_size);											\
+																			\
+	ll_push(bucket, &it->link);												\
+	++(ht->size);															\
+	if (ht->filter)															\
+		filter_add(ht->filter, hash);										\
+																			\
+	/* The entries are never moved, so the pointer stays valid */			\
+	if ((double)ht->size / ht->hmax > ht->max_load)							\
+		name##_resize(ht, 2 * ht->hmax);									\
+																			\
+	return &it->value;														\
+}																			\
+																			\
+/* Removes the entry of a value that is in the table, in O(1) (value is a	\
+ * pointer returned by name##_get or name##_put)							\
+ */																			\
+void																		\
+name##_remove_value(name##_t *ht, val_t *value)								\
+{																			\
+	name##_entry_t *it = (name##_entry_t *)((char *)value -					\
+		offsetof(name##_entry_t, value));									\
+																			\
+	ll_unlink(&it->link);													\
+	if (ht->filter)															\
+		filter_remove(ht->filter, it->hash);								\
+	if (ht->free_function)													\
+		ht->free_function(&it->value);										\
+	mem_free(ht->mem_class, it);											\
+	--(ht->size);															\
+																			\
+	/* Shrinks the table (never below its initial size) */					\
+	if (ht->hmax / 2 >= ht->min_hmax &&										\
+		(double)ht->size / ht->hmax < ht->min_load)							\
+		name##_resize(ht, ht->hmax / 2);									\
+}																			\
+																			\
+/* Removes an entry, returning 1 if it existed and 0 otherwise */			\
+int																			\
+name##_remove(name##_t *ht, const char *key)								\
+{																			\
+	if (!ht)																\
+		return -1;															\
+																			\
+	val_t *value = name##_get(ht, key);										\
+	if (!value)																\
+		return 0;															\
+																			\
+	name##_remove_value(ht, value);											\
+	return 1;																\
+}
+
+#endif  // HT_TYPED_H_
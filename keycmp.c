@@ -0,0 +1,140 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "keycmp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEYCMP_X86 1
+#include <immintrin.h>
+#endif
+
+// Copies a string into a width-byte key, filling the rest of it with 0s
+void
+key_pad(char *dst, const char *src, uint width)
+{
+	// The string's length (a string that fills the key is not terminated)
+	const char *end = memchr(src, '\0', width);
+	uint len = end ? (uint)(end - src) : width;
+
+	memmove(dst, src, len);
+	memset(dst + len, 0, width - len);
+}
+
+// Compares the bytes from the given position to the end of the keys
+static inline int
+tail_cmp(const char *a, const char *b, uint from, uint width)
+{
+	return memcmp(a + from, b + from, width - from);
+}
+
+// The scalar (fallback) kernels
+static int
+scalar_eq(const char *a, const char *b, uint width)
+{
+	return !memcmp(a, b, width);
+}
+
+static int
+scalar_cmp(const char *a, const char *b, uint width)
+{
+	return memcmp(a, b, width);
+}
+
+#ifdef KEYCMP_X86
+// The SSE2 kernels compare 16 bytes at a time
+__attribute__((target("sse2")))
+static int
+sse2_eq(const char *a, const char *b, uint width)
+{
+	uint i = 0;
+
+	for (; i + 16 <= width; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF)
+			return 0;
+	}
+
+	return !tail_cmp(a, b, i, width);
+}
+
+__attribute__((target("sse2")))
+static int
+sse2_cmp(const char *a, const char *b, uint width)
+{
+	uint i = 0;
+
+	for (; i + 16 <= width; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		// Each set bit marks a byte that differs
+		uint diff = ~(uint)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+		if (diff) {
+			uint pos = i + __builtin_ctz(diff);
+			return (unsigned char)a[pos] - (unsigned char)b[pos];
+		}
+	}
+
+	return tail_cmp(a, b, i, width);
+}
+
+// The AVX2 kernels compare 32 bytes at a time, then fall back to SSE2
+__attribute__((target("avx2")))
+static int
+avx2_eq(const char *a, const char *b, uint width)
+{
+	uint i = 0;
+
+	for (; i + 32 <= width; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		if ((uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb))
+			!= 0xFFFFFFFFu)
+			return 0;
+	}
+
+	return sse2_eq(a + i, b + i, width - i);
+}
+
+__attribute__((target("avx2")))
+static int
+avx2_cmp(const char *a, const char *b, uint width)
+{
+	uint i = 0;
+
+	for (; i + 32 <= width; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		uint diff = ~(uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+		if (diff) {
+			uint pos = i + __builtin_ctz(diff);
+			return (unsigned char)a[pos] - (unsigned char)b[pos];
+		}
+	}
+
+	return sse2_cmp(a + i, b + i, width - i);
+}
+#endif  // KEYCMP_X86
+
+int (*key_eq)(const char *a, const char *b, uint width) = scalar_eq;
+int (*key_cmp)(const char *a, const char *b, uint width) = scalar_cmp;
+
+// Picks the best kernels supported by the CPU
+void
+key_cmp_init(void)
+{
+#ifdef KEYCMP_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		key_eq = avx2_eq;
+		key_cmp = avx2_cmp;
+	} else if (__builtin_cpu_supports("sse2")) {
+		key_eq = sse2_eq;
+		key_cmp = sse2_cmp;
+	}
+#endif
+}
@@ -0,0 +1,30 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef KEYCMP_H_
+#define KEYCMP_H_
+
+#include "utils.h"
+
+/* Comparison of fixed-width keys: strings stored zero-padded to a given
+ * width (such as MAX_BOOK_SIZE or MAX_DEF_NAME_SIZE). Since every byte after
+ * the end of the string is 0, two padded keys are equal iff all their bytes
+ * are, and their byte-wise (unsigned) order is the order given by strcmp.
+ * This lets the comparisons be done a whole vector at a time.
+ */
+
+// The widest key that can be stored zero-padded
+#define MAX_KEY_WIDTH 64
+
+void
+key_pad(char *dst, const char *src, uint width);
+
+// Returns 1 if the two padded keys are equal, 0 otherwise
+extern int (*key_eq)(const char *a, const char *b, uint width);
+
+// Returns a value <0, 0 or >0, just like strcmp, for two padded keys
+extern int (*key_cmp)(const char *a, const char *b, uint width);
+
+void
+key_cmp_init(void);
+
+#endif  // KEYCMP_H_
@@ -3,31 +3,59 @@
 #ifndef LL_H_
 #define LL_H_
 
+#include <stddef.h>
 #include "utils.h"
 
-typedef struct ll_node_t
+/* Intrusive doubly-linked lists. The links live inside the records that are
+ * put in a list, so adding a record allocates nothing, and a record is
+ * unlinked in O(1) from its link alone, without walking the list or even
+ * knowing which list it is in. Every link points to the pointer that points
+ * to it (the list's first pointer or the previous link's next), so a list
+ * is a single pointer: an array of buckets costs one pointer per bucket.
+ */
+typedef struct ll_link_t
 {
-	void* data;
-	struct ll_node_t* next;
-} ll_node_t;
+	struct ll_link_t *next;
+	struct ll_link_t **pprev;  // the pointer that points to this link
+} ll_link_t;
 
 typedef struct ll_t
 {
-	ll_node_t* head;
-	uint data_size;
-	uint size;
+	ll_link_t *first;
 } ll_t;
 
-ll_t *
-ll_create(uint data_size);
+// The record that holds a link (the link is its member called member)
+#define LL_ENTRY(link, type, member)										\
+	((type *)((char *)(link) - offsetof(type, member)))
 
-void
-ll_add_nth_node(ll_t* list, uint n, const void* new_data);
+// Makes a list empty
+static inline void
+ll_init(ll_t *list)
+{
+	list->first = NULL;
+}
 
-ll_node_t *
-ll_remove_nth_node(ll_t* list, uint n);
+// Adds a link at the beginning of a list
+static inline void
+ll_push(ll_t *list, ll_link_t *link)
+{
+	link->next = list->first;
+	if (link->next)
+		link->next->pprev = &link->next;
+	list->first = link;
+	link->pprev = &list->first;
+}
+
+// Takes a link out of the list it is in
+static inline void
+ll_unlink(ll_link_t *link)
+{
+	*link->pprev = link->next;
+	if (link->next)
+		link->next->pprev = link->pprev;
+}
 
 void
-ll_free(ll_t** pp_list);
+ll_splice(ll_t *dst, ll_t *src);
 
 #endif  // LL_H_
@@ -0,0 +1,160 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "loans.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+#include "user.h"
+
+// The heap is 1-based, so that a position of 0 means that there is no loan
+#define HEAP_AT(loans, pos) ((loans)->heap[(pos) - 1])
+
+// Creates an empty heap of loans, with the clock on day 0
+loans_t *
+loans_create(void)
+{
+	loans_t *loans = (loans_t *)mem_calloc(MEM_USERS, 1, sizeof(loans_t));
+	DIE(!loans, "loans calloc failed");
+
+	return loans;
+}
+
+// Frees the heap (the users belong to the users hashtable)
+void
+loans_free(loans_t *loans)
+{
+	if (!loans)
+		return;
+
+	mem_free(MEM_USERS, loans->heap);
+	mem_free(MEM_USERS, loans);
+}
+
+// Puts a user at a position of the heap, keeping their position up to date
+static void
+place(loans_t *loans, uint pos, user_t *user)
+{
+	HEAP_AT(loans, pos) = user;
+	user->loan_pos = pos;
+}
+
+// Moves the user at pos up, while their book is due before their parent's
+static void
+sift_up(loans_t *loans, uint pos)
+{
+	user_t *user = HEAP_AT(loans, pos);
+
+	while (pos > 1 && HEAP_AT(loans, pos / 2)->due > user->due) {
+		place(loans, pos, HEAP_AT(loans, pos / 2));
+		pos /= 2;
+	}
+
+	place(loans, pos, user);
+}
+
+// Moves the user at pos down, while a child's book is due before theirs
+static void
+sift_down(loans_t *loans, uint pos)
+{
+	user_t *user = HEAP_AT(loans, pos);
+
+	while (2 * pos <= loans->size) {
+		uint child = 2 * pos;
+		if (child < loans->size &&
+			HEAP_AT(loans, child + 1)->due < HEAP_AT(loans, child)->due)
+			++child;
+
+		if (HEAP_AT(loans, child)->due >= user->due)
+			break;
+
+		place(loans, pos, HEAP_AT(loans, child));
+		pos = child;
+	}
+
+	place(loans, pos, user);
+}
+
+// Adds the loan of a user (whose due day is already set)
+void
+loans_add(loans_t *loans, user_t *user)
+{
+	if (loans->size == loans->capacity) {
+		loans->capacity = loans->capacity ? 2 * loans->capacity : HMAX;
+		loans->heap = (user_t **)mem_realloc(MEM_USERS, loans->heap,
+			loans->capacity * sizeof(user_t *));
+		DIE(!loans->heap, "loans->heap realloc failed");
+	}
+
+	place(loans, ++(loans->size), user);
+	sift_up(loans, loans->size);
+}
+
+// Removes the loan of a user (if they have one)
+void
+loans_remove(loans_t *loans, user_t *user)
+{
+	uint pos = user->loan_pos;
+	if (!pos)
+		return;
+
+	user->loan_pos = 0;
+	user_t *last = HEAP_AT(loans, loans->size);
+	--(loans->size);
+	if (last == user)
+		return;
+
+	// The last loan takes the place of the removed one
+	place(loans, pos, last);
+	sift_up(loans, pos);
+	sift_down(loans, last->loan_pos);
+}
+
+// Counts the loans due before day in the subtree rooted at pos
+static uint
+count(loans_t *loans, uint pos, uint day)
+{
+	if (pos > loans->size || HEAP_AT(loans, pos)->due >= day)
+		return 0;
+
+	return 1 + count(loans, 2 * pos, day) + count(loans, 2 * pos + 1, day);
+}
+
+// Returns the number of loans that are overdue on a given day, in O(that)
+uint
+loans_count_overdue(loans_t *loans, uint day)
+{
+	return count(loans, 1, day);
+}
+
+// Gathers the loans due before day from the subtree rooted at pos
+static uint
+collect(loans_t *loans, uint pos, uint day, user_t **found, uint cnt)
+{
+	// The whole subtree is due on day or later
+	if (pos > loans->size || HEAP_AT(loans, pos)->due >= day)
+		return cnt;
+
+	found[cnt++] = HEAP_AT(loans, pos);
+	cnt = collect(loans, 2 * pos, day, found, cnt);
+
+	return collect(loans, 2 * pos + 1, day, found, cnt);
+}
+
+/**
+ * @brief Finds the loans that are overdue on a given day (the ones due
+ * before it), in O(number of overdue loans)
+ *
+ * @param loans the loans
+ * @param day the day
+ * @param found receives the users (it must have room for all the overdue
+ * loans, as counted by loans_count_overdue)
+ * @return uint the number of overdue loans
+ */
+uint
+loans_overdue(loans_t *loans, uint day, user_t **found)
+{
+	return collect(loans, 1, day, found, 0);
+}
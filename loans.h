@@ -0,0 +1,42 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef LOANS_H_
+#define LOANS_H_
+
+#include "utils.h"
+
+struct user_t;
+
+/* The active loans, in a min-heap keyed by the day each book is due. Every
+ * user who has a book borrowed is in the heap and knows its position in it,
+ * so a loan is removed in O(log n) when the book is returned or lost, and
+ * the k loans that are overdue on a given day are found in O(k), without
+ * looking at the other users.
+ */
+typedef struct loans_t
+{
+	struct user_t **heap;  // the users who have a book borrowed
+	uint size;
+	uint capacity;
+	uint today;  // the library's clock, in days
+} loans_t;
+
+loans_t *
+loans_create(void);
+
+void
+loans_free(loans_t *loans);
+
+void
+loans_add(loans_t *loans, struct user_t *user);
+
+void
+loans_remove(loans_t *loans, struct user_t *user);
+
+uint
+loans_count_overdue(loans_t *loans, uint day);
+
+uint
+loans_overdue(loans_t *loans, uint day, struct user_t **found);
+
+#endif  // LOANS_H_
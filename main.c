@@ -5,81 +5,208 @@
 #include <string.h>
 #include <errno.h>
 #include "utils.h"
-#include "ll.h"
+#include "keycmp.h"
+#include "command.h"
+#include "pipeline.h"
+#include "shard.h"
+#include "changelog.h"
+#include "server.h"
+#include "snapshot.h"
+#include "batch.h"
+#include "mem.h"
 #include "ht.h"
-#include "book.h"
-#include "user.h"
+#include "tenant.h"
+#include "dict.h"
+
+// Parses a number of bytes, optionally followed by K, M or G
+static int
+parse_size(const char *str, size_t *size)
+{
+	char *end;
+	errno = 0;
+	unsigned long long value = strtoull(str, &end, 10);
+	if (errno || end == str)
+		return 0;
+
+	switch (*end) {
+	case 'G':
+		value *= 1024;
+		// fall through
+	case 'M':
+		value *= 1024;
+		// fall through
+	case 'K':
+		value *= 1024;
+		++end;
+		break;
+	}
+
+	if (*end)
+		return 0;
+
+	*size = value;
+	return 1;
+}
 
 int
-main(void)
+main(int nr_opts, char *opts[])
 {
-	// Creating the hashtables
-	ht_t *library = ht_create(HMAX, 1, 0, hash_function_string,
-		compare_function_strings, free_book);
-	ht_t *users = ht_create(HMAX, 1, 0, hash_function_string,
-		compare_function_strings, NULL);
-	ht_t *banned_users = ht_create(HMAX, 1, 1, hash_function_string,
-		compare_function_strings, NULL);
-
-	// Breaking down a command line into argumentszz
-	char line[LINE_SIZE];
-	while (fgets(line, LINE_SIZE, stdin)) {
-		int len = strlen(line);
-
-		if (line[len - 1] == '\n')
-			line[len - 1] = '\0';
-
-		int argc = 0;
-		char argv[NR_ARGS][MAX_BOOK_SIZE] = {{'\0'}};
-
-		break_down_line(line, &argc, argv, '"');
-
-		// Executing different commands
-		if (!strcmp(argv[0], "ADD_BOOK")) {
-			add_book(library, argv[1], atoi(argv[2]));
-		} else if (!strcmp(argv[0], "GET_BOOK")) {
-			get_book(library, argv[1]);
-		} else if (!strcmp(argv[0], "RMV_BOOK")) {
-			remove_book(library, argv[1]);
-		} else if (!strcmp(argv[0], "ADD_DEF")) {
-			// Creating the def_t struct
-			def_t def;
-			memcpy(def.key, argv[2], MAX_DEF_NAME_SIZE);
-			memcpy(def.val, argv[3], MAX_DEF_NAME_SIZE);
-			add_def(library, argv[1], &def);
-		} else if (!strcmp(argv[0], "GET_DEF")) {
-			get_def(library, argv[1], argv[2]);
-		} else if (!strcmp(argv[0], "RMV_DEF")) {
-			remove_def(library, argv[1], argv[2]);
-		} else if (!strcmp(argv[0], "ADD_USER")) {
-			add_user(users, banned_users, argv[1]);
-		} else if (!strcmp(argv[0], "BORROW")) {
-			borrow(library, users, banned_users, argv[1],
-				argv[2], atoi(argv[3]));
-		} else if (!strcmp(argv[0], "RETURN")) {
-			return_func(library, users, banned_users, argv[1],
-				argv[2], atoi(argv[3]), atoi(argv[4]));
-		} else if (!strcmp(argv[0], "LOST")) {
-			lost(library, users, banned_users, argv[1], argv[2]);
-		} else if (!strcmp(argv[0], "EXIT")) {
-			printf("Books ranking:\n");
-			// Checks if there are any books, then prints them if there are
-			if (library->size) {
-				top_books(library);
+	/* By default, keys have variable length, all the indexes are kept and
+	 * every book has a hashtable of definitions
+	 */
+	db_opts_t db_opts = {0, 0, 1, 1, NULL};
+	// Whether the books keep their definitions packed in a dictionary
+	uint packed_defs = 0;
+	// Whether reading, executing and writing run on separate threads
+	uint pipelined = 0;
+	// The most bytes the tables may take (0 for no limit)
+	size_t mem_budget = 0;
+	// The number of worker processes the tables are split between (0 for none)
+	uint num_shards = 0;
+	// The log the changes are written to, and the log that is followed
+	const char *changelog_path = NULL, *follow_path = NULL;
+	// The address the server mode listens on (NULL for stdin and stdout)
+	const char *listen_addr = NULL;
+	// The number of commands after which an unused tenant is evicted
+	uint tenant_idle = TENANT_IDLE;
+
+	// Parsing the command line options
+	for (int i = 1; i < nr_opts; ++i) {
+		if (!strcmp(opts[i], "--fixed-keys")) {
+			// Keys are stored zero-padded and compared a vector at a time
+			db_opts.book_key_width = MAX_BOOK_SIZE;
+			db_opts.user_key_width = MAX_DEF_NAME_SIZE;
+		} else if (!strcmp(opts[i], "--pipeline")) {
+			pipelined = 1;
+		} else if (!strcmp(opts[i], "--no-name-index")) {
+			db_opts.name_index = 0;
+		} else if (!strcmp(opts[i], "--no-filters")) {
+			db_opts.filtered = 0;
+		} else if (!strcmp(opts[i], "--packed-defs")) {
+			// The definitions are kept as ids in a shared dictionary
+			packed_defs = 1;
+		} else if (!strcmp(opts[i], "--mem-budget") && i + 1 < nr_opts) {
+			if (!parse_size(opts[++i], &mem_budget)) {
+				fprintf(stderr, "Invalid memory budget: %s\n", opts[i]);
+				return 1;
+			}
+		} else if (!strcmp(opts[i], "--shards") && i + 1 < nr_opts) {
+			num_shards = atoi(opts[++i]);
+			if (num_shards < 1 || num_shards > MAX_SHARDS) {
+				fprintf(stderr, "Invalid number of shards: %s\n", opts[i]);
+				return 1;
 			}
-			printf("Users ranking:\n");
-			// Checks if there are any users, then prints them if there are
-			if (users->size) {
-				top_users(users);
+		} else if (!strcmp(opts[i], "--changelog") && i + 1 < nr_opts) {
+			changelog_path = opts[++i];
+		} else if (!strcmp(opts[i], "--follow") && i + 1 < nr_opts) {
+			follow_path = opts[++i];
+		} else if (!strcmp(opts[i], "--listen") && i + 1 < nr_opts) {
+			listen_addr = opts[++i];
+		} else if (!strcmp(opts[i], "--rehash-threads") && i + 1 < nr_opts) {
+			int num_threads = atoi(opts[++i]);
+			if (num_threads < 1 || num_threads > HT_MAX_REHASH_THREADS) {
+				fprintf(stderr, "Invalid number of threads: %s\n", opts[i]);
+				return 1;
 			}
-			// Frees all allocated memory
-			ht_free(library);
-			free_users(users, banned_users);
-			break;
+			ht_set_rehash_threads(num_threads);
+		} else if (!strcmp(opts[i], "--tenant-idle") && i + 1 < nr_opts) {
+			tenant_idle = atoi(opts[++i]);
+		} else if (!strcmp(opts[i], "--profile")) {
+			// Every allocation is counted for its site and its command
+			mem_profile_enable();
 		} else {
-			printf("Invalid command. Please try again.\n");
+			fprintf(stderr, "Unknown option: %s\n", opts[i]);
+			return 1;
 		}
 	}
 
+	// The processes of the sharded mode cannot share a log
+	if (num_shards && (changelog_path || follow_path)) {
+		fprintf(stderr, "--shards cannot be used with a change log\n");
+		return 1;
+	} else if (pipelined && follow_path) {
+		fprintf(stderr, "--pipeline cannot be used with --follow\n");
+		return 1;
+	} else if (listen_addr && (pipelined || num_shards || follow_path)) {
+		fprintf(stderr, "--listen cannot be used with --pipeline, --shards "
+			"or --follow\n");
+		return 1;
+	}
+
+	mem_set_budget(mem_budget);
+
+	// Picking the key comparison kernels supported by the CPU
+	key_cmp_init();
+
+	// A single dictionary is shared by the libraries of all the tenants
+	if (packed_defs)
+		db_opts.dict = dict_create(db_opts.filtered, MEM_DEFS);
+
+	// The workers create their own tables (each one with the whole budget)
+	if (num_shards) {
+		shard_run(&db_opts, num_shards, stdin, stdout);
+		snapshot_wait();
+		dict_free(db_opts.dict);
+		return 0;
+	}
+
+	if (changelog_path && !changelog_open(changelog_path)) {
+		fprintf(stderr, "Cannot open the change log: %s\n", changelog_path);
+		return 1;
+	}
+
+	// Creating the hashtables
+	db_t *db = db_create(&db_opts);
+
+	// The tenants of a log's primary or follower would share the log
+	if (!changelog_path && !follow_path)
+		tenants_init(db, &db_opts, tenant_idle);
+
+	if (follow_path) {
+		if (!follow_run(db, follow_path, stdin, stdout)) {
+			fprintf(stderr, "Cannot follow the change log: %s\n",
+				follow_path);
+			db_free(db);
+			dict_free(db_opts.dict);
+			changelog_close();
+			return 1;
+		}
+	} else if (listen_addr) {
+		if (!server_run(db, listen_addr)) {
+			fprintf(stderr, "Cannot listen on %s\n", listen_addr);
+			tenants_free();
+			db_free(db);
+			dict_free(db_opts.dict);
+			changelog_close();
+			return 1;
+		}
+	} else if (pipelined) {
+		pipeline_run(db, stdin, stdout);
+	} else {
+		batch_t batch;
+		batch_init(&batch);
+
+		// Reading and executing the commands one by one, until EXIT
+		cmd_t cmd;
+		while (read_command(stdin, &cmd)) {
+			int running = submit_command(db, &batch, &cmd);
+			free_command(&cmd);
+			if (!running)
+				break;
+		}
+
+		// A batch that was never committed is not executed
+		batch_discard(&batch);
+	}
+
+	// Lets the snapshots that are still being written finish
+	snapshot_wait();
+
+	// Frees all allocated memory
+	tenants_free();
+	db_free(db);
+	dict_free(db_opts.dict);
+	changelog_close();
+
 	return 0;
 }
@@ -0,0 +1,368 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include "utils.h"
+
+// The header in front of every block that is profiled (padded to keep the
+// block aligned)
+typedef union mem_header_t
+{
+	struct {
+		size_t size;  // the size of the block, header included
+		mem_class_t mem_class;  // the class it is charged to
+		uint16_t site;  // its allocation site, plus 1 (0 if not profiled)
+		uint8_t tag;  // the tag it was allocated under
+	} info;
+	long double align_ld;
+	void *align_ptr;
+} mem_header_t;
+
+// The number of bytes charged to each class, and to all of them
+static size_t mem_class_used[MEM_CLASSES];
+static size_t mem_used_total;
+static size_t mem_used_peak;
+// The most bytes that may be in use (0 for no limit)
+static size_t mem_budget;
+
+// Whether the allocations are profiled (and so whether blocks have headers)
+static int mem_prof_on;
+// The allocation sites seen so far (an open-addressing table of pointers)
+static const char *mem_prof_site_names[MEM_PROF_SITES];
+static mem_prof_t mem_prof_sites[MEM_PROF_SITES];
+static mem_prof_t mem_prof_tags[MEM_PROF_TAGS];
+// The tag of the command that the thread is executing (0 for none)
+static __thread uint mem_prof_tag;
+
+static const char *mem_class_names[MEM_CLASSES] = {
+	"Books", "Definitions", "Users", "Index", "Other"
+};
+
+// Adds (or, for a negative delta, subtracts) bytes to a class
+static void
+mem_charge(mem_class_t mem_class, size_t size, int sign)
+{
+	if (sign > 0) {
+		__atomic_add_fetch(&mem_class_used[mem_class], size, __ATOMIC_RELAXED);
+		size_t total = __atomic_add_fetch(&mem_used_total, size,
+			__ATOMIC_RELAXED);
+
+		// Raises the peak, unless another thread raised it even higher
+		size_t peak = __atomic_load_n(&mem_used_peak, __ATOMIC_RELAXED);
+		while (total > peak &&
+			!__atomic_compare_exchange_n(&mem_used_peak, &peak, total, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+	} else {
+		__atomic_sub_fetch(&mem_class_used[mem_class], size, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&mem_used_total, size, __ATOMIC_RELAXED);
+	}
+}
+
+/* Returns the slot of an allocation site, adding it if it is new (sites
+ * are string literals, so they are told apart by their addresses). When the
+ * table is full, MEM_PROF_SITES is returned and the block is not counted.
+ */
+static uint
+mem_prof_slot(const char *site)
+{
+	uint slot = (uint)(((uintptr_t)site >> 3) % MEM_PROF_SITES);
+
+	for (uint i = 0; i < MEM_PROF_SITES; ++i) {
+		const char *seen = __atomic_load_n(&mem_prof_site_names[slot],
+			__ATOMIC_ACQUIRE);
+		if (seen == site)
+			return slot;
+
+		// Another thread may claim the slot first, for the same site or not
+		if (!seen && __atomic_compare_exchange_n(&mem_prof_site_names[slot],
+				&seen, site, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return slot;
+		if (seen == site)
+			return slot;
+
+		slot = (slot + 1) % MEM_PROF_SITES;
+	}
+
+	return MEM_PROF_SITES;
+}
+
+// Adds an allocation of size bytes to a profile
+static void
+mem_prof_count(mem_prof_t *prof, size_t size)
+{
+	__atomic_add_fetch(&prof->calls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&prof->bytes, size, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&prof->live, 1, __ATOMIC_RELAXED);
+}
+
+// Counts a block for its site and for the current tag (if profiling is on)
+static void
+mem_prof_alloc(mem_header_t *header, size_t size, const char *site)
+{
+	header->info.site = 0;
+	header->info.tag = 0;
+	if (!mem_prof_on)
+		return;
+
+	uint slot = mem_prof_slot(site);
+	if (slot == MEM_PROF_SITES)
+		return;
+
+	header->info.site = slot + 1;
+	mem_prof_count(&mem_prof_sites[slot], size);
+	header->info.tag = mem_prof_tag;
+	mem_prof_count(&mem_prof_tags[mem_prof_tag], size);
+}
+
+// Stops counting a block as live
+static void
+mem_prof_free(mem_header_t *header)
+{
+	if (!header->info.site)
+		return;
+
+	__atomic_sub_fetch(&mem_prof_sites[header->info.site - 1].live, 1,
+		__ATOMIC_RELAXED);
+	__atomic_sub_fetch(&mem_prof_tags[header->info.tag].live, 1,
+		__ATOMIC_RELAXED);
+}
+
+// Allocates a profiled block, with a header in front of it
+static void *
+mem_prof_malloc(mem_class_t mem_class, size_t size, const char *site)
+{
+	mem_header_t *header = (mem_header_t *)malloc(sizeof(mem_header_t) + size);
+	if (!header)
+		return NULL;
+
+	header->info.size = sizeof(mem_header_t) + size;
+	header->info.mem_class = mem_class;
+	mem_charge(mem_class, header->info.size, 1);
+	mem_prof_alloc(header, size, site);
+
+	return header + 1;
+}
+
+// Resizes a profiled block, keeping the class it is charged to
+static void *
+mem_prof_realloc(void *ptr, size_t size, const char *site)
+{
+	mem_header_t *header = (mem_header_t *)ptr - 1;
+	mem_class_t mem_class = header->info.mem_class;
+	size_t old_size = header->info.size;
+
+	header = (mem_header_t *)realloc(header, sizeof(mem_header_t) + size);
+	if (!header)
+		return NULL;
+
+	mem_charge(mem_class, old_size, -1);
+	header->info.size = sizeof(mem_header_t) + size;
+	mem_charge(mem_class, header->info.size, 1);
+	mem_prof_free(header);
+	mem_prof_alloc(header, size, site);
+
+	return header + 1;
+}
+
+// Allocates size bytes charged to a class (NULL if malloc fails)
+void *
+mem_malloc_at(mem_class_t mem_class, size_t size, const char *site)
+{
+	if (mem_prof_on)
+		return mem_prof_malloc(mem_class, size, site);
+
+	void *ptr = malloc(size);
+	if (ptr)
+		mem_charge(mem_class, malloc_usable_size(ptr), 1);
+
+	return ptr;
+}
+
+// Allocates num zeroed elements of size bytes charged to a class
+void *
+mem_calloc_at(mem_class_t mem_class, size_t num, size_t size,
+	const char *site)
+{
+	if (mem_prof_on) {
+		void *ptr = mem_prof_malloc(mem_class, num * size, site);
+		if (ptr)
+			memset(ptr, 0, num * size);
+
+		return ptr;
+	}
+
+	void *ptr = calloc(num, size);
+	if (ptr)
+		mem_charge(mem_class, malloc_usable_size(ptr), 1);
+
+	return ptr;
+}
+
+/**
+ * @brief Resizes a block charged to a class
+ *
+ * @param mem_class the class the block is charged to
+ * @param ptr the block (or NULL for a new one)
+ * @param size its new size
+ * @param site where it is resized (the block is profiled as made there)
+ * @return void * the resized block (NULL if realloc fails, just like realloc)
+ */
+void *
+mem_realloc_at(mem_class_t mem_class, void *ptr, size_t size,
+	const char *site)
+{
+	if (!ptr)
+		return mem_malloc_at(mem_class, size, site);
+	if (mem_prof_on)
+		return mem_prof_realloc(ptr, size, site);
+
+	size_t old_size = malloc_usable_size(ptr);
+	void *new_ptr = realloc(ptr, size);
+	if (!new_ptr)
+		return NULL;
+
+	mem_charge(mem_class, old_size, -1);
+	mem_charge(mem_class, malloc_usable_size(new_ptr), 1);
+
+	return new_ptr;
+}
+
+// Frees a block, uncharging it from its class
+void
+mem_free(mem_class_t mem_class, void *ptr)
+{
+	if (!ptr)
+		return;
+
+	if (mem_prof_on) {
+		mem_header_t *header = (mem_header_t *)ptr - 1;
+		mem_charge(header->info.mem_class, header->info.size, -1);
+		mem_prof_free(header);
+		free(header);
+		return;
+	}
+
+	mem_charge(mem_class, malloc_usable_size(ptr), -1);
+	free(ptr);
+}
+
+// Returns the number of bytes charged to a class
+size_t
+mem_used(mem_class_t mem_class)
+{
+	return __atomic_load_n(&mem_class_used[mem_class], __ATOMIC_RELAXED);
+}
+
+// Returns the number of bytes in use
+size_t
+mem_total(void)
+{
+	return __atomic_load_n(&mem_used_total, __ATOMIC_RELAXED);
+}
+
+// Returns the most bytes that have ever been in use
+size_t
+mem_peak(void)
+{
+	return __atomic_load_n(&mem_used_peak, __ATOMIC_RELAXED);
+}
+
+// Limits the number of bytes in use (0 removes the limit)
+void
+mem_set_budget(size_t budget)
+{
+	mem_budget = budget;
+}
+
+// Returns the most bytes that may be in use (0 if there is no limit)
+size_t
+mem_get_budget(void)
+{
+	return mem_budget;
+}
+
+// Checks if allocating extra more bytes would go over the budget
+int
+mem_over_budget(size_t extra)
+{
+	return mem_budget && mem_total() + extra > mem_budget;
+}
+
+// Returns the name under which a class is reported
+const char *
+mem_class_name(mem_class_t mem_class)
+{
+	return mem_class_names[mem_class];
+}
+
+// Reads a profile that other threads may be updating
+static void
+mem_profile_copy(mem_prof_t *dst, mem_prof_t *src)
+{
+	dst->calls = __atomic_load_n(&src->calls, __ATOMIC_RELAXED);
+	dst->bytes = __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+	dst->live = __atomic_load_n(&src->live, __ATOMIC_RELAXED);
+}
+
+/* Starts profiling the allocations. It must be called before the first
+ * one, since only the blocks allocated while profiling have headers.
+ */
+void
+mem_profile_enable(void)
+{
+	// The blocks allocated so far have no headers
+	if (mem_total())
+		return;
+
+	mem_prof_on = 1;
+}
+
+// Checks if the allocations are profiled
+int
+mem_profiling(void)
+{
+	return mem_prof_on;
+}
+
+// Charges the thread's next allocations to a tag (0 for no command)
+void
+mem_profile_tag(uint tag)
+{
+	mem_prof_tag = tag < MEM_PROF_TAGS ? tag : 0;
+}
+
+/**
+ * @brief Copies the profiles of all the allocation sites seen so far
+ *
+ * @param sites receives the sites (room for MEM_PROF_SITES of them)
+ * @param profs receives their profiles, in the same order
+ * @return uint the number of sites
+ */
+uint
+mem_profile_sites(const char **sites, mem_prof_t *profs)
+{
+	uint cnt = 0;
+	for (uint i = 0; i < MEM_PROF_SITES; ++i) {
+		const char *site = __atomic_load_n(&mem_prof_site_names[i],
+			__ATOMIC_ACQUIRE);
+		if (!site)
+			continue;
+
+		sites[cnt] = site;
+		mem_profile_copy(&profs[cnt++], &mem_prof_sites[i]);
+	}
+
+	return cnt;
+}
+
+// Copies the profile of a tag
+void
+mem_profile_tagged(uint tag, mem_prof_t *prof)
+{
+	mem_profile_copy(prof, &mem_prof_tags[tag]);
+}
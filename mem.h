@@ -0,0 +1,109 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef MEM_H_
+#define MEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "utils.h"
+
+/* Memory accounting. Every allocation made for the tables goes through these
+ * wrappers, which charge it to the class of the table that owns it. A block
+ * is charged the size that malloc actually gave it (malloc_usable_size), so
+ * its owner only has to tell mem_free its class. The counters are updated
+ * atomically, since the reader thread of the pipelined mode allocates
+ * commands as well.
+ */
+typedef enum mem_class_t
+{
+	MEM_BOOKS,  // the books table, the books' names index and statistics
+	MEM_DEFS,  // the books' definitions tables and arenas
+	MEM_USERS,  // the users table
+	MEM_INDEX,  // the inverted index of definitions
+	MEM_OTHER,  // commands, rings and generic hashtables
+	MEM_CLASSES
+} mem_class_t;
+
+/* Allocation profiling. When it is enabled (with --profile), every
+ * allocation is also counted for the site that made it (its file and line,
+ * which the wrappers below pass along) and for the kind of command that was
+ * being executed by the thread at that time (its tag). Only then does each
+ * block start with a small header that remembers both of them (along with
+ * its size and class), so freeing it updates their numbers of live blocks.
+ */
+
+// The most allocation sites and command tags that are told apart
+#define MEM_PROF_SITES 256
+#define MEM_PROF_TAGS 32
+
+// What was allocated by a site, or while executing a kind of command
+typedef struct mem_prof_t
+{
+	uint64_t calls;  // the number of allocations (a realloc is one more)
+	uint64_t bytes;  // the number of bytes asked for by them
+	uint64_t live;  // the number of their blocks that are not freed yet
+} mem_prof_t;
+
+#define MEM_STR_(x) #x
+#define MEM_STR(x) MEM_STR_(x)
+// The site of an allocation, as "file:line"
+#define MEM_SITE __FILE__ ":" MEM_STR(__LINE__)
+
+#define mem_malloc(mem_class, size)										\
+	mem_malloc_at(mem_class, size, MEM_SITE)
+#define mem_calloc(mem_class, num, size)									\
+	mem_calloc_at(mem_class, num, size, MEM_SITE)
+#define mem_realloc(mem_class, ptr, size)									\
+	mem_realloc_at(mem_class, ptr, size, MEM_SITE)
+
+void *
+mem_malloc_at(mem_class_t mem_class, size_t size, const char *site);
+
+void *
+mem_calloc_at(mem_class_t mem_class, size_t num, size_t size,
+	const char *site);
+
+void *
+mem_realloc_at(mem_class_t mem_class, void *ptr, size_t size,
+	const char *site);
+
+void
+mem_free(mem_class_t mem_class, void *ptr);
+
+size_t
+mem_used(mem_class_t mem_class);
+
+size_t
+mem_total(void);
+
+size_t
+mem_peak(void);
+
+void
+mem_set_budget(size_t budget);
+
+size_t
+mem_get_budget(void);
+
+int
+mem_over_budget(size_t extra);
+
+const char *
+mem_class_name(mem_class_t mem_class);
+
+void
+mem_profile_enable(void);
+
+int
+mem_profiling(void);
+
+void
+mem_profile_tag(uint tag);
+
+uint
+mem_profile_sites(const char **sites, mem_prof_t *profs);
+
+void
+mem_profile_tagged(uint tag, mem_prof_t *prof);
+
+#endif  // MEM_H_
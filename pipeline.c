@@ -0,0 +1,130 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "pipeline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "utils.h"
+#include "command.h"
+#include "resp.h"
+#include "batch.h"
+#include "ring.h"
+
+/* The pipelined mode runs each command through three threads:
+ * - the reader reads and breaks down the input into commands, which it
+ *   pushes into the ring of commands;
+ * - the executor (the calling thread) pops them and applies them to the
+ *   tables in order, pushing their responses into the ring of responses;
+ * - the writer pops the responses, formats them and writes them out.
+ * Each ring has a single producer and a single consumer, and both keep the
+ * order of their elements, so the output is exactly the one of the serial
+ * mode.
+ */
+typedef struct pipeline_t
+{
+	ring_t *cmds;  // reader -> executor
+	ring_t *resps;  // executor -> writer
+	FILE *in;
+	FILE *out;
+} pipeline_t;
+
+// Reads commands until the input ends or EXIT is read
+static void *
+reader_thread(void *arg)
+{
+	pipeline_t *pipeline = (pipeline_t *)arg;
+	cmd_t cmd;
+
+	while (read_command(pipeline->in, &cmd)) {
+		ring_push(pipeline->cmds, &cmd);
+		// Nothing after EXIT is executed
+		if (cmd.op == CMD_EXIT)
+			break;
+	}
+
+	ring_close(pipeline->cmds);
+
+	return NULL;
+}
+
+// Formats and writes responses until the executor is done
+static void *
+writer_thread(void *arg)
+{
+	pipeline_t *pipeline = (pipeline_t *)arg;
+	resp_t resp;
+	char buf[2 * LINE_SIZE];
+
+	while (ring_pop(pipeline->resps, &resp)) {
+		int len = resp_format(&resp, buf, sizeof(buf));
+		if (len > (int)sizeof(buf) - 1)
+			len = sizeof(buf) - 1;
+		fwrite(buf, 1, len, pipeline->out);
+	}
+
+	fflush(pipeline->out);
+
+	return NULL;
+}
+
+/* The executor's sink: queues the responses for the writer (a definition
+ * may change before the writer gets to it, so it is copied first)
+ */
+static void
+ring_sink(const resp_t *resp, void *ctx)
+{
+	resp_t owned;
+	ring_push((ring_t *)ctx, resp_detach(resp, &owned));
+}
+
+/**
+ * @brief Executes all the commands from the input in the pipelined mode
+ *
+ * @param db the tables the commands are executed against
+ * @param in the input
+ * @param out the output
+ */
+void
+pipeline_run(db_t *db, FILE *in, FILE *out)
+{
+	pipeline_t pipeline;
+	pipeline.cmds = ring_create(CMD_RING_SIZE, sizeof(cmd_t));
+	pipeline.resps = ring_create(RESP_RING_SIZE, sizeof(resp_t));
+	pipeline.in = in;
+	pipeline.out = out;
+
+	resp_set_sink(ring_sink, pipeline.resps);
+
+	pthread_t reader, writer;
+	DIE(pthread_create(&reader, NULL, reader_thread, &pipeline),
+		"reader pthread_create failed");
+	DIE(pthread_create(&writer, NULL, writer_thread, &pipeline),
+		"writer pthread_create failed");
+
+	batch_t batch;
+	batch_init(&batch);
+
+	// Executes the commands in the order in which they were read
+	cmd_t cmd;
+	while (ring_pop(pipeline.cmds, &cmd)) {
+		int running = submit_command(db, &batch, &cmd);
+		free_command(&cmd);
+		if (!running)
+			break;
+	}
+
+	batch_discard(&batch);
+
+	ring_close(pipeline.resps);
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+
+	resp_set_sink(resp_print, NULL);
+	ring_free(pipeline.cmds);
+	ring_free(pipeline.resps);
+}
@@ -0,0 +1,16 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdio.h>
+#include "command.h"
+
+// The number of slots in the ring of commands and in the ring of responses
+#define CMD_RING_SIZE 1024
+#define RESP_RING_SIZE 4096
+
+void
+pipeline_run(db_t *db, FILE *in, FILE *out);
+
+#endif  // PIPELINE_H_
@@ -0,0 +1,319 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "radix.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+
+// Creates a node whose edge is labeled with len characters of label
+static radix_node_t *
+node_create(const char *label, uint len, void *value)
+{
+	radix_node_t *node = (radix_node_t *)mem_malloc(MEM_BOOKS,
+		sizeof(radix_node_t));
+	DIE(!node, "radix node malloc failed");
+
+	node->label = NULL;
+	if (len) {
+		node->label = (char *)mem_malloc(MEM_BOOKS, len);
+		DIE(!node->label, "radix node->label malloc failed");
+		memcpy(node->label, label, len);
+	}
+	node->len = len;
+	node->value = value;
+	node->children = NULL;
+	node->num_children = 0;
+	node->capacity = 0;
+
+	return node;
+}
+
+// Frees a node along with all the nodes below it
+static void
+node_free(radix_node_t *node)
+{
+	for (uint i = 0; i < node->num_children; ++i)
+		node_free(node->children[i]);
+
+	mem_free(MEM_BOOKS, node->children);
+	mem_free(MEM_BOOKS, node->label);
+	mem_free(MEM_BOOKS, node);
+}
+
+/* Returns the position of the child whose label starts with c, or the
+ * position at which it would be inserted (*found tells which)
+ */
+static uint
+find_child(radix_node_t *node, unsigned char c, int *found)
+{
+	uint left = 0, right = node->num_children;
+
+	// Binary search over the children's first characters
+	while (left < right) {
+		uint mid = (left + right) / 2;
+		unsigned char mid_c = (unsigned char)node->children[mid]->label[0];
+
+		if (mid_c == c) {
+			*found = 1;
+			return mid;
+		}
+		if (mid_c < c)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+
+	*found = 0;
+	return left;
+}
+
+// Inserts a child at the given position
+static void
+add_child(radix_node_t *node, uint pos, radix_node_t *child)
+{
+	if (node->num_children == node->capacity) {
+		node->capacity = node->capacity ? 2 * node->capacity : 2;
+		node->children = (radix_node_t **)mem_realloc(MEM_BOOKS, node->children,
+			node->capacity * sizeof(radix_node_t *));
+		DIE(!node->children, "radix node->children realloc failed");
+	}
+
+	memmove(node->children + pos + 1, node->children + pos,
+		(node->num_children - pos) * sizeof(radix_node_t *));
+	node->children[pos] = child;
+	++(node->num_children);
+}
+
+// Removes the child at the given position (without freeing it)
+static void
+remove_child(radix_node_t *node, uint pos)
+{
+	memmove(node->children + pos, node->children + pos + 1,
+		(node->num_children - pos - 1) * sizeof(radix_node_t *));
+	--(node->num_children);
+}
+
+// Returns the length of the common prefix of a and b (at most len)
+static uint
+common_prefix(const char *a, const char *b, uint len)
+{
+	uint i = 0;
+
+	while (i < len && a[i] == b[i])
+		++i;
+
+	return i;
+}
+
+// Merges a node that holds no value with its only child
+static void
+merge_child(radix_node_t *node)
+{
+	radix_node_t *child = node->children[0];
+
+	// The node's label is followed by the child's
+	char *label = (char *)mem_realloc(MEM_BOOKS, node->label,
+		node->len + child->len);
+	DIE(!label, "radix label realloc failed");
+	memcpy(label + node->len, child->label, child->len);
+	node->label = label;
+	node->len += child->len;
+
+	// The node takes the child's place
+	mem_free(MEM_BOOKS, node->children);
+	node->value = child->value;
+	node->children = child->children;
+	node->num_children = child->num_children;
+	node->capacity = child->capacity;
+
+	mem_free(MEM_BOOKS, child->label);
+	mem_free(MEM_BOOKS, child);
+}
+
+// Creates an empty tree
+radix_t *
+radix_create(void)
+{
+	radix_t *tree = (radix_t *)mem_malloc(MEM_BOOKS, sizeof(radix_t));
+	DIE(!tree, "radix malloc failed");
+
+	tree->root = node_create(NULL, 0, NULL);
+	tree->size = 0;
+
+	return tree;
+}
+
+// Frees a tree (the values are not freed)
+void
+radix_free(radix_t *tree)
+{
+	if (!tree)
+		return;
+
+	node_free(tree->root);
+	mem_free(MEM_BOOKS, tree);
+}
+
+/**
+ * @brief Inserts a key in the tree, replacing its value if it is already
+ * there
+ *
+ * @param tree the tree
+ * @param key the key
+ * @param len the key's length
+ * @param value the value (it must not be NULL)
+ */
+void
+radix_insert(radix_t *tree, const char *key, uint len, void *value)
+{
+	radix_node_t *node = tree->root;
+	uint pos = 0;
+
+	while (pos < len) {
+		int found;
+		uint i = find_child(node, (unsigned char)key[pos], &found);
+
+		// No edge starts with the next character: adds a leaf
+		if (!found) {
+			add_child(node, i, node_create(key + pos, len - pos, value));
+			++(tree->size);
+			return;
+		}
+
+		radix_node_t *child = node->children[i];
+		uint rest = len - pos < child->len ? len - pos : child->len;
+		uint common = common_prefix(child->label, key + pos, rest);
+
+		// The key goes on through the whole edge
+		if (common == child->len) {
+			node = child;
+			pos += common;
+			continue;
+		}
+
+		/* The key leaves the edge midway: the edge is split, the first part
+		 * leading to a new node, to which the child is moved
+		 */
+		radix_node_t *mid = node_create(child->label, common, NULL);
+		memmove(child->label, child->label + common, child->len - common);
+		child->len -= common;
+		add_child(mid, 0, child);
+		node->children[i] = mid;
+
+		node = mid;
+		pos += common;
+	}
+
+	if (!node->value)
+		++(tree->size);
+	node->value = value;
+}
+
+/**
+ * @brief Removes a key from the tree (if it is there), then merges the
+ * nodes that are no longer needed, so the tree stays compressed
+ *
+ * @param tree the tree
+ * @param key the key
+ * @param len the key's length
+ */
+void
+radix_remove(radix_t *tree, const char *key, uint len)
+{
+	radix_node_t *parent = NULL, *node = tree->root;
+	uint pos = 0, child_pos = 0;
+
+	// Finds the node where the key ends
+	while (pos < len) {
+		int found;
+		uint i = find_child(node, (unsigned char)key[pos], &found);
+		if (!found)
+			return;
+
+		radix_node_t *child = node->children[i];
+		if (len - pos < child->len ||
+			common_prefix(child->label, key + pos, child->len) < child->len)
+			return;
+
+		parent = node;
+		child_pos = i;
+		node = child;
+		pos += child->len;
+	}
+
+	if (!node->value)
+		return;
+
+	node->value = NULL;
+	--(tree->size);
+
+	// The root is never merged or removed
+	if (!parent)
+		return;
+
+	if (!node->num_children) {
+		// A leaf that holds no value is removed...
+		remove_child(parent, child_pos);
+		node_free(node);
+
+		// ...which may leave its parent with a single child and no value
+		if (parent != tree->root && !parent->value &&
+			parent->num_children == 1)
+			merge_child(parent);
+	} else if (node->num_children == 1) {
+		merge_child(node);
+	}
+}
+
+// Visits all the values below a node, in order (returns 0 once stopped)
+static int
+walk(radix_node_t *node, radix_visit_t visit, void *ctx)
+{
+	if (node->value && !visit(node->value, ctx))
+		return 0;
+
+	for (uint i = 0; i < node->num_children; ++i)
+		if (!walk(node->children[i], visit, ctx))
+			return 0;
+
+	return 1;
+}
+
+/**
+ * @brief Visits the values of all the keys that start with a prefix, in
+ * lexicographic order of their keys
+ *
+ * @param tree the tree
+ * @param prefix the prefix (an empty one matches all the keys)
+ * @param len the prefix's length
+ * @param visit the function called for every value
+ * @param ctx passed to visit
+ */
+void
+radix_walk_prefix(radix_t *tree, const char *prefix, uint len,
+	radix_visit_t visit, void *ctx)
+{
+	radix_node_t *node = tree->root;
+	uint pos = 0;
+
+	// Finds the highest node whose keys all start with the prefix
+	while (pos < len) {
+		int found;
+		uint i = find_child(node, (unsigned char)prefix[pos], &found);
+		if (!found)
+			return;
+
+		radix_node_t *child = node->children[i];
+		uint rest = len - pos < child->len ? len - pos : child->len;
+		if (common_prefix(child->label, prefix + pos, rest) < rest)
+			return;
+
+		node = child;
+		pos += rest;
+	}
+
+	walk(node, visit, ctx);
+}
@@ -0,0 +1,48 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef RADIX_H_
+#define RADIX_H_
+
+#include "utils.h"
+
+/* A radix tree (compressed trie) that maps strings to values. Every edge
+ * holds a whole run of characters, so a tree with n keys has at most 2n
+ * nodes, and the children of each node are kept sorted by their first
+ * character, so a traversal visits the keys in lexicographic (strcmp) order.
+ */
+typedef struct radix_node_t
+{
+	char *label;  // the characters on the edge that leads to the node
+	uint len;  // the label's length
+	void *value;  // the value of the key that ends here (NULL if none does)
+	struct radix_node_t **children;  // sorted by the first character
+	uint num_children;
+	uint capacity;
+} radix_node_t;
+
+typedef struct radix_t
+{
+	radix_node_t *root;
+	uint size;  // the number of keys
+} radix_t;
+
+// Called for every visited value; returning 0 stops the traversal
+typedef int (*radix_visit_t)(void *value, void *ctx);
+
+radix_t *
+radix_create(void);
+
+void
+radix_free(radix_t *tree);
+
+void
+radix_insert(radix_t *tree, const char *key, uint len, void *value);
+
+void
+radix_remove(radix_t *tree, const char *key, uint len);
+
+void
+radix_walk_prefix(radix_t *tree, const char *prefix, uint len,
+	radix_visit_t visit, void *ctx);
+
+#endif  // RADIX_H_
@@ -0,0 +1,294 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#include "resp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "utils.h"
+
+// The sink that receives the responses (by default, they are printed)
+static resp_sink_t resp_sink = resp_print;
+static void *resp_sink_ctx;
+
+// Changes the sink (ctx is passed to it along with every response)
+void
+resp_set_sink(resp_sink_t sink, void *ctx)
+{
+	resp_sink = sink;
+	resp_sink_ctx = ctx;
+}
+
+// Hands a response to the current sink
+void
+resp_emit(const resp_t *resp)
+{
+	resp_sink(resp, resp_sink_ctx);
+}
+
+/**
+ * @brief Formats a response into a buffer
+ *
+ * @param resp the response
+ * @param buf the buffer
+ * @param size the buffer's size
+ * @return int the length of the formatted line (just like snprintf)
+ */
+int
+resp_format(const resp_t *resp, char *buf, size_t size)
+{
+	switch (resp->type) {
+	case RESP_MSG:
+		return snprintf(buf, size, "%s", resp->msg);
+	case RESP_BOOK:
+		return snprintf(buf, size, "Name:%s Rating:%.3lf Purchases:%d\n",
+			resp->str, resp->real, resp->num[0]);
+	case RESP_BOOK_RANK:
+		return snprintf(buf, size, "%d. Name:%s Rating:%.3lf Purchases:%d\n",
+			resp->num[1], resp->str, resp->real, resp->num[0]);
+	case RESP_USER_RANK:
+		return snprintf(buf, size, "%d. Name:%s Points:%d\n",
+			resp->num[1], resp->str, resp->num[0]);
+	case RESP_DEF:
+		return snprintf(buf, size, "%.*s\n", resp->num[0], resp->msg);
+	case RESP_BANNED:
+		return snprintf(buf, size,
+			"The user %s has been banned from this library.\n", resp->str);
+	case RESP_LIBRARY_STATS:
+		return snprintf(buf, size,
+			"Books:%u Borrowed:%u Purchases:%u Rating:%.3lf\n",
+			(uint)resp->num[0], (uint)resp->num[1], (uint)resp->num[2],
+			resp->real);
+	case RESP_POSTING:
+		return snprintf(buf, size, "%s: %.*s\n", resp->str, resp->num[0],
+			resp->msg);
+	case RESP_LOAN:
+		return snprintf(buf, size, "Name:%s Book:%s Due:%d\n", resp->str,
+			resp->str + RESP_LOAN_BOOK, resp->num[0]);
+	case RESP_TEXT: {
+		// Already formatted, so it is only copied
+		size_t len = (size_t)resp->num[0] < size ? (size_t)resp->num[0]
+			: size - 1;
+		memcpy(buf, resp->msg, len);
+		buf[len] = '\0';
+		return resp->num[0];
+	}
+	case RESP_LINE:
+		return snprintf(buf, size, "%s", resp->str);
+	}
+
+	return 0;
+}
+
+// The default sink: prints the response to a FILE * (stdout if ctx is NULL)
+void
+resp_print(const resp_t *resp, void *ctx)
+{
+	FILE *out = ctx ? (FILE *)ctx : stdout;
+
+	// Constant messages and definitions need no formatting
+	if (resp->type == RESP_MSG) {
+		fputs(resp->msg, out);
+		return;
+	} else if (resp->type == RESP_DEF) {
+		fwrite(resp->msg, 1, resp->num[0], out);
+		fputc('\n', out);
+		return;
+	} else if (resp->type == RESP_TEXT) {
+		fwrite(resp->msg, 1, resp->num[0], out);
+		return;
+	}
+
+	char buf[2 * LINE_SIZE];
+	int len = resp_format(resp, buf, sizeof(buf));
+	if (len > (int)sizeof(buf) - 1)
+		len = sizeof(buf) - 1;
+	fwrite(buf, 1, len, out);
+}
+
+/* Returns a response that does not refer to the tables: either resp itself,
+ * or (for a definition, a posting or a line that is not owned) owned, which
+ * is filled with its formatted line
+ */
+const resp_t *
+resp_detach(const resp_t *resp, resp_t *owned)
+{
+	if (resp->type != RESP_DEF && resp->type != RESP_POSTING &&
+		resp->type != RESP_TEXT)
+		return resp;
+
+	owned->type = RESP_LINE;
+	owned->seq = resp->seq;
+	resp_format(resp, owned->str, LINE_SIZE);
+
+	return owned;
+}
+
+// Copies at most len characters of a string into a response's str
+static void
+resp_copy(char *dst, const char *str, uint len)
+{
+	if (len > LINE_SIZE - 1)
+		len = LINE_SIZE - 1;
+
+	const char *end = memchr(str, '\0', len);
+	if (end)
+		len = end - str;
+
+	memcpy(dst, str, len);
+	dst[len] = '\0';
+}
+
+// Emits a constant message (it must outlive the response)
+void
+resp_msg(const char *msg)
+{
+	resp_t resp;
+	resp.type = RESP_MSG;
+	resp.msg = msg;
+	resp_emit(&resp);
+}
+
+// Emits a book's important information
+void
+resp_book(const char *name, double rating, uint purchases)
+{
+	resp_t resp;
+	resp.type = RESP_BOOK;
+	resp.real = rating;
+	resp.num[0] = purchases;
+	resp_copy(resp.str, name, MAX_BOOK_SIZE);
+	resp_emit(&resp);
+}
+
+/* Formats the line of resp_book into a buffer (returns its length, just
+ * like snprintf), so that it can be emitted again with resp_text
+ */
+int
+resp_book_line(char *buf, size_t size, const char *name, double rating,
+	uint purchases)
+{
+	resp_t resp;
+	resp.type = RESP_BOOK;
+	resp.real = rating;
+	resp.num[0] = purchases;
+	resp_copy(resp.str, name, MAX_BOOK_SIZE);
+
+	return resp_format(&resp, buf, size);
+}
+
+/* Emits an already formatted line (with its '\n'), which is not copied:
+ * just like for resp_def, a sink that keeps the response has to detach it
+ */
+void
+resp_text(const char *text, uint len)
+{
+	resp_t resp;
+	resp.type = RESP_TEXT;
+	resp.msg = text;
+	resp.num[0] = len < LINE_SIZE - 1 ? len : LINE_SIZE - 1;
+	resp_emit(&resp);
+}
+
+// Emits a book's important information, along with its place in the ranking
+void
+resp_book_rank(uint pos, const char *name, double rating, uint purchases)
+{
+	resp_t resp;
+	resp.type = RESP_BOOK_RANK;
+	resp.real = rating;
+	resp.num[0] = purchases;
+	resp.num[1] = pos;
+	resp_copy(resp.str, name, MAX_BOOK_SIZE);
+	resp_emit(&resp);
+}
+
+// Emits a user's score, along with their place in the ranking
+void
+resp_user_rank(uint pos, const char *name, int score)
+{
+	resp_t resp;
+	resp.type = RESP_USER_RANK;
+	resp.num[0] = score;
+	resp.num[1] = pos;
+	resp_copy(resp.str, name, MAX_DEF_NAME_SIZE);
+	resp_emit(&resp);
+}
+
+/* Emits the value of a definition, which is not copied: a sink that keeps
+ * the response after it returns has to detach it first
+ */
+void
+resp_def(const char *val, uint len)
+{
+	resp_t resp;
+	resp.type = RESP_DEF;
+	resp.msg = val;
+	resp.num[0] = len < LINE_SIZE - 1 ? len : LINE_SIZE - 1;
+	resp_emit(&resp);
+}
+
+/* Emits a book that contains a definition, along with the definition's value
+ * (which is not copied, just like for resp_def)
+ */
+void
+resp_posting(const char *book_name, const char *val, uint len, uint64_t seq)
+{
+	resp_t resp;
+	resp.type = RESP_POSTING;
+	resp.msg = val;
+	resp.num[0] = len < LINE_SIZE - 1 ? len : LINE_SIZE - 1;
+	resp.seq = seq;
+	resp_copy(resp.str, book_name, MAX_BOOK_SIZE);
+	resp_emit(&resp);
+}
+
+// Emits a loan that is overdue
+void
+resp_loan(const char *user_name, const char *book_name, uint due)
+{
+	resp_t resp;
+	resp.type = RESP_LOAN;
+	resp.num[0] = due;
+	resp_copy(resp.str, user_name, MAX_DEF_NAME_SIZE);
+	resp_copy(resp.str + RESP_LOAN_BOOK, book_name, MAX_BOOK_SIZE);
+	resp_emit(&resp);
+}
+
+// Emits the message that a user has been banned
+void
+resp_banned(const char *name)
+{
+	resp_t resp;
+	resp.type = RESP_BANNED;
+	resp_copy(resp.str, name, MAX_DEF_NAME_SIZE);
+	resp_emit(&resp);
+}
+
+// Emits the aggregated statistics of a library
+void
+resp_library_stats(uint books, uint borrowed, uint purchases, double rating)
+{
+	resp_t resp;
+	resp.type = RESP_LIBRARY_STATS;
+	resp.num[0] = books;
+	resp.num[1] = borrowed;
+	resp.num[2] = purchases;
+	resp.real = rating;
+	resp_emit(&resp);
+}
+
+// Formats a line right away (for rare responses that have no type of their own)
+void
+resp_line(const char *fmt, ...)
+{
+	resp_t resp;
+	resp.type = RESP_LINE;
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(resp.str, LINE_SIZE, fmt, args);
+	va_end(args);
+
+	resp_emit(&resp);
+}
@@ -0,0 +1,100 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef RESP_H_
+#define RESP_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "utils.h"
+
+/* The responses of the commands. Instead of printing their output, the
+ * commands emit responses: small records that hold the kind of line and the
+ * values in it. They are handed to a sink, which decides where (and when)
+ * they are formatted: the default sink prints them right away, while the
+ * pipelined mode queues them for a writer thread.
+ */
+
+typedef enum resp_type_t
+{
+	RESP_MSG,  // a constant message (msg)
+	RESP_BOOK,  // a book's information (str, real, num[0])
+	RESP_BOOK_RANK,  // a book's place in the ranking (num[1], str, ...)
+	RESP_USER_RANK,  // a user's place in the ranking (num[1], str, num[0])
+	RESP_DEF,  // a definition's value (num[0] bytes of msg, not owned)
+	RESP_BANNED,  // a user has been banned (str)
+	RESP_LIBRARY_STATS,  // aggregated statistics (num[0..2], real)
+	RESP_POSTING,  // a book and a definition's value (str, num[0] of msg)
+	RESP_LOAN,  // an overdue loan (user in str, book after it, num[0])
+	RESP_TEXT,  // a formatted line (num[0] bytes of msg, not owned)
+	RESP_LINE  // an already formatted line (str)
+} resp_type_t;
+
+// Where the book's name starts in the str of a RESP_LOAN
+#define RESP_LOAN_BOOK (MAX_DEF_NAME_SIZE + 1)
+
+typedef struct resp_t
+{
+	resp_type_t type;  // the kind of response
+	const char *msg;  // the message (only for RESP_MSG)
+	int num[3];  // integer values
+	double real;  // a real value
+	char str[LINE_SIZE];  // a name, a definition or a whole line
+	uint64_t seq;  // orders postings gathered from several shards
+} resp_t;
+
+// A function that receives every emitted response
+typedef void (*resp_sink_t)(const resp_t *resp, void *ctx);
+
+const resp_t *
+resp_detach(const resp_t *resp, resp_t *owned);
+
+void
+resp_set_sink(resp_sink_t sink, void *ctx);
+
+void
+resp_emit(const resp_t *resp);
+
+int
+resp_format(const resp_t *resp, char *buf, size_t size);
+
+void
+resp_print(const resp_t *resp, void *ctx);
+
+void
+resp_msg(const char *msg);
+
+void
+resp_book(const char *name, double rating, uint purchases);
+
+int
+resp_book_line(char *buf, size_t size, const char *name, double rating,
+	uint purchases);
+
+void
+resp_text(const char *text, uint len);
+
+void
+resp_book_rank(uint pos, const char *name, double rating, uint purchases);
+
+void
+resp_user_rank(uint pos, const char *name, int score);
+
+void
+resp_def(const char *val, uint len);
+
+void
+resp_posting(const char *book_name, const char *val, uint len, uint64_t seq);
+
+void
+resp_loan(const char *user_name, const char *book_name, uint due);
+
+void
+resp_banned(const char *name);
+
+void
+resp_library_stats(uint books, uint borrowed, uint purchases, double rating);
+
+void
+resp_line(const char *fmt, ...);
+
+#endif  // RESP_H_
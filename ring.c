@@ -0,0 +1,123 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include "utils.h"
+#include "mem.h"
+
+// How many times a waiting side checks the ring before yielding the CPU
+#define RING_SPINS 128
+
+// Waits a bit for the other side of the ring
+static void
+ring_wait(uint *spins)
+{
+	if (++(*spins) < RING_SPINS)
+		return;
+
+	*spins = 0;
+	sched_yield();
+}
+
+// Creates a ring with room for capacity (rounded up to a power of 2) elements
+ring_t *
+ring_create(uint capacity, uint elem_size)
+{
+	ring_t *ring = (ring_t *)mem_malloc(MEM_OTHER, sizeof(ring_t));
+	DIE(!ring, "ring malloc failed");
+
+	ring->capacity = 1;
+	while (ring->capacity < capacity)
+		ring->capacity *= 2;
+
+	ring->slots = (char *)mem_malloc(MEM_OTHER,
+		(size_t)ring->capacity * elem_size);
+	DIE(!ring->slots, "ring->slots malloc failed");
+
+	ring->elem_size = elem_size;
+	ring->head = ring->tail = 0;
+	ring->closed = 0;
+
+	return ring;
+}
+
+// Frees a ring
+void
+ring_free(ring_t *ring)
+{
+	if (!ring)
+		return;
+
+	mem_free(MEM_OTHER, ring->slots);
+	mem_free(MEM_OTHER, ring);
+}
+
+// Copies an element into the ring, waiting while it is full (producer only)
+void
+ring_push(ring_t *ring, const void *elem)
+{
+	uint tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	uint spins = 0;
+
+	while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+		== ring->capacity)
+		ring_wait(&spins);
+
+	memcpy(ring->slots + (size_t)(tail & (ring->capacity - 1))
+		* ring->elem_size, elem, ring->elem_size);
+
+	// Publishes the element
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copies the oldest element out of the ring, waiting while it is
+ * empty (consumer only)
+ *
+ * @param ring the ring
+ * @param elem where the element is copied
+ * @return int 0 if the ring is empty and has been closed, 1 otherwise
+ */
+int
+ring_pop(ring_t *ring, void *elem)
+{
+	uint head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint spins = 0;
+
+	while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+		// Checks tail again, since it might have been pushed before closing
+		if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) &&
+			__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head)
+			return 0;
+		ring_wait(&spins);
+	}
+
+	memcpy(elem, ring->slots + (size_t)(head & (ring->capacity - 1))
+		* ring->elem_size, ring->elem_size);
+
+	// Frees the slot
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+// Returns 1 if there is nothing to pop right now (consumer only)
+int
+ring_empty(ring_t *ring)
+{
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+		== __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+}
+
+// Marks the end of the elements (producer only)
+void
+ring_close(ring_t *ring)
+{
+	__atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,48 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef RING_H_
+#define RING_H_
+
+#include "utils.h"
+
+// The size of a cache line (keeps the two indexes on different lines)
+#define CACHE_LINE 64
+
+/* A lock-free ring buffer with a single producer and a single consumer.
+ * Elements have a fixed size and are copied in and out of the slots. The
+ * producer only writes tail and the consumer only writes head, so the two
+ * sides never share a lock; a full (or empty) ring makes the side that
+ * waits spin for a while, then yield the CPU.
+ */
+typedef struct ring_t
+{
+	char *slots;  // capacity slots of elem_size bytes
+	uint elem_size;  // the size of an element
+	uint capacity;  // the number of slots (a power of 2)
+	char pad0[CACHE_LINE];
+	uint head;  // the number of popped elements (written by the consumer)
+	char pad1[CACHE_LINE];
+	uint tail;  // the number of pushed elements (written by the producer)
+	char pad2[CACHE_LINE];
+	int closed;  // set by the producer after its last push
+} ring_t;
+
+ring_t *
+ring_create(uint capacity, uint elem_size);
+
+void
+ring_free(ring_t *ring);
+
+void
+ring_push(ring_t *ring, const void *elem);
+
+int
+ring_pop(ring_t *ring, void *elem);
+
+int
+ring_empty(ring_t *ring);
+
+void
+ring_close(ring_t *ring);
+
+#endif  // RING_H_
@@ -0,0 +1,470 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "utils.h"
+#include "mem.h"
+#include "command.h"
+#include "batch.h"
+#include "resp.h"
+#include "tenant.h"
+
+/* The server mode. A single thread waits on epoll for any number of TCP or
+ * Unix socket connections that speak the same line protocol as the input.
+ * Every command executes against the same tables, as soon as it has been
+ * received whole, and its responses are appended to its connection's
+ * output. A client may send many commands at once: all the commands that
+ * a read brings in are executed before their responses are written back,
+ * in a single write.
+ */
+
+// A growing buffer of bytes
+typedef struct buf_t
+{
+	char *data;
+	size_t start;  // the first byte not consumed yet
+	size_t size;  // the number of bytes in data
+	size_t capacity;
+} buf_t;
+
+typedef struct conn_t
+{
+	int fd;
+	buf_t in;  // received, but not executed yet
+	buf_t out;  // the responses not written yet
+	cmd_t cmd;  // an ADD_BOOK whose definitions are being received
+	int defs_left;  // the number of definitions cmd is still waiting for
+	batch_t batch;  // the commands sent since BEGIN
+	tenant_t *tenant;  // the tenant its commands run against
+	int eof;  // whether the client has stopped sending
+	int closing;  // whether the client sent EXIT (or went away)
+	uint events;  // the events the connection waits for
+	struct conn_t *prev, *next;  // the other open connections
+} conn_t;
+
+typedef struct server_t
+{
+	db_t *db;
+	int epfd;
+	int listen_fd;
+	conn_t *conns;  // the open connections
+	char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+} server_t;
+
+// Set by SIGINT and SIGTERM
+static volatile sig_atomic_t server_stopped;
+
+static void
+stop_server(int sig)
+{
+	(void)sig;
+	server_stopped = 1;
+}
+
+// Makes room for extra more bytes at the end of a buffer
+static void
+buf_reserve(buf_t *buf, size_t extra)
+{
+	// Drops the consumed bytes first
+	if (buf->start) {
+		memmove(buf->data, buf->data + buf->start, buf->size - buf->start);
+		buf->size -= buf->start;
+		buf->start = 0;
+	}
+
+	if (buf->size + extra <= buf->capacity)
+		return;
+
+	while (buf->size + extra > buf->capacity)
+		buf->capacity = buf->capacity ? 2 * buf->capacity : SERVER_READ_SIZE;
+	buf->data = (char *)mem_realloc(MEM_OTHER, buf->data, buf->capacity);
+	DIE(!buf->data, "buf realloc failed");
+}
+
+// The number of bytes of a buffer not consumed yet
+static size_t
+buf_len(buf_t *buf)
+{
+	return buf->size - buf->start;
+}
+
+// The sink of a connection: formats the responses into its output
+static void
+conn_sink(const resp_t *resp, void *ctx)
+{
+	conn_t *conn = (conn_t *)ctx;
+
+	buf_reserve(&conn->out, 2 * LINE_SIZE);
+	int len = resp_format(resp, conn->out.data + conn->out.size,
+		2 * LINE_SIZE);
+	if (len > 2 * LINE_SIZE - 1)
+		len = 2 * LINE_SIZE - 1;
+	conn->out.size += len;
+}
+
+/* Takes the next line out of a connection's input, cutting it at
+ * LINE_SIZE - 1 characters just like fgets. Returns 0 if there is no whole
+ * line yet.
+ */
+static int
+next_line(conn_t *conn, char line[LINE_SIZE])
+{
+	buf_t *in = &conn->in;
+	size_t avail = buf_len(in);
+	if (!avail)
+		return 0;
+
+	size_t max = avail < LINE_SIZE - 1 ? avail : LINE_SIZE - 1;
+	char *start = in->data + in->start;
+
+	char *end = memchr(start, '\n', max);
+	size_t len, used;
+	if (end) {
+		len = end - start;
+		used = len + 1;
+	} else if (avail >= LINE_SIZE - 1 || (conn->eof && avail)) {
+		// The line is too long, or it is the last one and has no '\n'
+		len = used = max;
+	} else {
+		return 0;
+	}
+
+	memcpy(line, start, len);
+	// Telnet-like clients end their lines with "\r\n"
+	if (len && line[len - 1] == '\r')
+		--len;
+	line[len] = '\0';
+	in->start += used;
+
+	return 1;
+}
+
+// Executes every command that a connection has received whole
+static void
+process(server_t *server, conn_t *conn)
+{
+	char line[LINE_SIZE];
+
+	while (!conn->closing && buf_len(&conn->out) < SERVER_OUT_LIMIT &&
+		next_line(conn, line)) {
+		cmd_t *cmd = &conn->cmd;
+
+		if (conn->defs_left) {
+			if (!parse_def(line, &cmd->defs[cmd->num_defs - conn->defs_left]))
+				cmd->op = CMD_INVALID;
+			--(conn->defs_left);
+		} else {
+			conn->defs_left = parse_command(line, cmd);
+		}
+
+		if (conn->defs_left)
+			continue;
+
+		resp_set_sink(conn_sink, conn);
+		/* A client has no say over the server's files: there is no
+		 * authentication, and the server may listen on every interface
+		 */
+		if (cmd->op == CMD_SNAPSHOT || cmd->op == CMD_BULK_LOAD) {
+			resp_msg("Files cannot be accessed over the network.\n");
+			free_command(cmd);
+			continue;
+		}
+
+		tenant_set_current(conn->tenant);
+		int running = submit_command(server->db, &conn->batch, cmd);
+		conn->tenant = tenant_current();
+		free_command(cmd);
+		if (!running)
+			conn->closing = 1;
+	}
+
+	// A command cut short by the end of the input is dropped
+	if (conn->eof && !buf_len(&conn->in)) {
+		free_command(&conn->cmd);
+		conn->defs_left = 0;
+		conn->closing = 1;
+	}
+}
+
+// Writes as much of a connection's output as the socket takes
+static int
+flush_out(conn_t *conn)
+{
+	buf_t *out = &conn->out;
+
+	while (buf_len(out)) {
+		ssize_t len = write(conn->fd, out->data + out->start, buf_len(out));
+		if (len < 0 && errno == EAGAIN)
+			return 1;
+		if (len <= 0)
+			return 0;
+		out->start += len;
+	}
+
+	out->start = out->size = 0;
+	return 1;
+}
+
+// Frees a connection
+static void
+close_conn(server_t *server, conn_t *conn)
+{
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		server->conns = conn->next;
+	if (conn->next)
+		conn->next->prev = conn->prev;
+
+	epoll_ctl(server->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	free_command(&conn->cmd);
+	batch_discard(&conn->batch);
+	mem_free(MEM_OTHER, conn->in.data);
+	mem_free(MEM_OTHER, conn->out.data);
+	mem_free(MEM_OTHER, conn);
+}
+
+/* Waits for input only while the connection's output is below the limit,
+ * and for the socket to drain only while there is output left
+ */
+static void
+update_events(server_t *server, conn_t *conn)
+{
+	uint events = 0;
+	if (!conn->closing && !conn->eof &&
+		buf_len(&conn->out) < SERVER_OUT_LIMIT)
+		events |= EPOLLIN;
+	if (buf_len(&conn->out))
+		events |= EPOLLOUT;
+
+	if (events == conn->events)
+		return;
+
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = conn;
+	epoll_ctl(server->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+	conn->events = events;
+}
+
+// Accepts all the pending connections
+static void
+accept_conns(server_t *server)
+{
+	while (1) {
+		int fd = accept(server->listen_fd, NULL, NULL);
+		if (fd < 0)
+			return;
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		conn_t *conn = (conn_t *)mem_calloc(MEM_OTHER, 1, sizeof(conn_t));
+		DIE(!conn, "conn calloc failed");
+		conn->fd = fd;
+		conn->events = EPOLLIN;
+		batch_init(&conn->batch);
+		conn->next = server->conns;
+		if (server->conns)
+			server->conns->prev = conn;
+		server->conns = conn;
+
+		struct epoll_event ev;
+		ev.events = conn->events;
+		ev.data.ptr = conn;
+		DIE(epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) < 0,
+			"epoll_ctl failed");
+	}
+}
+
+// Handles the events of a connection
+static void
+handle_conn(server_t *server, conn_t *conn, uint events)
+{
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		buf_reserve(&conn->in, SERVER_READ_SIZE);
+		ssize_t len = read(conn->fd, conn->in.data + conn->in.size,
+			SERVER_READ_SIZE);
+		if (len > 0)
+			conn->in.size += len;
+		else if (!len || errno != EAGAIN)
+			conn->eof = 1;
+	}
+
+	// Executes the commands, then writes all of their responses at once
+	process(server, conn);
+	if (!flush_out(conn)) {
+		close_conn(server, conn);
+		return;
+	}
+
+	// The output drained, so the input held back can be executed
+	if (!conn->closing && buf_len(&conn->in)) {
+		process(server, conn);
+		if (!flush_out(conn)) {
+			close_conn(server, conn);
+			return;
+		}
+	}
+
+	if (conn->closing && !buf_len(&conn->out)) {
+		close_conn(server, conn);
+		return;
+	}
+
+	update_events(server, conn);
+}
+
+/**
+ * @brief Creates the listening socket
+ *
+ * @param server the server
+ * @param addr "unix:PATH" for a Unix socket, "HOST:PORT" or "PORT" for TCP
+ * @return int 1 if the server listens, 0 otherwise
+ */
+static int
+listen_on(server_t *server, const char *addr)
+{
+	int fd;
+
+	if (!strncmp(addr, "unix:", 5)) {
+		struct sockaddr_un sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		if (strlen(addr + 5) >= sizeof(sa.sun_path))
+			return 0;
+		strcpy(sa.sun_path, addr + 5);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return 0;
+		unlink(sa.sun_path);
+		if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+			close(fd);
+			return 0;
+		}
+		strcpy(server->unix_path, sa.sun_path);
+	} else {
+		// Splits the address into a host (any, by default) and a port
+		char host[LINE_SIZE] = "";
+		const char *port = strrchr(addr, ':');
+		if (port) {
+			size_t len = port - addr;
+			if (len >= sizeof(host))
+				return 0;
+			memcpy(host, addr, len);
+			host[len] = '\0';
+			++port;
+		} else {
+			port = addr;
+		}
+
+		struct addrinfo hints, *res;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		if (getaddrinfo(*host ? host : NULL, port, &hints, &res))
+			return 0;
+
+		fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		int one = 1;
+		if (fd >= 0)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (fd >= 0 && bind(fd, res->ai_addr, res->ai_addrlen) < 0) {
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+		if (fd < 0)
+			return 0;
+	}
+
+	if (listen(fd, SOMAXCONN) < 0) {
+		close(fd);
+		return 0;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	server->listen_fd = fd;
+
+	return 1;
+}
+
+/**
+ * @brief Serves the clients that connect to an address, until the process
+ * receives SIGINT or SIGTERM. A client that sends EXIT receives the
+ * rankings, then its connection is closed.
+ *
+ * @param db the tables that all the clients share
+ * @param addr "unix:PATH" for a Unix socket, "HOST:PORT" or "PORT" for TCP
+ * @return int 0 if the server could not listen on addr, 1 otherwise
+ */
+int
+server_run(db_t *db, const char *addr)
+{
+	server_t server;
+	memset(&server, 0, sizeof(server));
+	server.db = db;
+
+	if (!listen_on(&server, addr))
+		return 0;
+
+	server.epfd = epoll_create1(0);
+	DIE(server.epfd < 0, "epoll_create1 failed");
+
+	// The listening socket is the only one without a connection
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	DIE(epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.listen_fd, &ev) < 0,
+		"epoll_ctl failed");
+
+	// A client that goes away shows up as a failed write, not as a signal
+	signal(SIGPIPE, SIG_IGN);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_server;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	struct epoll_event events[SERVER_EVENTS];
+	while (!server_stopped) {
+		int cnt = epoll_wait(server.epfd, events, SERVER_EVENTS, -1);
+		if (cnt < 0) {
+			DIE(errno != EINTR, "epoll_wait failed");
+			continue;
+		}
+
+		for (int i = 0; i < cnt; ++i) {
+			if (!events[i].data.ptr)
+				accept_conns(&server);
+			else
+				handle_conn(&server, (conn_t *)events[i].data.ptr,
+					events[i].events);
+		}
+	}
+
+	while (server.conns)
+		close_conn(&server, server.conns);
+	close(server.epfd);
+	close(server.listen_fd);
+	if (*server.unix_path)
+		unlink(server.unix_path);
+	resp_set_sink(resp_print, NULL);
+
+	return 1;
+}
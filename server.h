@@ -0,0 +1,19 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "utils.h"
+#include "command.h"
+
+// The most connections a single epoll_wait reports
+#define SERVER_EVENTS 64
+// The most bytes read from a connection at once
+#define SERVER_READ_SIZE 65536
+// The most pending output a connection may have before its input is paused
+#define SERVER_OUT_LIMIT (1 << 20)
+
+int
+server_run(db_t *db, const char *addr);
+
+#endif  // SERVER_H_
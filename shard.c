@@ -0,0 +1,1156 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "utils.h"
+#include "command.h"
+#include "book.h"
+#include "user.h"
+#include "resp.h"
+#include "mem.h"
+#include "snapshot.h"
+#include "batch.h"
+#include "bulk.h"
+
+/* The sharded mode splits the library and the users between worker
+ * processes. Every book and every user belongs to the shard that owns its
+ * name on a consistent hash ring, so each worker holds a disjoint part of
+ * the tables. A router (the calling process) reads the commands and sends
+ * them to the workers over Unix sockets:
+ * - a command about a single book or user is forwarded to its shard, without
+ *   waiting for the reply; the replies are read back in the order in which
+ *   the commands were forwarded, so the output keeps the order of the input;
+ * - BORROW, RETURN and LOST are split into steps, run one after the other
+ *   on the user's shard and on the book's shard;
+ * - LIBRARY_STATS, MEMORY, FIND_DEF, LIST_BOOKS and EXIT are sent to every
+ *   shard, and the router merges what they send back.
+ * Responses travel as resp_t records (a worker forked from the router has
+ * the same constant messages at the same addresses), and the output is the
+ * same as the one of the serial mode.
+ */
+
+// What a worker does with a request
+typedef enum shard_op_t
+{
+	SHARD_EXEC,  // executes the command as it is
+	SHARD_CAN_BORROW,  // BORROW, on the user's shard: checks the user
+	SHARD_LEND_BOOK,  // BORROW, on the book's shard: marks the book
+	SHARD_LEND_TO,  // BORROW, on the user's shard: marks the user
+	SHARD_GIVE_BACK,  // RETURN, on the user's shard
+	SHARD_TAKE_BACK,  // RETURN, on the book's shard
+	SHARD_REPORT_LOST,  // LOST, on the user's shard
+	SHARD_STATS,  // sends back the sums of the books' statistics
+	SHARD_MEMORY,  // sends back the memory counters
+	SHARD_FIND_DEF,  // sends back the postings of a definition key
+	SHARD_LIST_BOOKS,  // sends back the books that start with a prefix
+	SHARD_ADVANCE,  // moves the clock forward, sending back the bans
+	SHARD_RECLAIM,  // ADVANCE, on the book's shard of a banned user
+	SHARD_OVERDUE,  // sends back the overdue loans
+	SHARD_RANKINGS,  // sends back the rankings of the shard's books and users
+	SHARD_EXISTS,  // COMMIT, on the shard of a book or a user of the batch
+	SHARD_FITS,  // COMMIT, checks what the batch adds against the budget
+	SHARD_EXEC_BATCH  // executes a command of a batch, without the budget
+} shard_op_t;
+
+// A request, followed on the socket by the command's definitions
+typedef struct shard_req_t
+{
+	shard_op_t op;
+	uint64_t seq;  // the command's number in the input
+	cmd_t cmd;
+} shard_req_t;
+
+// The number of values a reply carries
+#define SHARD_VALS (2 + MEM_CLASSES)
+
+// A frame of a reply: a response, or the end of the reply
+typedef struct shard_frame_t
+{
+	int last;  // whether the frame ends the reply
+	int status;  // the result of the request (only in the last frame)
+	uint64_t vals[SHARD_VALS];  // values sent back (only in the last frame)
+	resp_t resp;  // a response (unless it is the last frame)
+} shard_frame_t;
+
+// A worker, as seen by the router
+typedef struct shard_t
+{
+	pid_t pid;
+	FILE *to;  // the requests
+	FILE *from;  // the replies
+} shard_t;
+
+// A point on the hash ring
+typedef struct ring_point_t
+{
+	uint hash;
+	uint shard;
+} ring_point_t;
+
+// A growing vector of responses gathered from the shards
+typedef struct resp_vec_t
+{
+	resp_t *resps;
+	uint size;
+	uint capacity;
+} resp_vec_t;
+
+typedef struct router_t
+{
+	shard_t shards[MAX_SHARDS];
+	uint num_shards;
+	ring_point_t ring[MAX_SHARDS * SHARD_VNODES];  // sorted by hash
+	uint ring_size;
+	uint pending[SHARD_WINDOW];  // the shards of the forwarded commands
+	uint pending_head;  // the oldest forwarded command
+	uint num_pending;
+	uint64_t seq;  // the number of commands read so far
+	shard_op_t exec_op;  // how the commands about a book or user are sent
+} router_t;
+
+// Scrambles the bits of a hash (the murmur3 finalizer)
+static uint
+mix32(uint hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+// Hashes a name (a book's or a user's) onto the ring
+static uint
+hash_name(const char *name)
+{
+	uint hash = 5381;
+
+	for (uint i = 0; i < MAX_BOOK_SIZE && name[i]; ++i)
+		hash = ((hash << 5u) + hash) + (unsigned char)name[i];
+
+	return mix32(hash);
+}
+
+// Compares two points of the ring by their hashes
+static int
+compare_points(const void *a, const void *b)
+{
+	uint hash1 = ((const ring_point_t *)a)->hash;
+	uint hash2 = ((const ring_point_t *)b)->hash;
+
+	return hash1 < hash2 ? -1 : hash1 > hash2;
+}
+
+/* Puts SHARD_VNODES points of every shard on the ring, so that adding a
+ * shard only moves the names of the arcs its points take over
+ */
+static void
+build_ring(router_t *router)
+{
+	router->ring_size = 0;
+	for (uint i = 0; i < router->num_shards; ++i)
+		for (uint j = 0; j < SHARD_VNODES; ++j) {
+			ring_point_t *point = &router->ring[router->ring_size++];
+			point->hash = mix32(i * SHARD_VNODES + j + 1);
+			point->shard = i;
+		}
+
+	qsort(router->ring, router->ring_size, sizeof(ring_point_t),
+		compare_points);
+}
+
+// Returns the shard that owns a name: the one of the first point after it
+static uint
+shard_of(router_t *router, const char *name)
+{
+	uint hash = hash_name(name);
+	uint lo = 0, hi = router->ring_size;
+
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+		if (router->ring[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return router->ring[lo % router->ring_size].shard;
+}
+
+// Writes a whole record to a socket
+static void
+send_record(FILE *out, const void *record, size_t size)
+{
+	DIE(fwrite(record, size, 1, out) != 1, "shard fwrite failed");
+}
+
+// Reads a whole record from a socket (returns 0 if the peer is done)
+static int
+recv_record(FILE *in, void *record, size_t size)
+{
+	return fread(record, size, 1, in) == 1;
+}
+
+// Adds a response to a vector
+static void
+resp_vec_push(resp_vec_t *vec, const resp_t *resp)
+{
+	if (vec->size == vec->capacity) {
+		vec->capacity = vec->capacity ? 2 * vec->capacity : HMAX;
+		vec->resps = (resp_t *)mem_realloc(MEM_OTHER, vec->resps,
+			vec->capacity * sizeof(resp_t));
+		DIE(!vec->resps, "resp_vec realloc failed");
+	}
+
+	vec->resps[vec->size++] = *resp;
+}
+
+// The worker's sink: sends every response to the router
+static void
+frame_sink(const resp_t *resp, void *ctx)
+{
+	shard_frame_t frame;
+	resp_t owned;
+
+	frame.last = 0;
+	frame.status = 0;
+	frame.resp = *resp_detach(resp, &owned);
+	send_record((FILE *)ctx, &frame, sizeof(frame));
+}
+
+/* Sends the loan of a user that ADVANCE banned back to the router, which
+ * has the book's shard take it back
+ */
+static void
+send_reclaim(user_t *user, void *ctx)
+{
+	(void)ctx;
+	resp_loan(user->name, user->book_name, user->due);
+}
+
+/* Sends back a user of a batch (NULL if they are not registered): their
+ * score and the rest of their record, with their book's name as a loan
+ */
+static void
+send_user_state(user_t *user, shard_frame_t *end)
+{
+	if (!user)
+		return;
+
+	end->status = 1;
+	end->vals[0] = (uint64_t)(int64_t)user->score;
+	end->vals[1] = user->banned;
+	end->vals[2] = user->days_max;
+	end->vals[3] = user->charged;
+	if (strcmp(user->book_name, INIT_STR))
+		resp_loan(user->name, user->book_name, user->due);
+}
+
+// Sends back whether a book of a batch (or NULL) exists and is borrowed
+static void
+send_book_state(library_t *library, book_t *book, shard_frame_t *end)
+{
+	if (!book)
+		return;
+
+	end->status = 1;
+	end->vals[0] = library->stats.status[book->id];
+}
+
+// Executes a request on a worker's tables
+static void
+serve(db_t *db, shard_req_t *req, shard_frame_t *end)
+{
+	library_t *library = db->library;
+	char (*argv)[MAX_BOOK_SIZE] = req->cmd.argv;
+	uint days, limit;
+
+	// The postings are numbered by the command that added them
+	library->def_clock = req->seq << 32;
+	// The steps of a command are profiled as the command itself
+	mem_profile_tag(req->cmd.op + 1);
+
+	switch (req->op) {
+	case SHARD_EXEC:
+		execute_command(db, &req->cmd);
+		break;
+	case SHARD_CAN_BORROW:
+		end->status = can_borrow(user_ht_get(db->users, argv[1]));
+		break;
+	case SHARD_LEND_BOOK:
+		end->status = lend_book(library,
+			book_ht_get(library->books, argv[2]));
+		break;
+	case SHARD_LEND_TO:
+		lend_to(db->loans, user_ht_get(db->users, argv[1]), argv[2],
+			atoi(argv[3]));
+		break;
+	case SHARD_GIVE_BACK:
+		end->status = give_back(db->loans, user_ht_get(db->users, argv[1]),
+			argv[2], atoi(argv[3]));
+		break;
+	case SHARD_TAKE_BACK:
+		take_back(library, book_ht_get(library->books, argv[2]),
+			atoi(argv[4]));
+		break;
+	case SHARD_REPORT_LOST:
+		end->status = report_lost(db->loans,
+			user_ht_get(db->users, argv[1]));
+		break;
+	case SHARD_STATS:
+		end->vals[0] = library->stats.size;
+		end->vals[1] = book_stats_borrowed(&library->stats);
+		end->vals[2] = book_stats_purchases(&library->stats);
+		end->vals[3] = book_stats_ratings(&library->stats);
+		end->vals[4] = library->line_hits;
+		end->vals[5] = library->line_misses;
+		break;
+	case SHARD_MEMORY:
+		end->vals[0] = mem_total();
+		end->vals[1] = mem_peak();
+		for (uint i = 0; i < MEM_CLASSES; ++i)
+			end->vals[2 + i] = mem_used(i);
+		break;
+	case SHARD_FIND_DEF:
+		print_postings(library, argv[1]);
+		break;
+	case SHARD_LIST_BOOKS:
+		print_prefixed(library, argv[1], atoi(argv[2]));
+		break;
+	case SHARD_ADVANCE:
+		// The clock is left as it is if the days are not a number
+		end->vals[1] = parse_clock_args(&req->cmd, &days, &limit) ?
+			advance_clock(db->loans, days, send_reclaim, NULL) : 0;
+		end->vals[0] = db->loans->today;
+		break;
+	case SHARD_RECLAIM:
+		reclaim_book(library, argv[1]);
+		break;
+	case SHARD_OVERDUE:
+		if (parse_clock_args(&req->cmd, &days, &limit))
+			print_overdue(db->loans, days, limit);
+		break;
+	case SHARD_EXISTS:
+		/* The command is a GET_BOOK for a book, an ADD_USER for a user or a
+		 * GET_DEF for a definition
+		 */
+		if (req->cmd.op == CMD_ADD_USER)
+			send_user_state(user_ht_get(db->users, argv[1]), end);
+		else if (req->cmd.op == CMD_GET_DEF)
+			end->status = has_def(library,
+				book_ht_get(library->books, argv[1]), argv[2]);
+		else
+			send_book_state(library, book_ht_get(library->books, argv[1]),
+				end);
+		break;
+	case SHARD_FITS:
+		end->status = !mem_over_budget(adds_cost(library, atoi(argv[1]),
+			atoi(argv[2])));
+		break;
+	case SHARD_EXEC_BATCH: {
+		// The batch was checked against the budget as a whole
+		size_t budget = mem_get_budget();
+		mem_set_budget(0);
+		execute_command(db, &req->cmd);
+		mem_set_budget(budget);
+		break;
+	}
+	case SHARD_RANKINGS:
+		if (library->books->size)
+			top_books(library);
+		if (db->users->size)
+			top_users(db->users);
+		break;
+	}
+
+	mem_profile_tag(0);
+}
+
+// A worker's loop: serves requests until the router closes its socket
+static void
+worker_run(const db_opts_t *opts, int fd)
+{
+	FILE *from = fdopen(fd, "r");
+	FILE *to = fdopen(dup(fd), "w");
+	DIE(!from || !to, "worker fdopen failed");
+
+	db_t *db = db_create(opts);
+	resp_set_sink(frame_sink, to);
+
+	shard_req_t req;
+	while (recv_record(from, &req, sizeof(req))) {
+		cmd_t *cmd = &req.cmd;
+
+		// Reads the definitions that follow an ADD_BOOK
+		cmd->defs = NULL;
+		if (cmd->num_defs > 0) {
+			cmd->defs = (def_arg_t *)mem_malloc(MEM_OTHER,
+				cmd->num_defs * sizeof(def_arg_t));
+			DIE(!cmd->defs, "cmd->defs malloc failed");
+			DIE(!recv_record(from, cmd->defs,
+				cmd->num_defs * sizeof(def_arg_t)), "shard fread failed");
+		}
+
+		shard_frame_t end;
+		memset(&end, 0, sizeof(end));
+		end.last = 1;
+		serve(db, &req, &end);
+		free_command(cmd);
+
+		send_record(to, &end, sizeof(end));
+		fflush(to);
+	}
+
+	db_free(db);
+	fclose(from);
+	fclose(to);
+	_exit(0);
+}
+
+// Sends a request (along with the command's definitions) to a shard
+static void
+send_request(router_t *router, uint shard, shard_op_t op, cmd_t *cmd)
+{
+	shard_req_t req;
+	req.op = op;
+	req.seq = router->seq;
+	req.cmd = *cmd;
+
+	FILE *to = router->shards[shard].to;
+	send_record(to, &req, sizeof(req));
+	if (cmd->num_defs > 0)
+		send_record(to, cmd->defs, cmd->num_defs * sizeof(def_arg_t));
+}
+
+/**
+ * @brief Reads a shard's next reply
+ *
+ * @param router the router
+ * @param shard the shard
+ * @param gathered collects the responses (if NULL, they are emitted)
+ * @param vals receives the values sent back (if not NULL)
+ * @return int the request's status
+ */
+static int
+read_reply(router_t *router, uint shard, resp_vec_t *gathered,
+	uint64_t *vals)
+{
+	FILE *from = router->shards[shard].from;
+	shard_frame_t frame;
+
+	while (1) {
+		DIE(!recv_record(from, &frame, sizeof(frame)), "shard fread failed");
+		if (frame.last)
+			break;
+
+		if (gathered)
+			resp_vec_push(gathered, &frame.resp);
+		else
+			resp_emit(&frame.resp);
+	}
+
+	if (vals)
+		memcpy(vals, frame.vals, sizeof(frame.vals));
+
+	return frame.status;
+}
+
+// Reads the replies to all the forwarded commands, oldest first
+static void
+drain(router_t *router)
+{
+	// The shards only see the requests that left the buffers
+	for (uint i = 0; i < router->num_shards; ++i)
+		fflush(router->shards[i].to);
+
+	while (router->num_pending) {
+		uint shard = router->pending[router->pending_head];
+		router->pending_head = (router->pending_head + 1) % SHARD_WINDOW;
+		--(router->num_pending);
+		read_reply(router, shard, NULL, NULL);
+	}
+}
+
+// Sends a request to a shard, without waiting for its reply
+static void
+forward(router_t *router, uint shard, shard_op_t op, cmd_t *cmd)
+{
+	if (router->num_pending == SHARD_WINDOW)
+		drain(router);
+
+	send_request(router, shard, op, cmd);
+
+	uint tail = (router->pending_head + router->num_pending) % SHARD_WINDOW;
+	router->pending[tail] = shard;
+	++(router->num_pending);
+}
+
+// Sends a request to a shard and waits for its reply, returning its status
+static int
+call(router_t *router, uint shard, shard_op_t op, cmd_t *cmd)
+{
+	send_request(router, shard, op, cmd);
+	drain(router);
+
+	return read_reply(router, shard, NULL, NULL);
+}
+
+// Sends a request to every shard and gathers their replies
+static void
+broadcast(router_t *router, shard_op_t op, cmd_t *cmd, resp_vec_t *gathered,
+	uint64_t vals[][SHARD_VALS])
+{
+	for (uint i = 0; i < router->num_shards; ++i)
+		send_request(router, i, op, cmd);
+	drain(router);
+
+	for (uint i = 0; i < router->num_shards; ++i)
+		read_reply(router, i, gathered, vals ? vals[i] : NULL);
+}
+
+// Orders postings by when they were indexed
+static int
+compare_seqs(const void *a, const void *b)
+{
+	uint64_t seq1 = ((const resp_t *)a)->seq;
+	uint64_t seq2 = ((const resp_t *)b)->seq;
+
+	return seq1 < seq2 ? -1 : seq1 > seq2;
+}
+
+// Orders books by their names
+static int
+compare_names(const void *a, const void *b)
+{
+	return strcmp(((const resp_t *)a)->str, ((const resp_t *)b)->str);
+}
+
+// Orders books just like top_books: rating, number of purchases, then name
+static int
+compare_book_ranks(const void *a, const void *b)
+{
+	const resp_t *book1 = (const resp_t *)a;
+	const resp_t *book2 = (const resp_t *)b;
+
+	if (book1->real != book2->real)
+		return book1->real > book2->real ? -1 : 1;
+	if (book1->num[0] != book2->num[0])
+		return (uint)book1->num[0] > (uint)book2->num[0] ? -1 : 1;
+
+	return strcmp(book1->str, book2->str);
+}
+
+// Orders users just like top_users: score, then name
+static int
+compare_user_ranks(const void *a, const void *b)
+{
+	const resp_t *user1 = (const resp_t *)a;
+	const resp_t *user2 = (const resp_t *)b;
+
+	if (user1->num[0] != user2->num[0])
+		return user1->num[0] > user2->num[0] ? -1 : 1;
+
+	return strcmp(user1->str, user2->str);
+}
+
+// Sorts a part of the gathered responses and emits them
+static void
+emit_sorted(resp_t *resps, uint cnt, int (*compare)(const void *,
+	const void *), uint renumber)
+{
+	qsort(resps, cnt, sizeof(resp_t), compare);
+
+	for (uint i = 0; i < cnt; ++i) {
+		if (renumber)
+			resps[i].num[1] = i + 1;
+		resp_emit(&resps[i]);
+	}
+}
+
+// BORROW: checks the user, then marks the book, then marks the user
+static void
+route_borrow(router_t *router, cmd_t *cmd)
+{
+	uint user_shard = shard_of(router, cmd->argv[1]);
+	uint book_shard = shard_of(router, cmd->argv[2]);
+
+	if (call(router, user_shard, SHARD_CAN_BORROW, cmd) &&
+		call(router, book_shard, SHARD_LEND_BOOK, cmd))
+		forward(router, user_shard, SHARD_LEND_TO, cmd);
+}
+
+// RETURN: takes the book back from the user, then updates its statistics
+static void
+route_return(router_t *router, cmd_t *cmd)
+{
+	uint user_shard = shard_of(router, cmd->argv[1]);
+
+	if (call(router, user_shard, SHARD_GIVE_BACK, cmd))
+		forward(router, shard_of(router, cmd->argv[2]), SHARD_TAKE_BACK, cmd);
+}
+
+// LOST: lowers the user's score, then removes the book
+static void
+route_lost(router_t *router, cmd_t *cmd)
+{
+	if (!call(router, shard_of(router, cmd->argv[1]), SHARD_REPORT_LOST, cmd))
+		return;
+
+	cmd_t rmv_book;
+	memset(&rmv_book, 0, sizeof(rmv_book));
+	rmv_book.op = CMD_RMV_BOOK;
+	rmv_book.argc = 2;
+	memcpy(rmv_book.argv[1], cmd->argv[2], MAX_BOOK_SIZE);
+	forward(router, shard_of(router, cmd->argv[2]), SHARD_EXEC, &rmv_book);
+}
+
+// LIBRARY_STATS: adds up the statistics of all the shards
+static void
+route_stats(router_t *router, cmd_t *cmd)
+{
+	uint64_t vals[MAX_SHARDS][SHARD_VALS];
+	broadcast(router, SHARD_STATS, cmd, NULL, vals);
+
+	uint sums[4] = {0, 0, 0, 0};
+	for (uint i = 0; i < router->num_shards; ++i)
+		for (uint j = 0; j < 4; ++j)
+			sums[j] += vals[i][j];
+
+	resp_library_stats(sums[0], sums[1], sums[2],
+		sums[2] ? (double)sums[3] / sums[2] : 0);
+}
+
+// CACHE_STATS: adds up the pre-rendered lines used by all the shards
+static void
+route_cache_stats(router_t *router, cmd_t *cmd)
+{
+	uint64_t vals[MAX_SHARDS][SHARD_VALS];
+	broadcast(router, SHARD_STATS, cmd, NULL, vals);
+
+	uint64_t hits = 0, misses = 0;
+	for (uint i = 0; i < router->num_shards; ++i) {
+		hits += vals[i][4];
+		misses += vals[i][5];
+	}
+
+	report_line_cache(hits, misses);
+}
+
+// MEMORY: adds up the memory in use by all the shards
+static void
+route_memory(router_t *router, cmd_t *cmd)
+{
+	uint64_t vals[MAX_SHARDS][SHARD_VALS];
+	broadcast(router, SHARD_MEMORY, cmd, NULL, vals);
+
+	size_t total = 0, peak = 0, used[MEM_CLASSES] = {0};
+	for (uint i = 0; i < router->num_shards; ++i) {
+		total += vals[i][0];
+		peak += vals[i][1];
+		for (uint j = 0; j < MEM_CLASSES; ++j)
+			used[j] += vals[i][2 + j];
+	}
+
+	report_memory(total, peak, used);
+}
+
+// FIND_DEF: merges the postings of all the shards, in the order of the index
+static void
+route_find_def(router_t *router, cmd_t *cmd)
+{
+	resp_vec_t postings = {NULL, 0, 0};
+	broadcast(router, SHARD_FIND_DEF, cmd, &postings, NULL);
+
+	if (!postings.size)
+		resp_msg("The definition is not in any book.\n");
+	else
+		emit_sorted(postings.resps, postings.size, compare_seqs, 0);
+
+	mem_free(MEM_OTHER, postings.resps);
+}
+
+// LIST_BOOKS: merges the books of all the shards, in the order of the names
+static void
+route_list_books(router_t *router, cmd_t *cmd)
+{
+	resp_vec_t books = {NULL, 0, 0};
+	broadcast(router, SHARD_LIST_BOOKS, cmd, &books, NULL);
+
+	// Every shard sent at most limit books
+	uint limit = atoi(cmd->argv[2]);
+	qsort(books.resps, books.size, sizeof(resp_t), compare_names);
+	for (uint i = 0; i < books.size && (!limit || i < limit); ++i)
+		resp_emit(&books.resps[i]);
+
+	if (!books.size)
+		resp_msg("No book starts with this prefix.\n");
+
+	mem_free(MEM_OTHER, books.resps);
+}
+
+/* ADVANCE: moves the clocks of all the shards forward, merging their bans,
+ * then has the books of the banned users taken back by their shards
+ */
+static void
+route_advance(router_t *router, cmd_t *cmd)
+{
+	uint days, limit;
+	if (!parse_clock_args(cmd, &days, &limit)) {
+		resp_msg("Invalid command. Please try again.\n");
+		return;
+	}
+
+	uint64_t vals[MAX_SHARDS][SHARD_VALS];
+	resp_vec_t bans = {NULL, 0, 0};
+	broadcast(router, SHARD_ADVANCE, cmd, &bans, vals);
+
+	// The loans of the banned users come along with the bans
+	uint cnt_bans = 0;
+	for (uint i = 0; i < bans.size; ++i) {
+		if (bans.resps[i].type != RESP_LOAN) {
+			bans.resps[cnt_bans++] = bans.resps[i];
+			continue;
+		}
+
+		cmd_t reclaim;
+		memset(&reclaim, 0, sizeof(reclaim));
+		reclaim.op = CMD_ADVANCE;
+		reclaim.argc = 2;
+		memcpy(reclaim.argv[1], bans.resps[i].str + RESP_LOAN_BOOK,
+			MAX_BOOK_SIZE);
+		forward(router, shard_of(router, reclaim.argv[1]), SHARD_RECLAIM,
+			&reclaim);
+	}
+
+	emit_sorted(bans.resps, cnt_bans, compare_names, 0);
+
+	uint cnt = 0;
+	for (uint i = 0; i < router->num_shards; ++i)
+		cnt += vals[i][1];
+	report_clock(vals[0][0], cnt);
+
+	mem_free(MEM_OTHER, bans.resps);
+}
+
+// Orders loans just like print_overdue: due day, then name
+static int
+compare_loans(const void *a, const void *b)
+{
+	const resp_t *loan1 = (const resp_t *)a;
+	const resp_t *loan2 = (const resp_t *)b;
+
+	if (loan1->num[0] != loan2->num[0])
+		return (uint)loan1->num[0] < (uint)loan2->num[0] ? -1 : 1;
+
+	return strcmp(loan1->str, loan2->str);
+}
+
+// OVERDUE: merges the overdue loans of all the shards
+static void
+route_overdue(router_t *router, cmd_t *cmd)
+{
+	uint day, limit;
+	if (!parse_clock_args(cmd, &day, &limit)) {
+		resp_msg("Invalid command. Please try again.\n");
+		return;
+	}
+
+	resp_vec_t loans = {NULL, 0, 0};
+	broadcast(router, SHARD_OVERDUE, cmd, &loans, NULL);
+
+	// Every shard sent at most limit loans
+	qsort(loans.resps, loans.size, sizeof(resp_t), compare_loans);
+	for (uint i = 0; i < loans.size && (!limit || i < limit); ++i)
+		resp_emit(&loans.resps[i]);
+
+	if (!loans.size)
+		resp_msg("No loan is overdue.\n");
+
+	mem_free(MEM_OTHER, loans.resps);
+}
+
+// Prints the rankings gathered from all the shards (arg is a resp_vec_t)
+static void
+emit_rankings(void *arg)
+{
+	resp_vec_t *ranks = (resp_vec_t *)arg;
+
+	// Moves the books in front of the users
+	uint num_books = 0;
+	for (uint i = 0; i < ranks->size; ++i)
+		if (ranks->resps[i].type == RESP_BOOK_RANK) {
+			resp_t aux = ranks->resps[num_books];
+			ranks->resps[num_books++] = ranks->resps[i];
+			ranks->resps[i] = aux;
+		}
+
+	resp_msg("Books ranking:\n");
+	emit_sorted(ranks->resps, num_books, compare_book_ranks, 1);
+	resp_msg("Users ranking:\n");
+	emit_sorted(ranks->resps + num_books, ranks->size - num_books,
+		compare_user_ranks, 1);
+}
+
+// PROFILE: prints the profile of every shard, one after the other
+static void
+route_profile(router_t *router, cmd_t *cmd)
+{
+	// The replies of the commands before have to come out first
+	drain(router);
+
+	for (uint i = 0; i < router->num_shards; ++i) {
+		resp_line("Shard %u:\n", i);
+		call(router, i, SHARD_EXEC, cmd);
+	}
+}
+
+// EXIT: merges the rankings of all the shards
+static void
+route_exit(router_t *router, cmd_t *cmd)
+{
+	resp_vec_t ranks = {NULL, 0, 0};
+	broadcast(router, SHARD_RANKINGS, cmd, &ranks, NULL);
+
+	emit_rankings(&ranks);
+
+	mem_free(MEM_OTHER, ranks.resps);
+
+	// With --profile, the shards' final profiles follow the rankings
+	if (mem_profiling()) {
+		cmd_t profile = *cmd;
+		profile.op = CMD_PROFILE;
+		route_profile(router, &profile);
+	}
+}
+
+/* BULK_LOAD: the router reads the catalogue and parses it, then forwards
+ * each ADD_BOOK to the shard that owns its book, where it is executed like
+ * any other
+ */
+static void
+route_bulk_load(router_t *router, cmd_t *cmd)
+{
+	bulk_t bulk;
+	if (!bulk_read(&bulk, cmd->argv[1])) {
+		drain(router);
+		resp_msg("The catalogue could not be loaded.\n");
+		return;
+	}
+	if (!bulk_prepare(&bulk, NULL)) {
+		drain(router);
+		resp_msg("The catalogue could not be loaded.\n");
+		bulk_free(&bulk);
+		return;
+	}
+
+	for (uint i = 0; i < bulk.num_cmds; ++i)
+		forward(router, shard_of(router, bulk.cmds[i].argv[1]), SHARD_EXEC,
+			&bulk.cmds[i]);
+
+	// The replies of the ADD_BOOKs come out before the total
+	drain(router);
+	resp_line("Loaded:%u\n", bulk.num_cmds);
+	bulk_free(&bulk);
+}
+
+/* SNAPSHOT: gathers the rankings of all the shards at this point of the
+ * input, then leaves merging and writing them to a child of the router
+ */
+static void
+route_snapshot(router_t *router, cmd_t *cmd)
+{
+	resp_vec_t ranks = {NULL, 0, 0};
+	broadcast(router, SHARD_RANKINGS, cmd, &ranks, NULL);
+
+	if (snapshot_take(cmd->argv[1], emit_rankings, &ranks))
+		resp_msg("The snapshot is being written.\n");
+	else
+		resp_msg("The snapshot could not be taken.\n");
+
+	mem_free(MEM_OTHER, ranks.resps);
+}
+
+// Sends a command where it has to go (returns 0 if it was EXIT)
+static int
+route_command(router_t *router, cmd_t *cmd)
+{
+	++(router->seq);
+
+	switch (cmd->op) {
+	case CMD_ADD_BOOK:
+	case CMD_GET_BOOK:
+	case CMD_RMV_BOOK:
+	case CMD_ADD_DEF:
+	case CMD_GET_DEF:
+	case CMD_RMV_DEF:
+	case CMD_ADD_USER:
+		forward(router, shard_of(router, cmd->argv[1]), router->exec_op, cmd);
+		break;
+	case CMD_INVALID:
+	case CMD_LAG:
+	case CMD_TENANT:
+	case CMD_TENANTS:
+		forward(router, 0, SHARD_EXEC, cmd);
+		break;
+	case CMD_BORROW:
+		route_borrow(router, cmd);
+		break;
+	case CMD_RETURN:
+		route_return(router, cmd);
+		break;
+	case CMD_LOST:
+		route_lost(router, cmd);
+		break;
+	case CMD_LIBRARY_STATS:
+		route_stats(router, cmd);
+		break;
+	case CMD_MEMORY:
+		route_memory(router, cmd);
+		break;
+	case CMD_CACHE_STATS:
+		route_cache_stats(router, cmd);
+		break;
+	case CMD_PROFILE:
+		if (mem_profiling())
+			route_profile(router, cmd);
+		else
+			resp_msg("Profiling is off.\n");
+		break;
+	case CMD_FIND_DEF:
+		route_find_def(router, cmd);
+		break;
+	case CMD_LIST_BOOKS:
+		route_list_books(router, cmd);
+		break;
+	case CMD_ADVANCE:
+		route_advance(router, cmd);
+		break;
+	case CMD_OVERDUE:
+		route_overdue(router, cmd);
+		break;
+	case CMD_SNAPSHOT:
+		route_snapshot(router, cmd);
+		break;
+	case CMD_BULK_LOAD:
+		route_bulk_load(router, cmd);
+		break;
+	case CMD_BEGIN:
+	case CMD_COMMIT:
+		// Batches are handled by route_batch
+		resp_msg("There is no batch to commit.\n");
+		break;
+	case CMD_EXIT:
+		route_exit(router, cmd);
+		return 0;
+	}
+
+	return 1;
+}
+
+// Sends a probe of a batch to a shard, reading back what it finds
+static int
+probe_shard(router_t *router, uint shard, shard_op_t op, cmd_t *probe,
+	resp_vec_t *gathered, uint64_t vals[SHARD_VALS])
+{
+	send_request(router, shard, op, probe);
+	drain(router);
+
+	return read_reply(router, shard, gathered, vals);
+}
+
+// Asks the shard of a book or a user of a batch for its state
+static int
+find_shard_key(void *ctx, uint is_user, const char *name, batch_key_t *key)
+{
+	router_t *router = (router_t *)ctx;
+
+	cmd_t probe;
+	memset(&probe, 0, sizeof(probe));
+	probe.op = is_user ? CMD_ADD_USER : CMD_GET_BOOK;
+	probe.argc = 2;
+	strncpy(probe.argv[1], name, MAX_BOOK_SIZE - 1);
+
+	resp_vec_t loan = {NULL, 0, 0};
+	uint64_t vals[SHARD_VALS];
+	int exists = probe_shard(router, shard_of(router, name), SHARD_EXISTS,
+		&probe, &loan, vals);
+
+	if (exists && is_user) {
+		init_user(&key->state, name);
+		key->state.score = (int)(int64_t)vals[0];
+		key->state.banned = vals[1];
+		key->state.days_max = vals[2];
+		key->state.charged = vals[3];
+		if (loan.size)
+			memcpy(key->state.book_name, loan.resps[0].str + RESP_LOAN_BOOK,
+				MAX_BOOK_SIZE);
+	} else if (exists) {
+		key->borrowed = vals[0];
+	}
+	mem_free(MEM_OTHER, loan.resps);
+
+	return exists;
+}
+
+// Asks the shard of a book of a batch whether the book has a definition
+static int
+find_shard_def(void *ctx, const char *book, const char *def)
+{
+	router_t *router = (router_t *)ctx;
+
+	cmd_t probe;
+	memset(&probe, 0, sizeof(probe));
+	probe.op = CMD_GET_DEF;
+	probe.argc = 3;
+	strncpy(probe.argv[1], book, MAX_BOOK_SIZE - 1);
+	strncpy(probe.argv[2], def, MAX_BOOK_SIZE - 1);
+
+	return probe_shard(router, shard_of(router, book), SHARD_EXISTS, &probe,
+		NULL, NULL);
+}
+
+// Asks every shard whether what the batch adds to it fits in its budget
+static int
+shard_fits(void *ctx, const batch_t *batch)
+{
+	router_t *router = (router_t *)ctx;
+	uint num_books[MAX_SHARDS] = {0}, num_defs[MAX_SHARDS] = {0};
+
+	for (uint i = 0; i < batch->size; ++i) {
+		uint shard = shard_of(router, batch->cmds[i].argv[1]);
+		batch_count_adds(&batch->cmds[i], &num_books[shard], &num_defs[shard]);
+	}
+
+	for (uint i = 0; i < router->num_shards; ++i) {
+		if (!num_books[i] && !num_defs[i])
+			continue;
+
+		cmd_t probe;
+		memset(&probe, 0, sizeof(probe));
+		probe.argc = 3;
+		snprintf(probe.argv[1], MAX_BOOK_SIZE, "%u", num_books[i]);
+		snprintf(probe.argv[2], MAX_BOOK_SIZE, "%u", num_defs[i]);
+		if (!probe_shard(router, i, SHARD_FITS, &probe, NULL, NULL))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Routes the commands of a batch (once COMMIT has been read). The router
+ * reads a single input, so nothing can come between the batch's commands.
+ * The shards send back the state of the books and the users of the batch,
+ * so that it is only routed if every command would succeed, but they still
+ * look them up for every command.
+ */
+static void
+route_batch(router_t *router, batch_t *batch)
+{
+	// Why a batch is refused is told after the replies still pending
+	drain(router);
+	batch_probe_t probe = {find_shard_key, find_shard_def, shard_fits, router};
+	if (!batch_check(batch, &probe))
+		return;
+
+	router->exec_op = SHARD_EXEC_BATCH;
+	for (uint i = 0; i < batch->size; ++i)
+		route_command(router, &batch->cmds[i]);
+	router->exec_op = SHARD_EXEC;
+
+	batch_discard(batch);
+}
+
+/**
+ * @brief Executes all the commands from the input in the sharded mode
+ *
+ * @param opts the options the workers create their tables with
+ * @param num_shards the number of workers
+ * @param in the input
+ * @param out the output
+ */
+void
+shard_run(const db_opts_t *opts, uint num_shards, FILE *in, FILE *out)
+{
+	router_t *router = (router_t *)mem_calloc(MEM_OTHER, 1, sizeof(router_t));
+	DIE(!router, "router calloc failed");
+	router->num_shards = num_shards;
+
+	// Anything still buffered would be written by every worker as well
+	fflush(NULL);
+
+	for (uint i = 0; i < num_shards; ++i) {
+		int fds[2];
+		DIE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0,
+			"socketpair failed");
+
+		pid_t pid = fork();
+		DIE(pid < 0, "fork failed");
+
+		if (!pid) {
+			// The worker keeps only its own end of its own socket
+			close(fds[0]);
+			for (uint j = 0; j < i; ++j) {
+				close(fileno(router->shards[j].to));
+				close(fileno(router->shards[j].from));
+			}
+			worker_run(opts, fds[1]);
+		}
+
+		close(fds[1]);
+		router->shards[i].pid = pid;
+		router->shards[i].to = fdopen(fds[0], "w");
+		router->shards[i].from = fdopen(dup(fds[0]), "r");
+		DIE(!router->shards[i].to || !router->shards[i].from,
+			"router fdopen failed");
+	}
+
+	build_ring(router);
+	resp_set_sink(resp_print, out);
+
+	batch_t batch;
+	batch_init(&batch);
+
+	// Routing the commands one by one, until EXIT
+	cmd_t cmd;
+	while (read_command(in, &cmd)) {
+		int running = 1;
+		if (batch_take(&batch, &cmd))
+			;  // queued until COMMIT
+		else if (cmd.op == CMD_COMMIT)
+			route_batch(router, &batch);
+		else
+			running = route_command(router, &cmd);
+
+		free_command(&cmd);
+		if (!running)
+			break;
+	}
+
+	batch_discard(&batch);
+
+	drain(router);
+
+	// Closing the sockets makes the workers free their tables and exit
+	for (uint i = 0; i < num_shards; ++i) {
+		shutdown(fileno(router->shards[i].to), SHUT_WR);
+		waitpid(router->shards[i].pid, NULL, 0);
+		fclose(router->shards[i].to);
+		fclose(router->shards[i].from);
+	}
+
+	fflush(out);
+	resp_set_sink(resp_print, NULL);
+	mem_free(MEM_OTHER, router);
+}
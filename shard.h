@@ -0,0 +1,20 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include <stdio.h>
+#include "utils.h"
+#include "command.h"
+
+// The most worker processes
+#define MAX_SHARDS 64
+// The number of points each shard has on the hash ring
+#define SHARD_VNODES 64
+// The most commands forwarded to the shards before their replies are read
+#define SHARD_WINDOW 64
+
+void
+shard_run(const db_opts_t *opts, uint num_shards, FILE *in, FILE *out);
+
+#endif  // SHARD_H_
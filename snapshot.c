@@ -0,0 +1,100 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "utils.h"
+#include "resp.h"
+
+// The children that are still writing their snapshots
+static pid_t snapshots[MAX_SNAPSHOTS];
+static uint num_snapshots;
+
+// Collects the children that are done (waiting for all of them if block)
+static void
+reap(int block)
+{
+	uint cnt = 0;
+
+	for (uint i = 0; i < num_snapshots; ++i) {
+		int status;
+		pid_t pid = waitpid(snapshots[i], &status, block ? 0 : WNOHANG);
+
+		// Still writing
+		if (!pid) {
+			snapshots[cnt++] = snapshots[i];
+			continue;
+		}
+
+		if (pid > 0 && (!WIFEXITED(status) || WEXITSTATUS(status)))
+			fprintf(stderr, "A snapshot could not be written\n");
+	}
+
+	num_snapshots = cnt;
+}
+
+// The child's side: writes the report next to path, then renames it
+static void
+write_snapshot(const char *path, void (*report)(void *), void *arg)
+{
+	char tmp_path[MAX_BOOK_SIZE + 8];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *out = fopen(tmp_path, "w");
+	if (!out)
+		_exit(1);
+
+	resp_set_sink(resp_print, out);
+	report(arg);
+
+	// Readers of path only ever see a whole report
+	if (fclose(out) || rename(tmp_path, path))
+		_exit(1);
+
+	_exit(0);
+}
+
+/**
+ * @brief Starts writing a snapshot: a child process writes the report of
+ * the tables as they are now to path, while the caller goes on. The child
+ * leaves with _exit, so it never flushes the parent's buffers.
+ *
+ * @param path the file the report is written to
+ * @param report the function that emits the report (in the child)
+ * @param arg passed to report
+ * @return int 1 if the snapshot was started, 0 otherwise
+ */
+int
+snapshot_take(const char *path, void (*report)(void *), void *arg)
+{
+	reap(0);
+	if (!path[0] || num_snapshots == MAX_SNAPSHOTS)
+		return 0;
+
+	// Anything still buffered is written once, by the parent
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return 0;
+	if (!pid)
+		write_snapshot(path, report, arg);
+
+	snapshots[num_snapshots++] = pid;
+
+	return 1;
+}
+
+// Waits for all the snapshots that are still being written
+void
+snapshot_wait(void)
+{
+	reap(1);
+}
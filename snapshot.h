@@ -0,0 +1,23 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "utils.h"
+
+/* Point-in-time reports. SNAPSHOT forks the process: the child gets a
+ * copy-on-write view of the tables as they are at that command, writes its
+ * report from them and exits, while the parent goes on executing commands
+ * right away (only the pages it changes in the meantime are copied).
+ */
+
+// The most snapshots that are written at the same time
+#define MAX_SNAPSHOTS 8
+
+int
+snapshot_take(const char *path, void (*report)(void *), void *arg);
+
+void
+snapshot_wait(void);
+
+#endif  // SNAPSHOT_H_
@@ -0,0 +1,227 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tenant.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils.h"
+#include "mem.h"
+#include "resp.h"
+#include "changelog.h"
+
+HT_TYPED_DEFINE(tenant_ht, tenant_t)
+
+// The tenants (NULL if the process does not host any, like a follower)
+static tenant_ht_t *tenants;
+// The options that the tenants' tables are created with
+static db_opts_t tenant_opts;
+// The tenant that the next commands run against
+static tenant_t *current;
+// The default tenant, whose tables belong to the caller
+static tenant_t *default_tenant;
+// The number of commands executed so far
+static uint64_t tenant_clock;
+// The number of commands after which an unused tenant is evicted
+static uint tenant_idle;
+
+// Frees a tenant's tables or its image (but not the caller's tables)
+static void
+free_tenant(tenant_t *tenant)
+{
+	if (!tenant->pinned)
+		db_free(tenant->db);
+	mem_free(MEM_OTHER, tenant->image);
+}
+
+/**
+ * @brief Makes the process host tenants, starting with the default one
+ *
+ * @param db the default tenant's tables (they stay the caller's)
+ * @param opts the options that the tenants' tables are created with
+ * @param idle the number of commands after which an unused tenant is evicted
+ */
+void
+tenants_init(db_t *db, const db_opts_t *opts, uint idle)
+{
+	tenants = tenant_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR, 0, 0,
+		MEM_OTHER, free_tenant);
+	tenant_opts = *opts;
+	tenant_idle = idle;
+	tenant_clock = 0;
+
+	tenant_t tenant;
+	memset(&tenant, 0, sizeof(tenant));
+	tenant.db = db;
+	tenant.pinned = 1;
+	default_tenant = tenant_ht_put(tenants, DEFAULT_TENANT, &tenant);
+	current = default_tenant;
+}
+
+// Frees all the tenants, except for the default one's tables
+void
+tenants_free(void)
+{
+	tenant_ht_free(tenants);
+	tenants = NULL;
+	current = NULL;
+	default_tenant = NULL;
+}
+
+// Writes a tenant's tables to an image, then frees them
+static void
+evict(tenant_t *tenant)
+{
+	char *buf;
+	size_t size;
+	FILE *out = open_memstream(&buf, &size);
+	DIE(!out, "open_memstream failed");
+	changelog_dump(tenant->db, out);
+	DIE(fclose(out), "tenant image fclose failed");
+
+	// The image is charged to the tables like any other allocation
+	tenant->image = (unsigned char *)mem_malloc(MEM_OTHER, size);
+	DIE(size && !tenant->image, "tenant->image malloc failed");
+	memcpy(tenant->image, buf, size);
+	tenant->image_size = size;
+	free(buf);
+
+	tenant->line_hits = tenant->db->library->line_hits;
+	tenant->line_misses = tenant->db->library->line_misses;
+	db_free(tenant->db);
+	tenant->db = NULL;
+}
+
+// Rebuilds the tables of an evicted tenant from its image
+static void
+reload(tenant_t *tenant)
+{
+	tenant->db = db_create(&tenant_opts);
+	changelog_load(tenant->db, tenant->image, tenant->image_size);
+	tenant->db->library->line_hits = tenant->line_hits;
+	tenant->db->library->line_misses = tenant->line_misses;
+
+	mem_free(MEM_OTHER, tenant->image);
+	tenant->image = NULL;
+	tenant->image_size = 0;
+}
+
+// Evicts the tenants that no command has used for tenant_idle commands
+static void
+evict_idle(void)
+{
+	tenant_ht_cursor_t cursor;
+	tenant_ht_entry_t *it = tenant_ht_begin(tenants, &cursor);
+	for (; it; it = tenant_ht_next(&cursor)) {
+		tenant_t *tenant = &it->value;
+		if (tenant->db && !tenant->pinned && tenant != current &&
+			tenant_clock - tenant->last_used >= tenant_idle)
+			evict(tenant);
+	}
+}
+
+/* Returns the tables that a command runs against: the current tenant's
+ * (rebuilt first, if it was evicted), or db if there are no tenants. Every
+ * TENANT_SWEEP commands, it also evicts the idle tenants, so that an input
+ * that stays on one tenant does not keep the others in memory.
+ */
+db_t *
+tenant_db(db_t *db)
+{
+	if (!tenants)
+		return db;
+
+	current->last_used = ++tenant_clock;
+	if (tenant_clock % TENANT_SWEEP == 0)
+		evict_idle();
+	if (!current->db)
+		reload(current);
+
+	return current->db;
+}
+
+// Returns the tenant that the next commands run against
+tenant_t *
+tenant_current(void)
+{
+	return current;
+}
+
+/* Makes the next commands run against a tenant (NULL for the default one),
+ * such as the one that a connection selected
+ */
+void
+tenant_set_current(tenant_t *tenant)
+{
+	if (tenants)
+		current = tenant ? tenant : default_tenant;
+}
+
+// TENANT: selects a tenant, creating it if it does not exist yet
+void
+tenant_select(const char *name)
+{
+	if (!tenants) {
+		resp_msg("Tenants cannot be used in this mode.\n");
+		return;
+	} else if (!*name) {
+		resp_msg("Invalid command. Please try again.\n");
+		return;
+	}
+
+	tenant_t *tenant = tenant_ht_get(tenants, name);
+	if (!tenant) {
+		tenant_t new_tenant;
+		memset(&new_tenant, 0, sizeof(new_tenant));
+		new_tenant.db = db_create(&tenant_opts);
+		tenant = tenant_ht_put(tenants, name, &new_tenant);
+	}
+
+	current = tenant;
+	current->last_used = tenant_clock;
+	evict_idle();
+
+	resp_line("Tenant:%s\n", name);
+}
+
+// Orders tenants by their names
+static int
+compare_tenants(const void *a, const void *b)
+{
+	return strcmp((*(tenant_ht_entry_t * const *)a)->key,
+		(*(tenant_ht_entry_t * const *)b)->key);
+}
+
+// TENANTS: prints every tenant, by name, along with whether it is evicted
+void
+tenant_list(void)
+{
+	if (!tenants) {
+		resp_msg("Tenants cannot be used in this mode.\n");
+		return;
+	}
+
+	tenant_ht_entry_t **vector = (tenant_ht_entry_t **)mem_malloc(MEM_OTHER,
+		tenants->size * sizeof(tenant_ht_entry_t *));
+	DIE(!vector, "vector malloc failed");
+
+	uint cnt = 0;
+	tenant_ht_cursor_t cursor;
+	tenant_ht_entry_t *it = tenant_ht_begin(tenants, &cursor);
+	for (; it; it = tenant_ht_next(&cursor))
+		vector[cnt++] = it;
+	qsort(vector, cnt, sizeof(tenant_ht_entry_t *), compare_tenants);
+
+	for (uint i = 0; i < cnt; ++i) {
+		tenant_t *tenant = &vector[i]->value;
+		if (tenant->db)
+			resp_line("Name:%s State:Resident\n", vector[i]->key);
+		else
+			resp_line("Name:%s State:Evicted Image:%zu\n", vector[i]->key,
+				tenant->image_size);
+	}
+
+	mem_free(MEM_OTHER, vector);
+}
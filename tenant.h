@@ -0,0 +1,66 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#ifndef TENANT_H_
+#define TENANT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.h"
+#include "ht_typed.h"
+#include "command.h"
+
+/* Tenants: independent libraries hosted by the same process. Every tenant
+ * has tables of its own (books, users and loans), while the allocator, the
+ * threads and the rest of the process are shared. TENANT selects the tenant
+ * that the input's next commands run against (creating it the first time),
+ * and the tenant that the program started with is called "default". A
+ * tenant that has not been used for a while is evicted (when another one
+ * is selected, or every TENANT_SWEEP commands): its tables are written to
+ * a compact image (the changes that rebuild them, just like the change
+ * log's) and freed, and they are rebuilt from the image the next time one
+ * of its commands comes.
+ */
+
+// The name of the tenant that the program starts with
+#define DEFAULT_TENANT "default"
+// The number of commands after which an unused tenant is evicted
+#define TENANT_IDLE 1024
+// The number of commands between two looks for idle tenants
+#define TENANT_SWEEP 64
+
+typedef struct tenant_t
+{
+	db_t *db;  // the tenant's tables (NULL while it is evicted)
+	unsigned char *image;  // the changes that rebuild them (while evicted)
+	size_t image_size;
+	uint64_t last_used;  // the number of the last command it executed
+	uint64_t line_hits;  // the counters of CACHE_STATS (while evicted)
+	uint64_t line_misses;
+	uint pinned;  // whether it may not be evicted (the default tenant)
+} tenant_t;
+
+// The hashtable of tenants (name -> tenant_t)
+HT_TYPED_DECLARE(tenant_ht, tenant_t);
+
+void
+tenants_init(db_t *db, const db_opts_t *opts, uint idle);
+
+void
+tenants_free(void);
+
+db_t *
+tenant_db(db_t *db);
+
+tenant_t *
+tenant_current(void);
+
+void
+tenant_set_current(tenant_t *tenant);
+
+void
+tenant_select(const char *name);
+
+void
+tenant_list(void);
+
+#endif  // TENANT_H_
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Copyright 2022 Rolea Theodor-Ioan
+
+# A batch whose command fails in the middle must leave the tables and the
+# change log as they were: the same input without the batch has to give the
+# same output (but for the refusal) and the same change log, which a
+# follower then reads back the same way.
+
+main=${1:-../main}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+	echo "batch: $1"
+	exit 1
+}
+
+cat > "$dir/setup.txt" <<EOF
+ADD_USER u
+ADD_USER v
+ADD_BOOK b 1
+k v
+BORROW u b 3
+EOF
+
+# The ADD_DEF would succeed, but the BORROW after it would not
+{ cat "$dir/setup.txt"; printf 'GET_DEF b k2\nEXIT\n'; } > "$dir/plain.txt"
+{
+	cat "$dir/setup.txt"
+	printf 'BEGIN\nADD_DEF b k2 v2\nBORROW v b 3\nCOMMIT\n'
+	printf 'GET_DEF b k2\nEXIT\n'
+} > "$dir/batch.txt"
+
+"$main" --changelog "$dir/plain.log" < "$dir/plain.txt" > "$dir/plain.out" ||
+	fail "the plain run failed"
+"$main" --changelog "$dir/batch.log" < "$dir/batch.txt" > "$dir/batch.out" ||
+	fail "the batch run failed"
+
+refusal="The batch has a command that would fail and was not executed."
+[ "$(head -n 1 "$dir/batch.out")" = "$refusal" ] ||
+	fail "the batch was not refused"
+tail -n +2 "$dir/batch.out" | cmp -s - "$dir/plain.out" ||
+	fail "the batch changed the tables"
+
+# The commit records hold the time they were written, so only the sizes of
+# the logs are compared, and a follower of each one shows what it holds
+[ "$(wc -c < "$dir/plain.log")" = "$(wc -c < "$dir/batch.log")" ] ||
+	fail "the batch wrote to the change log"
+printf 'GET_DEF b k\nGET_DEF b k2\nLIBRARY_STATS\nEXIT\n' > "$dir/follow.txt"
+"$main" --follow "$dir/plain.log" < "$dir/follow.txt" > "$dir/plain.fol"
+"$main" --follow "$dir/batch.log" < "$dir/follow.txt" > "$dir/batch.fol"
+cmp -s "$dir/plain.fol" "$dir/batch.fol" ||
+	fail "a follower of the change log sees the batch"
+
+echo "batch: ok"
@@ -0,0 +1,88 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+/* A table large enough to grow on several threads (see ht_rehash) must end
+ * up exactly like one grown on a single thread: the same entries in every
+ * bucket, in the same order, and the same counters in its filter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "ht.h"
+#include "ht_typed.h"
+
+HT_TYPED_DECLARE(rehash_ht, uint);
+HT_TYPED_DEFINE(rehash_ht, uint)
+
+// The number of threads of the parallel growth
+#define REHASH_THREADS 4
+
+// Fills a table of HT_PARALLEL_BUCKETS buckets, then doubles it
+static rehash_ht_t *
+grow_table(uint num_threads)
+{
+	rehash_ht_t *ht = rehash_ht_create(HT_PARALLEL_BUCKETS, LOAD_FACTOR,
+		SHRINK_FACTOR, 0, 1, MEM_OTHER, NULL);
+	char key[32];
+	for (uint i = 0; i < HT_PARALLEL_BUCKETS; ++i) {
+		sprintf(key, "key%u", i * 7919u);
+		rehash_ht_put(ht, key, &i);
+	}
+
+	ht_set_rehash_threads(num_threads);
+	rehash_ht_resize(ht, 2 * ht->hmax);
+
+	return ht;
+}
+
+// Returns 0 if both tables have the same buckets and filter words
+static int
+compare_tables(rehash_ht_t *serial, rehash_ht_t *parallel)
+{
+	if (serial->hmax != parallel->hmax || serial->size != parallel->size) {
+		fprintf(stderr, "rehash: the tables have different sizes\n");
+		return 1;
+	}
+
+	for (uint i = 0; i < serial->hmax; ++i) {
+		ll_link_t *a = serial->buckets[i].first;
+		ll_link_t *b = parallel->buckets[i].first;
+		for (; a && b; a = a->next, b = b->next)
+			if (strcmp(rehash_ht_entry(a)->key, rehash_ht_entry(b)->key)) {
+				fprintf(stderr, "rehash: bucket %u has another order\n", i);
+				return 1;
+			}
+		if (a || b) {
+			fprintf(stderr, "rehash: bucket %u has other entries\n", i);
+			return 1;
+		}
+	}
+
+	filter_t *fa = serial->filter, *fb = parallel->filter;
+	if (fa->num_blocks != fb->num_blocks ||
+		memcmp(fa->words, fb->words, fa->num_blocks * 8 * sizeof(uint64_t))) {
+		fprintf(stderr, "rehash: the filters differ\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(void)
+{
+	rehash_ht_t *serial = grow_table(1);
+	rehash_ht_t *parallel = grow_table(REHASH_THREADS);
+	int failed = compare_tables(serial, parallel);
+	rehash_ht_free(serial);
+	rehash_ht_free(parallel);
+
+	if (failed) {
+		printf("rehash: failed\n");
+		return 1;
+	}
+
+	printf("rehash: ok\n");
+	return 0;
+}
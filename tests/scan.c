@@ -0,0 +1,97 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+/* A scan of a typed hashtable that grows and then shrinks between its pages
+ * must still visit every key that stays in the table from its first page to
+ * its last.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "ht_typed.h"
+
+HT_TYPED_DECLARE(scan_ht, uint);
+HT_TYPED_DEFINE(scan_ht, uint)
+
+// The keys that stay in the table during the whole scan
+#define STABLE_KEYS 500
+// The keys that are added (and then removed) between the pages
+#define TRANSIENT_KEYS 8000
+// How many transient keys are added or removed after each page
+#define KEYS_PER_PAGE 250
+
+static uint seen[STABLE_KEYS];
+
+// Marks a stable key as visited
+static void
+visit(scan_ht_entry_t *entry, void *arg)
+{
+	(void)arg;
+	if (entry->key[0] == 's')
+		seen[entry->value] = 1;
+}
+
+// Scans a table while it grows and shrinks, returns 0 if no key was missed
+static int
+scan_resized(uint filtered)
+{
+	scan_ht_t *ht = scan_ht_create(HMAX, LOAD_FACTOR, SHRINK_FACTOR, 0,
+		filtered, MEM_OTHER, NULL);
+	char key[32];
+	for (uint i = 0; i < STABLE_KEYS; ++i) {
+		sprintf(key, "s%u", i);
+		scan_ht_put(ht, key, &i);
+	}
+	memset(seen, 0, sizeof(seen));
+
+	uint added = 0, removed = 0;
+	uint start_hmax = ht->hmax, max_hmax = ht->hmax, shrunk = 0;
+	uint cursor = 0;
+	do {
+		cursor = scan_ht_scan(ht, cursor, 8, visit, NULL);
+
+		// The table grows until every transient key is in, then shrinks
+		for (uint i = 0; i < KEYS_PER_PAGE; ++i) {
+			if (added < TRANSIENT_KEYS) {
+				sprintf(key, "t%u", added);
+				scan_ht_put(ht, key, &added);
+				++added;
+			} else if (removed < TRANSIENT_KEYS) {
+				sprintf(key, "t%u", removed++);
+				scan_ht_remove(ht, key);
+			}
+		}
+		if (ht->hmax > max_hmax)
+			max_hmax = ht->hmax;
+		else if (ht->hmax < max_hmax)
+			shrunk = 1;
+	} while (cursor);
+
+	int missed = 0;
+	for (uint i = 0; i < STABLE_KEYS; ++i)
+		if (!seen[i]) {
+			fprintf(stderr, "scan: s%u was not visited\n", i);
+			missed = 1;
+		}
+
+	if (max_hmax == start_hmax || !shrunk) {
+		fprintf(stderr, "scan: the table did not grow and shrink\n");
+		missed = 1;
+	}
+
+	scan_ht_free(ht);
+	return missed;
+}
+
+int
+main(void)
+{
+	if (scan_resized(0) || scan_resized(1)) {
+		printf("scan: failed\n");
+		return 1;
+	}
+
+	printf("scan: ok\n");
+	return 0;
+}
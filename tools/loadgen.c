@@ -0,0 +1,278 @@
+// Copyright 2022 Rolea Theodor-Ioan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../utils.h"
+
+/* A load generator for the server mode. It fills the library with books,
+ * then opens a number of connections, each of which sends batches of
+ * GET_BOOK and GET_DEF commands (every one of them answered by exactly one
+ * line) and waits for all of their responses before sending the next batch.
+ * It prints the throughput, along with the latency of a whole batch.
+ */
+
+// The size of a batch's buffers
+#define BATCH_BUF_SIZE (1 << 16)
+
+typedef struct loadgen_opts_t
+{
+	const char *addr;  // "unix:PATH", "HOST:PORT" or "PORT"
+	uint conns;  // the number of connections
+	uint cmds;  // the number of commands each connection sends
+	uint depth;  // the number of commands in a batch
+	uint books;  // the number of books the library is filled with
+} loadgen_opts_t;
+
+// What a connection measures
+typedef struct worker_t
+{
+	pthread_t thread;
+	const loadgen_opts_t *opts;
+	uint seed;
+	uint num_batches;
+	double *latencies;  // the latency of every batch, in microseconds
+} worker_t;
+
+// Returns the current time, in microseconds
+static double
+now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Connects to the server (returns -1 if it cannot)
+static int
+connect_to(const char *addr)
+{
+	int fd;
+
+	if (!strncmp(addr, "unix:", 5)) {
+		struct sockaddr_un sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		strncpy(sa.sun_path, addr + 5, sizeof(sa.sun_path) - 1);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+			close(fd);
+			fd = -1;
+		}
+
+		return fd;
+	}
+
+	// Splits the address into a host (the local one, by default) and a port
+	char host[LINE_SIZE] = "127.0.0.1";
+	const char *port = strrchr(addr, ':');
+	if (port) {
+		size_t len = port - addr;
+		if (len > LINE_SIZE - 1)
+			len = LINE_SIZE - 1;
+		memcpy(host, addr, len);
+		host[len] = '\0';
+		++port;
+	} else {
+		port = addr;
+	}
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res))
+		return -1;
+
+	fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	return fd;
+}
+
+// Writes a whole buffer to a socket
+static void
+write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t written = write(fd, buf, len);
+		DIE(written <= 0, "write failed");
+		buf += written;
+		len -= written;
+	}
+}
+
+// Reads from a socket until lines more lines have been received
+static void
+read_lines(int fd, uint lines)
+{
+	char buf[BATCH_BUF_SIZE];
+
+	while (lines) {
+		ssize_t len = read(fd, buf, sizeof(buf));
+		DIE(len <= 0, "read failed");
+		for (ssize_t i = 0; i < len; ++i)
+			if (buf[i] == '\n')
+				--lines;
+	}
+}
+
+// Fills the library with books, each of which has two definitions
+static void
+fill_library(const loadgen_opts_t *opts)
+{
+	int fd = connect_to(opts->addr);
+	DIE(fd < 0, "connect failed");
+
+	char buf[BATCH_BUF_SIZE];
+	size_t len = 0;
+	for (uint i = 0; i < opts->books; ++i) {
+		len += sprintf(buf + len,
+			"ADD_BOOK book%u 2\nkey0 val%u\nkey1 val%u\n", i, i, i);
+		if (len > sizeof(buf) - LINE_SIZE) {
+			write_all(fd, buf, len);
+			len = 0;
+		}
+	}
+
+	// ADD_BOOK has no response, so a GET_BOOK tells when they are all in
+	len += sprintf(buf + len, "GET_BOOK book0\n");
+	write_all(fd, buf, len);
+	read_lines(fd, 1);
+	close(fd);
+}
+
+// A connection: sends its batches, measuring how long each one takes
+static void *
+run_worker(void *arg)
+{
+	worker_t *worker = (worker_t *)arg;
+	const loadgen_opts_t *opts = worker->opts;
+
+	int fd = connect_to(opts->addr);
+	DIE(fd < 0, "connect failed");
+
+	char *buf = malloc(opts->depth * LINE_SIZE);
+	DIE(!buf, "buf malloc failed");
+
+	for (uint sent = 0; sent < opts->cmds; sent += opts->depth) {
+		uint cnt = opts->cmds - sent < opts->depth ?
+			opts->cmds - sent : opts->depth;
+
+		size_t len = 0;
+		for (uint i = 0; i < cnt; ++i) {
+			uint book = rand_r(&worker->seed) % opts->books;
+			if (i % 2)
+				len += sprintf(buf + len, "GET_DEF book%u key%u\n", book,
+					i % 4 / 2);
+			else
+				len += sprintf(buf + len, "GET_BOOK book%u\n", book);
+		}
+
+		double start = now_us();
+		write_all(fd, buf, len);
+		read_lines(fd, cnt);
+		worker->latencies[worker->num_batches++] = now_us() - start;
+	}
+
+	free(buf);
+	close(fd);
+
+	return NULL;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int
+main(int argc, char *argv[])
+{
+	loadgen_opts_t opts = {NULL, 4, 100000, 32, 1000};
+
+	int valid = 1;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-c") && i + 1 < argc)
+			opts.conns = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			opts.cmds = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+			opts.depth = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+			opts.books = atoi(argv[++i]);
+		else if (!opts.addr && argv[i][0] != '-')
+			opts.addr = argv[i];
+		else
+			valid = 0;
+	}
+
+	if (!valid || !opts.addr || !opts.conns || !opts.cmds || !opts.depth ||
+		!opts.books) {
+		fprintf(stderr, "Usage: %s ADDR [-c connections] [-n commands] "
+			"[-d depth] [-b books]\n", argv[0]);
+		return 1;
+	}
+
+	fill_library(&opts);
+
+	worker_t *workers = calloc(opts.conns, sizeof(worker_t));
+	DIE(!workers, "workers calloc failed");
+
+	double start = now_us();
+	for (uint i = 0; i < opts.conns; ++i) {
+		workers[i].opts = &opts;
+		workers[i].seed = i + 1;
+		workers[i].latencies = malloc((opts.cmds / opts.depth + 1) *
+			sizeof(double));
+		DIE(!workers[i].latencies, "latencies malloc failed");
+		DIE(pthread_create(&workers[i].thread, NULL, run_worker,
+			&workers[i]), "pthread_create failed");
+	}
+
+	// Gathers the latencies of all the batches
+	uint num_batches = 0;
+	double *latencies = malloc(opts.conns * (opts.cmds / opts.depth + 1) *
+		sizeof(double));
+	DIE(!latencies, "latencies malloc failed");
+	for (uint i = 0; i < opts.conns; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		memcpy(latencies + num_batches, workers[i].latencies,
+			workers[i].num_batches * sizeof(double));
+		num_batches += workers[i].num_batches;
+		free(workers[i].latencies);
+	}
+	double elapsed = (now_us() - start) / 1e6;
+
+	qsort(latencies, num_batches, sizeof(double), compare_doubles);
+	double total = (double)opts.conns * opts.cmds;
+	printf("Commands:%.0lf Seconds:%.3lf Throughput:%.0lf/s\n", total,
+		elapsed, total / elapsed);
+	printf("Batch latency (us): p50:%.1lf p99:%.1lf max:%.1lf\n",
+		latencies[num_batches / 2], latencies[num_batches * 99 / 100],
+		latencies[num_batches - 1]);
+
+	free(latencies);
+	free(workers);
+
+	return 0;
+}
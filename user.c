@@ -6,170 +6,240 @@
 #include <string.h>
 #include <errno.h>
 #include "utils.h"
-#include "ll.h"
-#include "ht.h"
+#include "mem.h"
+#include "ht_typed.h"
 #include "book.h"
+#include "keycmp.h"
+#include "resp.h"
+#include "changelog.h"
+
+HT_TYPED_DEFINE(user_ht, user_t)
+
+// Fills in the record of a newly registered user
+void
+init_user(user_t *user, const char *name)
+{
+	user->days_max = 0;
+	user->due = 0;
+	user->charged = 0;
+	user->loan_pos = 0;
+	user->score = 100;
+	user->banned = 0;
+	// Marks the user as having no book borrowed
+	key_pad(user->book_name, INIT_STR, MAX_BOOK_SIZE);
+	// Sets the username (zero-padded, so that it can be compared by key_cmp)
+	key_pad(user->name, name, MAX_DEF_NAME_SIZE);
+}
 
 // Adds user to the database
 void
-add_user(ht_t *users, ht_t *banned_users, char name[MAX_DEF_NAME_SIZE])
+add_user(user_ht_t *users, char name[MAX_DEF_NAME_SIZE])
 {
 	// Checks if the user is already registered / banned
-	if (ht_get(users, name) || ht_get(banned_users, name)) {
-		printf("User is already registered.\n");
+	if (user_ht_get(users, name)) {
+		resp_msg("User is already registered.\n");
 		return;
 	}
 
-	// Init
 	user_t user;
-	user.days_max = 0;
-	user.score = 100;
-	// Marks the user as having no book borrowed
-	memcpy(user.book_name, INIT_STR, MAX_BOOK_SIZE);
-	// Sets the username
-	memcpy(user.name, name, MAX_DEF_NAME_SIZE);
+	init_user(&user, name);
 
 	// Puts the user in the database
-	ht_put(users, name, strlen(name) + 1, &user, sizeof(user_t),
-		users->free_function);
+	changelog_user(user_ht_put(users, name, &user));
 }
 
-/* Marks a book as borrowed, as well as marks a user as having borrowed
- * said book, setting a time limit for its return
+/* Checks if a user that was already looked up (NULL if they are not
+ * registered) can borrow a book, returning 1 if they can (or 0, after saying
+ * why they cannot)
  */
-void
-borrow(ht_t *library, ht_t *users, ht_t *banned_users,
-	char user_name[MAX_DEF_NAME_SIZE], char book_name[MAX_BOOK_SIZE],
-		int days_max)
+int
+can_borrow(user_t *user)
 {
 	// Checks if the user is banned
-	if (ht_get(banned_users, user_name)) {
-		printf("You are banned from this library.\n");
-		return;
+	if (user && user->banned) {
+		resp_msg("You are banned from this library.\n");
+		return 0;
 	}
 
-	// Gets the user
-	user_t *user = ht_get(users, user_name);
-
 	// Checks if the user is registered or already has a book borrowed
 	if (!user) {
-		printf("You are not registered yet.\n");
-		return;
+		resp_msg("You are not registered yet.\n");
+		return 0;
 	} else if (strcmp(user->book_name, INIT_STR)) {
-		printf("You have already borrowed a book.\n");
-		return;
+		resp_msg("You have already borrowed a book.\n");
+		return 0;
 	}
 
-	// Gets the book
-	book_t *book = ht_get(library, book_name);
+	return 1;
+}
 
+/* Marks a book that was already looked up (NULL if it is not in the
+ * library) as borrowed, returning 1 if it could be (or 0, after saying why
+ * it could not)
+ */
+int
+lend_book(library_t *library, book_t *book)
+{
 	/* Checks if the book is in the library or if it is already borrowed by
 	 * another user
 	 */
 	if (!book) {
-		printf("The book is not in the library.\n");
-		return;
-	} else if (book->status) {
-		printf("The book is borrowed.\n");
-		return;
+		resp_msg("The book is not in the library.\n");
+		return 0;
+	} else if (library->stats.status[book->id]) {
+		resp_msg("The book is borrowed.\n");
+		return 0;
 	}
 
+	// Sets the book's status to borrowed
+	library->stats.status[book->id] = 1;
+	changelog_book_state(library, book);
+	return 1;
+}
+
+/* Marks a user as having borrowed a book, setting a time limit for its
+ * return, and adds the loan to the heap of loans
+ */
+void
+lend_to(loans_t *loans, user_t *user, char book_name[MAX_BOOK_SIZE],
+	int days_max)
+{
 	// Sets the time limit for the book's return
 	user->days_max = days_max;
+	user->due = loans->today + user->days_max;
+	user->charged = 0;
 	// Puts the name of the book in the user_t struct
 	memcpy(user->book_name, book_name, MAX_BOOK_SIZE);
-	// Sets the book's status to borrowed
-	book->status = 1;
+	loans_add(loans, user);
+	changelog_user(user);
 }
 
-// If the user's score is negative, bans the user
+/* Marks a book as borrowed, as well as marks a user as having borrowed
+ * said book, setting a time limit for its return
+ */
 void
-check(ht_t *users, ht_t *banned_users, user_t *user)
+borrow(library_t *library, loans_t *loans, user_t *user, book_t *book,
+	int days_max)
+{
+	if (!can_borrow(user) || !lend_book(library, book))
+		return;
+
+	lend_to(loans, user, book->name, days_max);
+}
+
+/* If the user's score is negative, bans the user. The user stays in the
+ * database, only marked as banned, so that their name cannot be registered
+ * again.
+ */
+void
+check(user_t *user)
 {
 	// Checks the score
 	if (user->score < 0) {
-		// Puts the user in the banned_users hashtable
-		ht_put(banned_users, user->name, strlen(user->name) + 1,
-			user->name, strlen(user->name) + 1, banned_users->free_function);
-		printf("The user %s has been banned from this library.\n", user->name);
-		// Removes the user from the users hashtable (aka the database)
-		ht_remove_entry(users, user->name, users->free_function);
+		user->banned = 1;
+		resp_banned(user->name);
 	}
 }
 
-// Returns a book to the library, adjusting the user's score appropiately
+/* Calculates the score of a user who returns their book, then marks them
+ * as having no book:
+ * If the book was returned on time, the score increases by the number of
+ * days that were left until the time limit.
+ * If it was not returned on time, the score decreases by (the number of
+ * days that were over the time limit) * 2.
+ * The days late that ADVANCE has already charged are not charged again
+ * (and a book that ADVANCE found late earns no days back).
+ */
 void
-return_func(ht_t *library, ht_t *users, ht_t *banned_users,
-	char user_name[MAX_DEF_NAME_SIZE], char book_name[MAX_BOOK_SIZE],
-		uint days_since, uint rating)
+score_return(user_t *user, uint days_since)
 {
-	// Checks if the user is banned
-	if (ht_get(banned_users, user_name)) {
-		printf("You are banned from this library.\n");
-		return;
+	if (days_since > user->days_max) {
+		uint late = days_since - user->days_max;
+		if (late > user->charged)
+			user->score -= 2 * (late - user->charged);
+	} else if (!user->charged) {
+		user->score += user->days_max - days_since;
 	}
 
-	// Gets the user
-	user_t *user = ht_get(users, user_name);
+	memcpy(user->book_name, INIT_STR, sizeof(INIT_STR));
+}
+
+/* Takes a book back from a user (NULL if they are not registered),
+ * adjusting their score appropiately. Returns 1 if the user had borrowed the
+ * book (or 0, after saying why not).
+ */
+int
+give_back(loans_t *loans, user_t *user, char book_name[MAX_BOOK_SIZE],
+	uint days_since)
+{
+	// Checks if the user is banned or registered
+	if (user && user->banned) {
+		resp_msg("You are banned from this library.\n");
+		return 0;
+	} else if (!user) {
+		resp_msg("You are not registered yet.\n");
+		return 0;
+	}
 
 	/* Checks if the user is trying to return a different book than the one
 	 * that they borrowed
 	 */
 	if (strcmp(user->book_name, book_name) ||
 		!strcmp(user->book_name, INIT_STR)) {
-		printf("You didn't borrow this book.\n");
-		return;
+		resp_msg("You didn't borrow this book.\n");
+		return 0;
 	}
 
-	/* Calculates the user's new score:
-	 * If the book was returned on time, the score increases by the number of
-	 * days that were left until the time limit.
-	 * If it was not returned on time, the score decreases by (the number of
-	 * days that were over the time limit) * 2.
-	 */
-	if (days_since > user->days_max)
-		user->score -= 2 * (days_since - user->days_max);
-	else
-		user->score += user->days_max - days_since;
-
-	// Marks the user as having no book
-	memcpy(user->book_name, INIT_STR, MAX_BOOK_SIZE);
+	score_return(user, days_since);
+	loans_remove(loans, user);
+	user->charged = 0;
 
 	// Checks the user's score, banning them if necessary
-	check(users, banned_users, user);
+	check(user);
+	changelog_user(user);
 
-	// Gets the book
-	book_t *book = ht_get(library, book_name);
+	return 1;
+}
 
-	// Sets its status to not borrowed
-	book->status = 0;
+/* Sets a returned book's status to not borrowed. The book's number of
+ * purchases, sum of total ratings, as well as its average rating change.
+ */
+void
+take_back(library_t *library, book_t *book, uint rating)
+{
+	if (!book)
+		return;
 
-	/* The book's number of purchases, sum of total ratings, as well as its
-	 * average rating change.
-	 */
-	++(book->purchases);
-	book->ratings += rating;
-	book->rating_avg = (double)book->ratings / book->purchases;
+	book_stats_return(&library->stats, book->id, rating);
+	changelog_book_state(library, book);
 }
 
-// Removes a book from the library, subtracting 50 from the user's score
+// Returns a book to the library, adjusting the user's score appropiately
 void
-lost(ht_t *library, ht_t *users, ht_t *banned_users,
-	char user_name[MAX_DEF_NAME_SIZE], char book_name[MAX_BOOK_SIZE])
+return_func(library_t *library, loans_t *loans, user_t *user, book_t *book,
+	char book_name[MAX_BOOK_SIZE], uint days_since, uint rating)
+{
+	if (give_back(loans, user, book_name, days_since))
+		take_back(library, book, rating);
+}
+
+/* Subtracts 50 from the score of a user who lost their book (NULL if they
+ * are not registered). Returns 1 if the user could report it (or 0, after
+ * saying why not).
+ */
+int
+report_lost(loans_t *loans, user_t *user)
 {
 	// Checks if the user has been banned
-	if (ht_get(banned_users, user_name)) {
-		printf("You are banned from this library.\n");
-		return;
+	if (user && user->banned) {
+		resp_msg("You are banned from this library.\n");
+		return 0;
 	}
 
-	// Gets the uer
-	user_t *user = ht_get(users, user_name);
-
 	// Checks if the user is registered
 	if (!user) {
-		printf("You are not registered yet.\n");
-		return;
+		resp_msg("You are not registered yet.\n");
+		return 0;
 	}
 
 	// Subtracts 50 from the user's score
@@ -177,69 +247,230 @@ lost(ht_t *library, ht_t *users, ht_t *banned_users,
 
 	// Marks the user as having no book borrowed
 	memcpy(user->book_name, INIT_STR, MAX_BOOK_SIZE);
+	loans_remove(loans, user);
+	user->charged = 0;
 	// Checks the user's score, banning them if necessary
-	check(users, banned_users, user);
-	// Removes the book from the library
-	remove_book(library, book_name);
+	check(user);
+	changelog_user(user);
+
+	return 1;
 }
 
-// Swaps two user_t structs
+// Removes a book from the library, subtracting 50 from the user's score
+void
+lost(library_t *library, loans_t *loans, user_t *user, book_t *book)
+{
+	if (report_lost(loans, user))
+		drop_book(library, book);
+}
+
+// Orders users by their names
+static int
+compare_user_names(const void *a, const void *b)
+{
+	const user_t *user1 = *(user_t * const *)a;
+	const user_t *user2 = *(user_t * const *)b;
+
+	return key_cmp(user1->name, user2->name, MAX_DEF_NAME_SIZE);
+}
+
+// Orders loans by the day they are due, then by the users' names
+static int
+compare_loans(const void *a, const void *b)
+{
+	const user_t *user1 = *(user_t * const *)a;
+	const user_t *user2 = *(user_t * const *)b;
+
+	if (user1->due != user2->due)
+		return user1->due < user2->due ? -1 : 1;
+
+	return key_cmp(user1->name, user2->name, MAX_DEF_NAME_SIZE);
+}
+
+/* Takes back the book of a user that ADVANCE banned: it is no longer
+ * borrowed, but it earns no purchase or rating, since it was not returned
+ */
 void
-swap_users(user_t *user1, user_t *user2)
+reclaim_book(library_t *library, const char *book_name)
 {
-	user_t aux = *user1;
+	book_t *book = book_ht_get(library->books, book_name);
+	if (!book)
+		return;
+
+	library->stats.status[book->id] = 0;
+	changelog_book_state(library, book);
+}
+
+/**
+ * @brief Moves the library's clock forward, then charges the users whose
+ * books are overdue 2 points for every day late that has not been charged
+ * yet, in the order of their names (banning them if necessary). Only the
+ * overdue loans are visited.
+ *
+ * @param loans the loans
+ * @param days the number of days
+ * @param reclaim called for every banned user (who still has their book),
+ * so that the book is taken back
+ * @param ctx passed to reclaim
+ * @return uint the number of overdue loans
+ */
+uint
+advance_clock(loans_t *loans, uint days, reclaim_t reclaim, void *ctx)
+{
+	loans->today += days;
+	changelog_clock(loans->today);
+
+	uint cnt = loans_count_overdue(loans, loans->today);
+	if (!cnt)
+		return 0;
+
+	user_t **found = (user_t **)mem_malloc(MEM_USERS,
+		cnt * sizeof(user_t *));
+	DIE(!found, "found malloc failed");
+
+	loans_overdue(loans, loans->today, found);
+	qsort(found, cnt, sizeof(user_t *), compare_user_names);
+
+	for (uint i = 0; i < cnt; ++i) {
+		user_t *user = found[i];
+		uint late = loans->today - user->due;
+
+		user->score -= 2 * (late - user->charged);
+		user->charged = late;
+		check(user);
+
+		/* A banned user cannot return the book, so it is charged no more
+		 * and the library takes it back
+		 */
+		if (user->banned) {
+			loans_remove(loans, user);
+			reclaim(user, ctx);
+			memcpy(user->book_name, INIT_STR, sizeof(INIT_STR));
+		}
+		changelog_user(user);
+	}
+
+	mem_free(MEM_USERS, found);
+
+	return cnt;
+}
+
+// Prints the library's clock, along with the number of overdue loans
+void
+report_clock(uint today, uint overdue)
+{
+	resp_line("Day:%u Overdue:%u\n", today, overdue);
+}
+
+// Takes back the book of a banned user from the library (the ctx)
+static void
+reclaim_local(user_t *user, void *ctx)
+{
+	reclaim_book((library_t *)ctx, user->book_name);
+}
+
+// Moves the library's clock forward, charging the overdue loans
+void
+advance(library_t *library, loans_t *loans, uint days)
+{
+	uint cnt = advance_clock(loans, days, reclaim_local, library);
+
+	report_clock(loans->today, cnt);
+}
+
+/* Prints the loans that are overdue on a given day, by the day they are due
+ * (at most limit of them, if limit is not 0). Returns the number of printed
+ * loans.
+ */
+uint
+print_overdue(loans_t *loans, uint day, uint limit)
+{
+	uint cnt = loans_count_overdue(loans, day);
+	if (!cnt)
+		return 0;
+
+	user_t **found = (user_t **)mem_malloc(MEM_USERS,
+		cnt * sizeof(user_t *));
+	DIE(!found, "found malloc failed");
+
+	loans_overdue(loans, day, found);
+	qsort(found, cnt, sizeof(user_t *), compare_loans);
+	if (limit && cnt > limit)
+		cnt = limit;
+
+	for (uint i = 0; i < cnt; ++i)
+		resp_loan(found[i]->name, found[i]->book_name, found[i]->due);
+
+	mem_free(MEM_USERS, found);
+
+	return cnt;
+}
+
+// Prints the loans that are overdue on a given day
+void
+overdue(loans_t *loans, uint day, uint limit)
+{
+	if (!print_overdue(loans, day, limit))
+		resp_msg("No loan is overdue.\n");
+}
+
+// Swaps two pointers to users
+void
+swap_users(user_t **user1, user_t **user2)
+{
+	user_t *aux = *user1;
 	*user1 = *user2;
 	*user2 = aux;
 }
 
-// Prints all users' important information (sorted)
+// Prints all (not banned) users' important information (sorted)
 void
-top_users(ht_t *users)
+top_users(user_ht_t *users)
 {
-	// Allocates memory for a vector of user_t structs
-	user_t *vector = (user_t *)malloc(users->size * sizeof(user_t));
+	// Allocates memory for a vector of pointers to users (not copies)
+	user_t **vector = (user_t **)mem_malloc(MEM_USERS,
+		users->size * sizeof(user_t *));
 	DIE(!vector, "vector (users) malloc failed");
 
 	uint cnt = 0;
 
-	// Adds entries from the hashtable in the vector
-	ll_node_t *it;
-	for (uint i = 0; i < users->hmax; ++i)	{
-		if (users->buckets[i]->head) {
-			it = users->buckets[i]->head;
-			while (it) {
-				vector[cnt] = *(user_t *)(((info *)it->data)->value);
-				++cnt;
-				it = it->next;
-			}
-		}
+	// Adds entries from the hashtable in the vector, skipping banned users
+	user_ht_cursor_t cursor;
+	user_ht_entry_t *it = user_ht_begin(users, &cursor);
+	for (; it; it = user_ht_next(&cursor))
+		if (!it->value.banned)
+			vector[cnt++] = &it->value;
+
+	// Every user might have been banned
+	if (!cnt) {
+		mem_free(MEM_USERS, vector);
+		return;
 	}
 
 	// Sorts the vector based on the given priorities: score, name
 	for (uint i = 0; i < cnt - 1; ++i)
 		for (uint j = i; j < cnt; ++j) {
-			if (vector[i].score < vector[j].score) {
+			if (vector[i]->score < vector[j]->score) {
 				swap_users(&vector[i], &vector[j]);
-			} else if (vector[i].score == vector[j].score) {
-				if (strcmp(vector[i].name, vector[j].name) > 0)
+			} else if (vector[i]->score == vector[j]->score) {
+				if (key_cmp(vector[i]->name, vector[j]->name,
+					MAX_DEF_NAME_SIZE) > 0)
 					swap_users(&vector[i], &vector[j]);
 			}
 		}
 
 	// Prints the vector
 	for (uint i = 0; i < cnt; ++i) {
-		printf("%d. Name:%s Points:%d\n", i + 1, vector[i].name,
-			vector[i].score);
+		resp_user_rank(i + 1, vector[i]->name, vector[i]->score);
 	}
 
 	// Frees the vector
-	free(vector);
+	mem_free(MEM_USERS, vector);
 }
 
-// Frees the users and banned_users hashtables
+// Frees the users hashtable
 void
-free_users(ht_t *users, ht_t *banned_users)
+free_users(user_ht_t *users)
 {
-	ht_free(users);
-	ht_free(banned_users);
+	user_ht_free(users);
 }
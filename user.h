@@ -4,43 +4,96 @@
 #define USER_H_
 
 #include "utils.h"
-#include "ht.h"
+#include "ht_typed.h"
+#include "book.h"
+#include "loans.h"
 
 typedef struct user_t
 {
 	int score;  // the score, initially 100
+	uint banned;  // whether the user has been banned (the rest is unused)
 	uint days_max;  // the time limit until a book must be returned
+	uint due;  // the day the borrowed book is due (on the library's clock)
+	uint charged;  // the days late that ADVANCE has already charged
+	uint loan_pos;  // the position of the loan in the heap (0 for none)
 	char name[MAX_DEF_NAME_SIZE];  // the username
 	char book_name[MAX_BOOK_SIZE];  // the borrowed book's name
 } user_t;
 
+// The users hashtable (name -> user_t), banned users included
+HT_TYPED_DECLARE(user_ht, user_t);
+
+void
+init_user(user_t *user, const char *name);
+
+void
+add_user(user_ht_t *users, char name[MAX_DEF_NAME_SIZE]);
+
+int
+can_borrow(user_t *user);
+
+int
+lend_book(library_t *library, book_t *book);
+
+void
+lend_to(loans_t *loans, user_t *user, char book_name[MAX_BOOK_SIZE],
+	int days_max);
+
+void
+borrow(library_t *library, loans_t *loans, user_t *user, book_t *book,
+	int days_max);
+
+void
+check(user_t *user);
+
+void
+score_return(user_t *user, uint days_since);
+
+int
+give_back(loans_t *loans, user_t *user, char book_name[MAX_BOOK_SIZE],
+	uint days_since);
+
+void
+take_back(library_t *library, book_t *book, uint rating);
+
 void
-add_user(ht_t *users, ht_t *banned_users, char name[MAX_DEF_NAME_SIZE]);
+return_func(library_t *library, loans_t *loans, user_t *user, book_t *book,
+	char book_name[MAX_BOOK_SIZE], uint days_since, uint rating);
+
+int
+report_lost(loans_t *loans, user_t *user);
+
+void
+lost(library_t *library, loans_t *loans, user_t *user, book_t *book);
+
+// Called for every user whose loan ADVANCE cancels by banning them
+typedef void (*reclaim_t)(user_t *user, void *ctx);
 
 void
-borrow(ht_t *library, ht_t *users, ht_t *banned_users,
-	char user_name[MAX_DEF_NAME_SIZE], char book_name[MAX_BOOK_SIZE],
-		int days);
+reclaim_book(library_t *library, const char *book_name);
+
+uint
+advance_clock(loans_t *loans, uint days, reclaim_t reclaim, void *ctx);
 
 void
-check(ht_t *users, ht_t *banned_users, user_t *user);
+report_clock(uint today, uint overdue);
 
 void
-return_func(ht_t *library, ht_t *users, ht_t *banned_users,
-	char user_name[MAX_DEF_NAME_SIZE], char book_name[MAX_BOOK_SIZE],
-		uint days_since, uint rating);
+advance(library_t *library, loans_t *loans, uint days);
+
+uint
+print_overdue(loans_t *loans, uint day, uint limit);
 
 void
-lost(ht_t *library, ht_t *users, ht_t *banned_users,
-	char user_name[MAX_DEF_NAME_SIZE], char book_name[MAX_BOOK_SIZE]);
+overdue(loans_t *loans, uint day, uint limit);
 
 void
-swap_users(user_t *user1, user_t *user2);
+swap_users(user_t **user1, user_t **user2);
 
 void
-top_users(ht_t *users);
+top_users(user_ht_t *users);
 
 void
-free_users(ht_t *users, ht_t *banned_users);
+free_users(user_ht_t *users);
 
 #endif  // USER_H_
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 // Checks if a character is considered a delimiter
 uint
@@ -23,8 +24,8 @@ is_delim(char c, char *delim)
 char *
 my_strtok(char *src_str, char *delim)
 {
-	// Start of the next token
-	static char *backup_string;
+	// Start of the next token (one per thread, so threads can parse at once)
+	static __thread char *backup_string;
 
 	if (!src_str)
 		src_str = backup_string;
@@ -71,52 +72,102 @@ my_strtok(char *src_str, char *delim)
 	}
 }
 
+/* Appends len characters of str to an argument, as many of them as fit
+ * (returns 0 if some of them did not)
+ */
+static int
+append_arg(char arg[MAX_BOOK_SIZE], const char *str, size_t len)
+{
+	size_t used = strlen(arg);
+	int fits = len <= MAX_BOOK_SIZE - 1 - used;
+	if (!fits)
+		len = MAX_BOOK_SIZE - 1 - used;
+
+	memcpy(arg + used, str, len);
+	arg[used + len] = '\0';
+
+	return fits;
+}
+
 /**
  * @brief Breaks down a line into arguments
  * 
  * @param line the command line
  * @param argc the number of arguments
- * @param argv the vector of arguments
+ * @param argv the vector of arguments (empty strings to begin with)
  * @param sep a separator sep is used to signal a multi-word argument
+ * @return int 1 if every argument fits in MAX_BOOK_SIZE - 1 characters, 0
+ * if one of them is longer (it is then cut)
  */
-void
+int
 break_down_line(char *line, int *argc,
 	char argv[NR_ARGS][MAX_BOOK_SIZE], char sep)
 {
+	int fits = 1;
+
 	// The first token
 	char *tok = my_strtok(line, "\n ");
 
 	// Goes through all tokens
-	while (tok) {
+	while (tok && *argc < NR_ARGS) {
 		// The separator sep is detected at the beginning of a token
-		if (tok && tok[0] == sep) {
-			// sep is deleted
-			memmove(tok, tok + 1, strlen(tok) - 1);
-			tok[strlen(tok) - 1] = '\0';
+		if (tok[0] == sep) {
+			// sep is skipped
+			++tok;
 			/* Until sep is found at the end of a token, appends the
-			 * following tokens to the zoriginal one, in which sep was detected
+			 * following tokens to the original one, in which sep was detected
 			 */
-			while (tok[strlen(tok) - 1] != '"') {
-				strncat(argv[(*argc)], tok, strlen(tok) + 1);
-				strncat(argv[(*argc)], " ", strlen(" ") + 1);
+			while (tok && (!tok[0] || tok[strlen(tok) - 1] != sep)) {
+				fits &= append_arg(argv[*argc], tok, strlen(tok));
+				fits &= append_arg(argv[*argc], " ", 1);
 				tok = my_strtok(NULL, "\n ");
 			}
-			strncat(argv[(*argc)], tok, strlen(tok) - 1);
+			// The line may end before sep is closed
+			if (!tok) {
+				++(*argc);
+				return fits;
+			}
+			fits &= append_arg(argv[*argc], tok, strlen(tok) - 1);
 
 			// The argument count ++
 			++(*argc);
 
 			// Gets the next token
 			tok = my_strtok(NULL, "\n ");
-			if (!tok) {
-				return;
-			}
+			if (!tok || *argc == NR_ARGS)
+				return fits;
 		}
 		// Copies the token into the vector of arguments
-		memcpy(argv[(*argc)], tok, MAX_DEF_NAME_SIZE);
+		fits &= append_arg(argv[*argc], tok, strlen(tok));
 		// The argument count ++
 		++(*argc);
 		// Gets the next token
 		tok = my_strtok(NULL, "\n ");
 	}
+
+	return fits;
+}
+
+/**
+ * @brief Parses a non-negative decimal number, which must be all of str
+ *
+ * @param str the string
+ * @param val receives the number
+ * @return int 1 on success, 0 if str is not such a number or is too big
+ */
+int
+parse_uint(const char *str, uint *val)
+{
+	// strtoul would take a sign, or spaces in front of the digits
+	if (*str < '0' || *str > '9')
+		return 0;
+
+	char *end;
+	errno = 0;
+	unsigned long value = strtoul(str, &end, 10);
+	if (errno || *end || value > UINT_MAX)
+		return 0;
+
+	*val = value;
+	return 1;
 }
@@ -17,6 +17,13 @@
 		}										\
 	} while (0)
 
+// Hints the CPU to start loading the memory at addr (no-op where unsupported)
+#ifdef __GNUC__
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr) ((void)(addr))
+#endif
+
 // Lots of useful defines
 #define LINE_SIZE 256
 #define MAX_BOOK_SIZE 40
@@ -25,6 +32,7 @@
 #define uint unsigned int
 #define NR_ARGS 100
 #define LOAD_FACTOR 1
+#define SHRINK_FACTOR 0.25
 
 // The string that marks a user with no book borrowed:
 #define INIT_STR "n0_B00k_F04_y0U"
@@ -38,8 +46,11 @@ my_strtok(char *srcString, char *delim);
 char *
 my_strtok(char *str, char *delim);
 
-void
+int
 break_down_line(char *line, int *argc,
 	char argv[NR_ARGS][MAX_BOOK_SIZE], char sep);
 
+int
+parse_uint(const char *str, uint *val);
+
 #endif  // UTILS_H_